@@ -0,0 +1,314 @@
+#include "array_ops.h"
+
+#if defined(__AVX__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Every kernel runs over whole vectors of I32_LANES or F64_LANES items
+ * and finishes the rest (or everything, if there are no vector
+ * instructions) in a scalar loop. The loads and stores are unaligned,
+ * the arrays are malloc'd and can be shorter than a vector anyway.
+ *
+ * Integer vectors need AVX2 or SSE4.1 (multiplication and min/max of
+ * 32 bit lanes), doubles have them since SSE2.
+ */
+#if defined(__AVX2__)
+#define I32_LANES 8
+typedef __m256i i32v;
+#define i32v_load(p) _mm256_loadu_si256((const __m256i*)(p))
+#define i32v_store(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+#define i32v_set1(x) _mm256_set1_epi32(x)
+#define i32v_add(a, b) _mm256_add_epi32((a), (b))
+#define i32v_mul(a, b) _mm256_mullo_epi32((a), (b))
+#define i32v_min(a, b) _mm256_min_epi32((a), (b))
+#define i32v_max(a, b) _mm256_max_epi32((a), (b))
+#elif defined(__SSE4_1__)
+#define I32_LANES 4
+typedef __m128i i32v;
+#define i32v_load(p) _mm_loadu_si128((const __m128i*)(p))
+#define i32v_store(p, v) _mm_storeu_si128((__m128i*)(p), (v))
+#define i32v_set1(x) _mm_set1_epi32(x)
+#define i32v_add(a, b) _mm_add_epi32((a), (b))
+#define i32v_mul(a, b) _mm_mullo_epi32((a), (b))
+#define i32v_min(a, b) _mm_min_epi32((a), (b))
+#define i32v_max(a, b) _mm_max_epi32((a), (b))
+#endif
+
+#if defined(__AVX__)
+#define F64_LANES 4
+typedef __m256d f64v;
+#define f64v_load(p) _mm256_loadu_pd(p)
+#define f64v_store(p, v) _mm256_storeu_pd((p), (v))
+#define f64v_set1(x) _mm256_set1_pd(x)
+#define f64v_add(a, b) _mm256_add_pd((a), (b))
+#define f64v_mul(a, b) _mm256_mul_pd((a), (b))
+#define f64v_min(a, b) _mm256_min_pd((a), (b))
+#define f64v_max(a, b) _mm256_max_pd((a), (b))
+#elif defined(__SSE2__)
+#define F64_LANES 2
+typedef __m128d f64v;
+#define f64v_load(p) _mm_loadu_pd(p)
+#define f64v_store(p, v) _mm_storeu_pd((p), (v))
+#define f64v_set1(x) _mm_set1_pd(x)
+#define f64v_add(a, b) _mm_add_pd((a), (b))
+#define f64v_mul(a, b) _mm_mul_pd((a), (b))
+#define f64v_min(a, b) _mm_min_pd((a), (b))
+#define f64v_max(a, b) _mm_max_pd((a), (b))
+#endif
+
+// The scalar integer operations go through u32, signed overflow is undefined.
+static inline i32 wrap_add(i32 a, i32 b) {
+    return (i32)((u32)a + (u32)b);
+}
+
+static inline i32 wrap_mul(i32 a, i32 b) {
+    return (i32)((u32)a * (u32)b);
+}
+
+i32 i32_sum(const i32* a, u32 n) {
+    i32 s = 0;
+    u32 i = 0;
+#ifdef I32_LANES
+    i32v acc = i32v_set1(0);
+    for (; i + I32_LANES <= n; i += I32_LANES) {
+        acc = i32v_add(acc, i32v_load(a + i));
+    }
+    i32 lanes[I32_LANES];
+    i32v_store(lanes, acc);
+    for (u32 l = 0; l < I32_LANES; ++l) {
+        s = wrap_add(s, lanes[l]);
+    }
+#endif
+    for (; i < n; ++i) {
+        s = wrap_add(s, a[i]);
+    }
+    return s;
+}
+
+i32 i32_min(const i32* a, u32 n) {
+    i32 m = a[0];
+    u32 i = 0;
+#ifdef I32_LANES
+    if (n >= I32_LANES) {
+        i32v acc = i32v_load(a);
+        for (i = I32_LANES; i + I32_LANES <= n; i += I32_LANES) {
+            acc = i32v_min(acc, i32v_load(a + i));
+        }
+        i32 lanes[I32_LANES];
+        i32v_store(lanes, acc);
+        for (u32 l = 0; l < I32_LANES; ++l) {
+            m = lanes[l] < m ? lanes[l] : m;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        m = a[i] < m ? a[i] : m;
+    }
+    return m;
+}
+
+i32 i32_max(const i32* a, u32 n) {
+    i32 m = a[0];
+    u32 i = 0;
+#ifdef I32_LANES
+    if (n >= I32_LANES) {
+        i32v acc = i32v_load(a);
+        for (i = I32_LANES; i + I32_LANES <= n; i += I32_LANES) {
+            acc = i32v_max(acc, i32v_load(a + i));
+        }
+        i32 lanes[I32_LANES];
+        i32v_store(lanes, acc);
+        for (u32 l = 0; l < I32_LANES; ++l) {
+            m = lanes[l] > m ? lanes[l] : m;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        m = a[i] > m ? a[i] : m;
+    }
+    return m;
+}
+
+i32 i32_dot(const i32* a, const i32* b, u32 n) {
+    i32 s = 0;
+    u32 i = 0;
+#ifdef I32_LANES
+    i32v acc = i32v_set1(0);
+    for (; i + I32_LANES <= n; i += I32_LANES) {
+        acc = i32v_add(acc, i32v_mul(i32v_load(a + i), i32v_load(b + i)));
+    }
+    i32 lanes[I32_LANES];
+    i32v_store(lanes, acc);
+    for (u32 l = 0; l < I32_LANES; ++l) {
+        s = wrap_add(s, lanes[l]);
+    }
+#endif
+    for (; i < n; ++i) {
+        s = wrap_add(s, wrap_mul(a[i], b[i]));
+    }
+    return s;
+}
+
+void i32_add(i32* dst, const i32* a, const i32* b, u32 n) {
+    u32 i = 0;
+#ifdef I32_LANES
+    for (; i + I32_LANES <= n; i += I32_LANES) {
+        i32v_store(dst + i, i32v_add(i32v_load(a + i), i32v_load(b + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = wrap_add(a[i], b[i]);
+    }
+}
+
+void i32_mul(i32* dst, const i32* a, const i32* b, u32 n) {
+    u32 i = 0;
+#ifdef I32_LANES
+    for (; i + I32_LANES <= n; i += I32_LANES) {
+        i32v_store(dst + i, i32v_mul(i32v_load(a + i), i32v_load(b + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = wrap_mul(a[i], b[i]);
+    }
+}
+
+void i32_fill(i32* dst, i32 v, u32 n) {
+    u32 i = 0;
+#ifdef I32_LANES
+    i32v vv = i32v_set1(v);
+    for (; i + I32_LANES <= n; i += I32_LANES) {
+        i32v_store(dst + i, vv);
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = v;
+    }
+}
+
+double f64_sum(const double* a, u32 n) {
+    double s = 0;
+    u32 i = 0;
+#ifdef F64_LANES
+    f64v acc = f64v_set1(0);
+    for (; i + F64_LANES <= n; i += F64_LANES) {
+        acc = f64v_add(acc, f64v_load(a + i));
+    }
+    double lanes[F64_LANES];
+    f64v_store(lanes, acc);
+    for (u32 l = 0; l < F64_LANES; ++l) {
+        s += lanes[l];
+    }
+#endif
+    for (; i < n; ++i) {
+        s += a[i];
+    }
+    return s;
+}
+
+// min_pd(x, m) is 'x < m ? x : m', the scalar loops compare the same way.
+double f64_min(const double* a, u32 n) {
+    double m = a[0];
+    u32 i = 0;
+#ifdef F64_LANES
+    if (n >= F64_LANES) {
+        f64v acc = f64v_load(a);
+        for (i = F64_LANES; i + F64_LANES <= n; i += F64_LANES) {
+            acc = f64v_min(f64v_load(a + i), acc);
+        }
+        double lanes[F64_LANES];
+        f64v_store(lanes, acc);
+        for (u32 l = 0; l < F64_LANES; ++l) {
+            m = lanes[l] < m ? lanes[l] : m;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        m = a[i] < m ? a[i] : m;
+    }
+    return m;
+}
+
+double f64_max(const double* a, u32 n) {
+    double m = a[0];
+    u32 i = 0;
+#ifdef F64_LANES
+    if (n >= F64_LANES) {
+        f64v acc = f64v_load(a);
+        for (i = F64_LANES; i + F64_LANES <= n; i += F64_LANES) {
+            acc = f64v_max(f64v_load(a + i), acc);
+        }
+        double lanes[F64_LANES];
+        f64v_store(lanes, acc);
+        for (u32 l = 0; l < F64_LANES; ++l) {
+            m = lanes[l] > m ? lanes[l] : m;
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        m = a[i] > m ? a[i] : m;
+    }
+    return m;
+}
+
+double f64_dot(const double* a, const double* b, u32 n) {
+    double s = 0;
+    u32 i = 0;
+#ifdef F64_LANES
+    f64v acc = f64v_set1(0);
+    for (; i + F64_LANES <= n; i += F64_LANES) {
+        acc = f64v_add(acc, f64v_mul(f64v_load(a + i), f64v_load(b + i)));
+    }
+    double lanes[F64_LANES];
+    f64v_store(lanes, acc);
+    for (u32 l = 0; l < F64_LANES; ++l) {
+        s += lanes[l];
+    }
+#endif
+    for (; i < n; ++i) {
+        s += a[i] * b[i];
+    }
+    return s;
+}
+
+void f64_add(double* dst, const double* a, const double* b, u32 n) {
+    u32 i = 0;
+#ifdef F64_LANES
+    for (; i + F64_LANES <= n; i += F64_LANES) {
+        f64v_store(dst + i, f64v_add(f64v_load(a + i), f64v_load(b + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = a[i] + b[i];
+    }
+}
+
+void f64_mul(double* dst, const double* a, const double* b, u32 n) {
+    u32 i = 0;
+#ifdef F64_LANES
+    for (; i + F64_LANES <= n; i += F64_LANES) {
+        f64v_store(dst + i, f64v_mul(f64v_load(a + i), f64v_load(b + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = a[i] * b[i];
+    }
+}
+
+void f64_fill(double* dst, double v, u32 n) {
+    u32 i = 0;
+#ifdef F64_LANES
+    f64v vv = f64v_set1(v);
+    for (; i + F64_LANES <= n; i += F64_LANES) {
+        f64v_store(dst + i, vv);
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = v;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+/// Bulk operations on the packed arrays of numbers (see object_array),
+/// the array natives are thin wrappers around them.
+///
+/// The kernels use SSE/AVX when the compiler targets them (build with
+/// -DNATIVE_ARCH=ON to get AVX) and plain loops otherwise. Integer
+/// arithmetic wraps around like in the interpreter. The sums of doubles
+/// are computed in several lanes at once, so they can differ in the last
+/// bits from adding the items one by one.
+#include "common.h"
+
+i32 i32_sum(const i32* a, u32 n);
+
+/// 'n' must not be 0.
+i32 i32_min(const i32* a, u32 n);
+
+/// 'n' must not be 0.
+i32 i32_max(const i32* a, u32 n);
+
+i32 i32_dot(const i32* a, const i32* b, u32 n);
+
+/// dst[i] = a[i] + b[i], 'dst' may be one of the operands.
+void i32_add(i32* dst, const i32* a, const i32* b, u32 n);
+
+/// dst[i] = a[i] * b[i], 'dst' may be one of the operands.
+void i32_mul(i32* dst, const i32* a, const i32* b, u32 n);
+
+void i32_fill(i32* dst, i32 v, u32 n);
+
+double f64_sum(const double* a, u32 n);
+
+/// 'n' must not be 0.
+double f64_min(const double* a, u32 n);
+
+/// 'n' must not be 0.
+double f64_max(const double* a, u32 n);
+
+double f64_dot(const double* a, const double* b, u32 n);
+
+/// dst[i] = a[i] + b[i], 'dst' may be one of the operands.
+void f64_add(double* dst, const double* a, const double* b, u32 n);
+
+/// dst[i] = a[i] * b[i], 'dst' may be one of the operands.
+void f64_mul(double* dst, const double* a, const double* b, u32 n);
+
+void f64_fill(double* dst, double v, u32 n);
@@ -1,6 +1,7 @@
 #include "bytecode.h"
 #include "common.h"
 #include "memory.h"
+#include "globals.h"
 #include "object.h"
 
 #include <string.h>
@@ -13,11 +14,23 @@ void init_bc_chunk(struct bc_chunk* c) {
     c->location = 0;
     c->location_cap = 0;
     c->location_len = 0;
+
+    c->code = NULL;
+    c->code_len = 0;
+
+    c->caches = NULL;
+    c->caches_len = 0;
+
+    c->method_caches = NULL;
+    c->method_caches_len = 0;
 }
 
 void free_bc_chunk(struct bc_chunk* c) {
-    free(c->data);
-    free(c->location);
+    mem_free(c->data);
+    mem_free(c->location);
+    mem_free(c->code);
+    mem_free(c->caches);
+    mem_free(c->method_caches);
     init_bc_chunk(c);
 }
 
@@ -42,6 +55,10 @@ size_t ins_size(enum opcode op) {
         case OP_IGREATEREQ:
         case OP_INEG:
         case OP_PUSH_NONE:
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+        case OP_LIST_LEN:
+        case OP_LIST_APPEND:
             return 1;
         case OP_DROPN:
         case OP_PUSH_BOOL:
@@ -51,14 +68,15 @@ size_t ins_size(enum opcode op) {
         case OP_PUSH_SHORT:
         case OP_JMP_SHORT:
         case OP_BRANCH_SHORT:
+        case OP_BRANCH_FALSE_SHORT:
         case OP_SET_LOCAL:
         case OP_GET_LOCAL:
+        case OP_NEW_LIST:
             return 3;
         case OP_PUSH_INT:
         case OP_JMP:
         case OP_BRANCH:
         case OP_BRANCH_FALSE:
-        case OP_BRANCH_FALSE_SHORT:
         case OP_GET_GLOBAL:
         case OP_SET_GLOBAL:
         case OP_VAL_GLOBAL:
@@ -70,6 +88,46 @@ size_t ins_size(enum opcode op) {
             return 5;
         case OP_DISPATCH_METHOD:
             return 6;
+        case OP_R_LOAD_NONE:
+        case OP_R_RETURN:
+            return 3;
+        case OP_R_LOAD_BOOL:
+        case OP_R_CALL_FUNC:
+        case OP_R_PRINT:
+            return 4;
+        case OP_R_MOVE:
+        case OP_R_INEG:
+        case OP_R_LIST_LEN:
+            return 5;
+        case OP_R_LOAD_INT:
+        case OP_R_LOAD_LITERAL:
+        case OP_R_GET_GLOBAL:
+        case OP_R_SET_GLOBAL:
+        case OP_R_VAL_GLOBAL:
+        case OP_R_VAR_GLOBAL:
+        case OP_R_NEW_OBJECT:
+        case OP_R_BRANCH_FALSE:
+        case OP_R_IADD:
+        case OP_R_ISUB:
+        case OP_R_IMUL:
+        case OP_R_IDIV:
+        case OP_R_IMOD:
+        case OP_R_ILESS:
+        case OP_R_ILESSEQ:
+        case OP_R_IGREATER:
+        case OP_R_IGREATEREQ:
+        case OP_R_EQ:
+        case OP_R_NEQ:
+        case OP_R_NEW_LIST:
+        case OP_R_GET_INDEX:
+        case OP_R_SET_INDEX:
+        case OP_R_LIST_APPEND:
+            return 7;
+        case OP_R_DISPATCH_METHOD:
+            return 8;
+        case OP_R_GET_MEMBER:
+        case OP_R_SET_MEMBER:
+            return 9;
         default:
             UNREACHABLE();
     }
@@ -88,7 +146,7 @@ size_t range_between(u8* begin, u8* end) {
 // TODO: Rename to u8, 16...
 
 void write_byte(struct bc_chunk* c, u8 byte) {
-    c->data = handle_capacity(c->data, c->len, &c->cap, sizeof(*c->data));
+    c->data = mem_handle_capacity(MEM_BYTECODE, c->data, c->len, &c->cap, sizeof(*c->data));
     c->data[c->len++] = byte;
 }
 
@@ -103,7 +161,8 @@ void write_dword(struct bc_chunk* c, u32 dword) {
 }
 
 void write_loc(struct bc_chunk* c, u64 begin, u64 end) {
-    c->location = handle_capacity(c->location, c->location_len, &c->location_cap, sizeof(*c->location));
+    c->location = mem_handle_capacity(MEM_BYTECODE, c->location, c->location_len,
+                                      &c->location_cap, sizeof(*c->location));
     c->location[c->location_len].begin = begin;
     c->location[c->location_len++].end = end;
 }
@@ -113,12 +172,12 @@ void init_constant_pool(struct constant_pool* cp) {
 }
 
 void free_constant_pool(struct constant_pool* cp) {
-    free(cp->data);
+    mem_free(cp->data);
     init_constant_pool(cp);
 }
 
 void write_constant_pool(struct constant_pool* cp, struct object* object) {
-    cp->data = handle_capacity(cp->data, cp->len, &cp->cap, sizeof(*cp->data));
+    cp->data = mem_handle_capacity(MEM_BYTECODE, cp->data, cp->len, &cp->cap, sizeof(*cp->data));
     cp->data[cp->len++] = object;
 }
 
@@ -147,3 +206,241 @@ struct object_function* read_function_cp(struct constant_pool* cp, u32 idx) {
     }
     return f;
 }
+
+#define DECODE_4B(p) ((u32)(p)[0] << 24 | (u32)(p)[1] << 16 | (u32)(p)[2] << 8 | (u32)(p)[3])
+#define DECODE_2B(p) ((u16)((p)[0] << 8 | (p)[1]))
+
+static void decode_error(const char* msg, size_t offset) {
+    fprintf(stderr, "Error decoding bytecode at offset %lu: %s\n", offset, msg);
+    exit(5);
+}
+
+static struct instruction* decode_jump(struct bc_chunk* c, size_t* index,
+                                       u32 dest, size_t offset) {
+    if (dest >= c->len || index[dest] == SIZE_MAX) {
+        decode_error("Jump destination is not an instruction", offset);
+    }
+    return &c->code[index[dest]];
+}
+
+bool ins_has_object(enum opcode op) {
+    switch (op) {
+        case OP_PUSH_LITERAL:
+        case OP_NEW_OBJECT:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_VAL_GLOBAL:
+        case OP_VAR_GLOBAL:
+        case OP_R_LOAD_LITERAL:
+        case OP_R_NEW_OBJECT:
+        case OP_R_GET_GLOBAL:
+        case OP_R_SET_GLOBAL:
+        case OP_R_VAL_GLOBAL:
+        case OP_R_VAR_GLOBAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_member_access(u8 op) {
+    return op == OP_GET_MEMBER || op == OP_SET_MEMBER
+        || op == OP_R_GET_MEMBER || op == OP_R_SET_MEMBER;
+}
+
+void decode_chunk(struct bc_chunk* c, struct constant_pool* cp,
+                  struct globals* globals, u8 flags) {
+    bool registers = flags & BC_FLAG_REGISTER;
+    // Maps byte offsets to instruction indexes, so that jumps can be resolved.
+    // Offsets which are not at instruction boundary are set to SIZE_MAX.
+    size_t* index = malloc(sizeof(*index) * (c->len + 1));
+    size_t count = 0;
+    for (size_t i = 0; i < c->len + 1; ++i) {
+        index[i] = SIZE_MAX;
+    }
+    size_t caches = 0;
+    size_t method_caches = 0;
+    for (size_t off = 0; off < c->len; off += ins_size(c->data[off])) {
+        index[off] = count++;
+        caches += is_member_access(c->data[off]);
+        method_caches += c->data[off] == OP_DISPATCH_METHOD
+                      || c->data[off] == OP_R_DISPATCH_METHOD;
+    }
+
+    mem_free(c->code);
+    c->code = mem_alloc(MEM_BYTECODE, sizeof(*c->code) * count);
+    c->code_len = count;
+    mem_free(c->caches);
+    c->caches = mem_calloc(MEM_BYTECODE, caches, sizeof(*c->caches));
+    c->caches_len = 0;
+    mem_free(c->method_caches);
+    c->method_caches = mem_calloc(MEM_BYTECODE, method_caches, sizeof(*c->method_caches));
+    c->method_caches_len = 0;
+
+    for (size_t off = 0; off < c->len; off += ins_size(c->data[off])) {
+        u8* p = c->data + off;
+        struct instruction* ins = &c->code[index[off]];
+        ins->op = *p;
+        ins->reg = 0;
+        ins->arg = 0;
+        ins->object = NULL;
+        // Unconditional jump is shared by both instruction sets
+        bool shared = *p == OP_JMP || *p == OP_JMP_SHORT;
+        if (!shared && IS_REGISTER_OP(*p) != registers) {
+            decode_error(registers ? "Stack instruction in register bytecode"
+                                   : "Register instruction in stack bytecode", off);
+        }
+        switch (*p) {
+            case OP_PUSH_SHORT:
+                ins->op = OP_PUSH_INT;
+                ins->arg = (i32)(i16)DECODE_2B(p + 1);
+                break;
+            case OP_PUSH_INT:
+                ins->arg = DECODE_4B(p + 1);
+                break;
+            case OP_PUSH_BOOL:
+            case OP_PRINT:
+            case OP_DROPN:
+            case OP_CALL_FUNC:
+                ins->arg = p[1];
+                break;
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_NEW_LIST:
+                ins->arg = DECODE_2B(p + 1);
+                break;
+            case OP_PUSH_LITERAL:
+            case OP_NEW_OBJECT:
+                ins->arg = DECODE_4B(p + 1);
+                ins->object = read_constant_pool(cp, ins->arg);
+                break;
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_VAL_GLOBAL:
+            case OP_VAR_GLOBAL:
+                ins->object = read_constant_pool(cp, DECODE_4B(p + 1));
+                ins->arg = resolve_global(globals, NEW_OBJECT(ins->object));
+                break;
+            case OP_GET_MEMBER:
+            case OP_SET_MEMBER:
+                ins->arg = DECODE_4B(p + 1);
+                ins->cache = &c->caches[c->caches_len++];
+                ins->cache->name = read_constant_pool(cp, ins->arg);
+                break;
+            case OP_DISPATCH_METHOD:
+                ins->method = &c->method_caches[c->method_caches_len++];
+                ins->method->name = read_constant_pool(cp, DECODE_4B(p + 1));
+                ins->arg = p[5];
+                break;
+            case OP_JMP_SHORT:
+            case OP_BRANCH_SHORT:
+            case OP_BRANCH_FALSE_SHORT:
+            case OP_JMP:
+            case OP_BRANCH:
+            case OP_BRANCH_FALSE: {
+                bool shrt = *p == OP_JMP_SHORT || *p == OP_BRANCH_SHORT
+                         || *p == OP_BRANCH_FALSE_SHORT;
+                u32 dest = shrt ? DECODE_2B(p + 1) : DECODE_4B(p + 1);
+                ins->target = decode_jump(c, index, dest, off);
+                if (*p == OP_JMP_SHORT) {
+                    ins->op = OP_JMP;
+                } else if (*p == OP_BRANCH_SHORT) {
+                    ins->op = OP_BRANCH;
+                } else if (*p == OP_BRANCH_FALSE_SHORT) {
+                    ins->op = OP_BRANCH_FALSE;
+                }
+                break;
+            }
+            case OP_R_LOAD_NONE:
+            case OP_R_RETURN:
+                ins->reg = DECODE_2B(p + 1);
+                break;
+            case OP_R_LOAD_BOOL:
+            case OP_R_CALL_FUNC:
+            case OP_R_PRINT:
+                ins->reg = DECODE_2B(p + 1);
+                ins->arg = p[3];
+                break;
+            case OP_R_MOVE:
+            case OP_R_INEG:
+            case OP_R_LIST_LEN:
+                ins->reg = DECODE_2B(p + 1);
+                ins->lhs = DECODE_2B(p + 3);
+                break;
+            case OP_R_LOAD_INT:
+                ins->reg = DECODE_2B(p + 1);
+                ins->arg = DECODE_4B(p + 3);
+                break;
+            case OP_R_LOAD_LITERAL:
+            case OP_R_NEW_OBJECT:
+                ins->reg = DECODE_2B(p + 1);
+                ins->arg = DECODE_4B(p + 3);
+                ins->object = read_constant_pool(cp, ins->arg);
+                break;
+            case OP_R_GET_GLOBAL:
+            case OP_R_SET_GLOBAL:
+            case OP_R_VAL_GLOBAL:
+            case OP_R_VAR_GLOBAL:
+                ins->reg = DECODE_2B(p + 1);
+                ins->object = read_constant_pool(cp, DECODE_4B(p + 3));
+                ins->arg = resolve_global(globals, NEW_OBJECT(ins->object));
+                break;
+            case OP_R_BRANCH_FALSE:
+                ins->reg = DECODE_2B(p + 1);
+                ins->target = decode_jump(c, index, DECODE_4B(p + 3), off);
+                break;
+            case OP_R_IADD:
+            case OP_R_ISUB:
+            case OP_R_IMUL:
+            case OP_R_IDIV:
+            case OP_R_IMOD:
+            case OP_R_ILESS:
+            case OP_R_ILESSEQ:
+            case OP_R_IGREATER:
+            case OP_R_IGREATEREQ:
+            case OP_R_EQ:
+            case OP_R_NEQ:
+            case OP_R_NEW_LIST:
+            case OP_R_GET_INDEX:
+            case OP_R_SET_INDEX:
+            case OP_R_LIST_APPEND:
+                ins->reg = DECODE_2B(p + 1);
+                ins->lhs = DECODE_2B(p + 3);
+                ins->rhs = DECODE_2B(p + 5);
+                break;
+            case OP_R_DISPATCH_METHOD:
+                ins->reg = DECODE_2B(p + 1);
+                ins->method = &c->method_caches[c->method_caches_len++];
+                ins->method->name = read_constant_pool(cp, DECODE_4B(p + 3));
+                ins->arg = p[7];
+                break;
+            case OP_R_GET_MEMBER:
+            case OP_R_SET_MEMBER:
+                ins->reg = DECODE_2B(p + 1);
+                ins->arg = DECODE_2B(p + 3);
+                ins->cache = &c->caches[c->caches_len++];
+                ins->cache->name = read_constant_pool(cp, DECODE_4B(p + 5));
+                break;
+            default:
+                break;
+        }
+    }
+    free(index);
+}
+
+void decode_constant_pool(struct constant_pool* cp, struct globals* globals, u8 flags) {
+    for (size_t i = 0; i < cp->len; ++i) {
+        struct object_function* f = as_function_s(cp->data[i]);
+        if (f != NULL) {
+            decode_chunk(&f->bc, cp, globals, flags);
+        }
+    }
+}
+
+u8* instruction_bytes(struct bc_chunk* c, size_t idx) {
+    u8* p = c->data;
+    while (idx-- > 0) {
+        p += ins_size(*p);
+    }
+    return p;
+}
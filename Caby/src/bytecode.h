@@ -3,9 +3,12 @@
 #include "common.h"
 
 #include <stdlib.h>
+#include <stdbool.h>
 
 // forward decl
 struct object;
+struct object_class;
+struct globals;
 
 enum opcode {
     OP_RETURN = 0x09,
@@ -55,10 +58,64 @@ enum opcode {
     OP_GET_MEMBER = 0x61,
     OP_SET_MEMBER = 0x62,
     OP_DISPATCH_METHOD= 0x63,
+    OP_NEW_LIST = 0x64,
+    OP_GET_INDEX = 0x65,
+    OP_SET_INDEX = 0x66,
+    OP_LIST_LEN = 0x67,
+    OP_LIST_APPEND = 0x68,
+
+    // Register instructions, their operands are slots of the current frame.
+    OP_R_MOVE = 0x80,
+    OP_R_LOAD_INT = 0x81,
+    OP_R_LOAD_BOOL = 0x82,
+    OP_R_LOAD_NONE = 0x83,
+    OP_R_LOAD_LITERAL = 0x84,
+    OP_R_GET_GLOBAL = 0x85,
+    OP_R_SET_GLOBAL = 0x86,
+    OP_R_VAL_GLOBAL = 0x87,
+    OP_R_VAR_GLOBAL = 0x88,
+    OP_R_BRANCH_FALSE = 0x8E,
+
+    OP_R_IADD = 0x90,
+    OP_R_ISUB = 0x91,
+    OP_R_IMUL = 0x92,
+    OP_R_IDIV = 0x93,
+    OP_R_IMOD = 0x94,
+    OP_R_ILESS = 0x97,
+    OP_R_ILESSEQ = 0x98,
+    OP_R_IGREATER = 0x99,
+    OP_R_IGREATEREQ = 0x9A,
+    OP_R_EQ = 0x9B,
+    OP_R_INEG = 0x9C,
+    OP_R_NEQ = 0x9D,
+
+    OP_R_CALL_FUNC = 0xA0,
+    OP_R_DISPATCH_METHOD = 0xA1,
+    OP_R_PRINT = 0xA2,
+    OP_R_RETURN = 0xA3,
+    OP_R_NEW_OBJECT = 0xA4,
+    OP_R_GET_MEMBER = 0xA5,
+    OP_R_SET_MEMBER = 0xA6,
+    OP_R_NEW_LIST = 0xA7,
+    OP_R_GET_INDEX = 0xA8,
+    OP_R_SET_INDEX = 0xA9,
+    OP_R_LIST_LEN = 0xAA,
+    OP_R_LIST_APPEND = 0xAB,
 };
 
+/// Bytecode file starts with the magic followed by one byte of flags.
+#define BC_HEADER_MAGIC "CAML"
+/// The code consists of register instructions instead of the stack ones.
+#define BC_FLAG_REGISTER 0x01
+
+/// Returns true if the instruction belongs to the register instruction set.
+#define IS_REGISTER_OP(op) ((op) >= OP_R_MOVE)
+
 size_t ins_size(enum opcode op);
 
+/// Returns true if the decoded instruction keeps a constant in 'object'.
+bool ins_has_object(enum opcode op);
+
 /// Calculates how many instruction are between begin and end
 /// (begin is the lower address).
 size_t range_between(u8* begin, u8* end);
@@ -68,6 +125,86 @@ struct loc {
     u64 end;
 };
 
+/// Number of shapes one inline cache remembers.
+#define INLINE_CACHE_WAYS 4
+
+struct shape;
+
+/**
+ * Inline cache of one member access instruction.
+ *
+ * The shape of an instance determines the slot of each of its members.
+ * The cache remembers the slot for the last few shapes seen by the
+ * instruction, a hit only compares the shape pointer. With one shape
+ * the cache is monomorphic, with more it is polymorphic.
+ *
+ * Set_member that adds a member also remembers the transition, the
+ * next instance in the same shape then gets the member without a lookup.
+ */
+struct inline_cache {
+    /// Name of the member (string from the constant pool).
+    struct object* name;
+    u8 len;
+    struct {
+        struct shape* shape;
+        /// Shape after adding the member, NULL if the shape has it already.
+        struct shape* transition;
+        u32 slot;
+    } ways[INLINE_CACHE_WAYS];
+};
+
+/**
+ * Cache of one method dispatch instruction.
+ *
+ * Remembers the method resolved for the last few classes of the receiver,
+ * a hit compares the class and calls the function directly without
+ * looking up the method by name.
+ */
+struct method_cache {
+    /// Name of the method (string from the constant pool).
+    struct object* name;
+    u8 len;
+    struct {
+        struct object_class* klass;
+        struct object_function* method;
+    } ways[INLINE_CACHE_WAYS];
+};
+
+/**
+ * Instruction in the form that is executed by the VM.
+ *
+ * The serialized bytecode is decoded into these when the program is
+ * loaded, so that the interpreter does not have to reassemble big endian
+ * operands over and over again. All of them have the same size, operands
+ * are native integers and jumps and constant pool indexes are already
+ * resolved into pointers.
+ *
+ * Short and long variants of instructions are decoded into the normal
+ * variant (ie. push_short becomes push_int).
+ */
+struct instruction {
+    u16 op;
+    /// Destination (or the only) slot of register instructions.
+    u16 reg;
+    /// Integer literal, local slot, number of arguments or constant pool index.
+    u32 arg;
+    union {
+        /// Jump destination.
+        struct instruction* target;
+        /// Resolved constant pool entry.
+        struct object* object;
+        /// Member access instructions, the cache holds the member name.
+        struct inline_cache* cache;
+        /// Method dispatch instructions, the cache holds the method name.
+        struct method_cache* method;
+        /// Operands of the binary register instructions.
+        struct {
+            u16 lhs;
+            u16 rhs;
+        };
+    };
+};
+
 struct bc_chunk {
     u8* data;
     size_t len;
@@ -76,6 +213,17 @@ struct bc_chunk {
     struct loc* location;
     size_t location_len;
     size_t location_cap;
+
+    /// Decoded instructions, NULL until decode_chunk is called.
+    /// The i-th instruction corresponds to the i-th location.
+    struct instruction* code;
+    size_t code_len;
+    /// Inline caches of member access instructions in 'code'.
+    struct inline_cache* caches;
+    size_t caches_len;
+    /// Caches of method dispatch instructions in 'code'.
+    struct method_cache* method_caches;
+    size_t method_caches_len;
 };
 
 struct constant_pool {
@@ -108,3 +256,17 @@ struct object* read_constant_pool(struct constant_pool* cp, u32 idx);
 struct object_string* read_string_cp(struct constant_pool* cp, u32 idx);
 
 struct object_function* read_function_cp(struct constant_pool* cp, u32 idx);
+
+/// Decodes the bytecode of the chunk into 'code'. Constant pool indexes
+/// are resolved against 'cp', so it has to be fully loaded. 'flags' are
+/// the header flags, the code may only contain instructions of the
+/// instruction set given by them. Names of globals are resolved to
+/// their slots in 'globals'.
+void decode_chunk(struct bc_chunk* c, struct constant_pool* cp,
+                  struct globals* globals, u8 flags);
+
+/// Decodes bytecode of all functions in the constant pool.
+void decode_constant_pool(struct constant_pool* cp, struct globals* globals, u8 flags);
+
+/// Returns pointer to the serialized form of the idx-th instruction.
+u8* instruction_bytes(struct bc_chunk* c, size_t idx);
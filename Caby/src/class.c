@@ -1,15 +1,73 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "class.h"
 #include "object.h"
+#include "memory.h"
 
+static struct shape* new_shape(struct shape* parent, struct object* name) {
+    struct shape* shape = mem_alloc(MEM_OBJECTS, sizeof(*shape));
+    shape->parent = parent;
+    shape->name = name;
+    shape->count = parent == NULL ? 0 : parent->count + 1;
+    shape->children = NULL;
+    shape->sibling = NULL;
+    return shape;
+}
 
-struct object_class* new_class(vm_t* vm, u32 name, struct table methods) {
-    struct object_class* klass = vmalloc(vm, sizeof(*klass));
+static void free_shape(struct shape* shape) {
+    struct shape* child = shape->children;
+    while (child != NULL) {
+        struct shape* next = child->sibling;
+        free_shape(child);
+        child = next;
+    }
+    mem_free(shape);
+}
+
+struct object_class* new_class(vm_t* vm, u32 name, u16 methods_len) {
+    struct object_class* klass =
+        vmalloc(vm, sizeof(*klass) + methods_len * sizeof(*klass->method_names));
     klass->name = name;
-    klass->methods = methods;
+    init_table(&klass->methods);
+    klass->vtable = mem_alloc(MEM_OBJECTS, methods_len * sizeof(*klass->vtable));
+    klass->vtable_len = 0;
+    klass->shape = new_shape(NULL, NULL);
+    klass->slots_hint = 0;
     init_object(vm, &klass->object, OBJECT_CLASS);
     return klass;
 }
 
+void class_add_method(struct object_class* klass, struct object* name,
+                      struct object_function* f) {
+    klass->method_names[klass->vtable_len] = name;
+    klass->vtable[klass->vtable_len++] = f;
+    if (klass->vtable_len == CLASS_SMALL_METHODS + 1) {
+        for (u16 i = 0; i < klass->vtable_len; ++i) {
+            table_set(&klass->methods, NEW_OBJECT(klass->method_names[i]), NEW_INT(i));
+        }
+    } else if (klass->vtable_len > CLASS_SMALL_METHODS) {
+        table_set(&klass->methods, NEW_OBJECT(name), NEW_INT(klass->vtable_len - 1));
+    }
+}
+
+struct object_function* class_find_method(struct object_class* klass, struct object* name) {
+    if (klass->vtable_len <= CLASS_SMALL_METHODS) {
+        // Method names are interned, comparing the pointers is enough
+        for (u16 i = 0; i < klass->vtable_len; ++i) {
+            if (klass->method_names[i] == name) {
+                return klass->vtable[i];
+            }
+        }
+        return NULL;
+    }
+    struct value idx;
+    if (!table_get(&klass->methods, NEW_OBJECT(name), &idx)) {
+        return NULL;
+    }
+    return klass->vtable[AS_CINT(idx)];
+}
+
 struct object_class* as_class(struct object* object) {
     return (struct object_class*)object;
 }
@@ -21,10 +79,20 @@ struct object_class* as_class_s(struct object* object) {
     return NULL;
 }
 
+void free_class(struct object_class* klass) {
+    free_table(&klass->methods);
+    mem_free(klass->vtable);
+    free_shape(klass->shape);
+}
+
 struct object_instance* new_instance(vm_t* vm, struct object_class* klass) {
-    struct object_instance* instance = vmalloc(vm, sizeof(*instance));
+    u32 capacity = klass->slots_hint;
+    struct object_instance* instance =
+        vmalloc(vm, sizeof(*instance) + capacity * sizeof(struct value));
     instance->klass = klass;
-    init_table(&instance->members);
+    instance->shape = klass->shape;
+    instance->slots = instance->inline_slots;
+    instance->capacity = capacity;
     init_object(vm, &instance->object, OBJECT_INSTANCE);
     return instance;
 }
@@ -39,3 +107,48 @@ struct object_instance* as_instance_s(struct object* object) {
     }
     return NULL;
 }
+
+void free_instance(struct object_instance* instance) {
+    if (instance->slots != instance->inline_slots) {
+        mem_free(instance->slots);
+    }
+}
+
+int shape_find(struct shape* shape, struct object* name) {
+    for (; shape->name != NULL; shape = shape->parent) {
+        if (shape->name == name) {
+            return shape->count - 1;
+        }
+    }
+    return -1;
+}
+
+struct shape* shape_add(struct shape* shape, struct object* name) {
+    for (struct shape* child = shape->children; child != NULL; child = child->sibling) {
+        if (child->name == name) {
+            return child;
+        }
+    }
+    struct shape* child = new_shape(shape, name);
+    child->sibling = shape->children;
+    shape->children = child;
+    return child;
+}
+
+void instance_transition(struct object_instance* instance, struct shape* to, struct value v) {
+    if (to->count > instance->capacity) {
+        u32 capacity = instance->capacity < 4 ? 4 : instance->capacity * 2;
+        struct value* slots = mem_alloc(MEM_OBJECTS, capacity * sizeof(*slots));
+        memcpy(slots, instance->slots, instance->shape->count * sizeof(*slots));
+        if (instance->slots != instance->inline_slots) {
+            mem_free(instance->slots);
+        }
+        instance->slots = slots;
+        instance->capacity = capacity;
+    }
+    instance->slots[to->count - 1] = v;
+    instance->shape = to;
+    if (to->count > instance->klass->slots_hint) {
+        instance->klass->slots_hint = to->count;
+    }
+}
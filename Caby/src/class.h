@@ -6,28 +6,92 @@
 #include "object.h"
 #include "hashtable.h"
 
+/**
+ * Describes which members an instance has and where they are stored.
+ *
+ * Instances that got the same members in the same order share one shape.
+ * Shapes of a class form a tree, the root is the empty shape and every
+ * other shape is a transition from its parent that adds one member.
+ * The values of members are kept by the instance in a plain array,
+ * the shape only knows their slot indexes.
+ */
+struct shape {
+    struct shape* parent;
+    /// Member added by the transition from parent, NULL in the root.
+    struct object* name;
+    /// Number of members, the added member is in slot 'count - 1'.
+    u32 count;
+    /// Shapes that add one member to this one, linked through 'sibling'.
+    struct shape* children;
+    struct shape* sibling;
+};
+
+/// Classes with at most this many methods find them by a linear search
+/// of 'method_names', only bigger ones build the 'methods' table.
+#define CLASS_SMALL_METHODS 8
+
 struct object_class {
     struct object object;
     u32 name;
+    /// Maps method names to their index in 'vtable', empty unless the class
+    /// has more than CLASS_SMALL_METHODS methods.
     struct table methods;
+    /// Methods of the class, resolved when the class is loaded.
+    struct object_function** vtable;
+    u16 vtable_len;
+    /// Root of the shape tree, owned by the class.
+    struct shape* shape;
+    /// Largest number of members an instance of the class had,
+    /// new instances reserve this many slots.
+    u32 slots_hint;
+    /// Name of every method in 'vtable', allocated together with the class.
+    struct object* method_names[];
 };
 
 struct object_instance {
     struct object object;
     struct object_class* klass;
-    struct table members;
+    struct shape* shape;
+    /// Values of members, 'shape->count' of them are used. Points either
+    /// to 'inline_slots' or, once the instance outgrows them, to a
+    /// separately allocated array.
+    struct value* slots;
+    u32 capacity;
+    struct value inline_slots[];
 };
 
-/// Returns new class, takes ownership of 'name'.
-struct object_class* new_class(vm_t* vm, u32 name, struct table methods);
+/// Returns new class without methods, 'methods_len' is the size of its vtable.
+struct object_class* new_class(vm_t* vm, u32 name, u16 methods_len);
+
+/// Adds method 'f' called 'name' to the next slot of the vtable.
+void class_add_method(struct object_class* klass, struct object* name,
+                      struct object_function* f);
+
+/// Returns method 'name' of the class or NULL if there is no such method.
+struct object_function* class_find_method(struct object_class* klass, struct object* name);
 
 struct object_class* as_class(struct object* object);
 
 struct object_class* as_class_s(struct object* object);
 
+void free_class(struct object_class* klass);
+
 /// Returns new class instance, takes ownership of 'name', but not 'klass'.
 struct object_instance* new_instance(vm_t* vm, struct object_class* klass);
 
 struct object_instance* as_instance(struct object* object);
 
 struct object_instance* as_instance_s(struct object* object);
+
+void free_instance(struct object_instance* instance);
+
+/// Returns slot of member 'name' in shape or -1 if the shape doesn't have it.
+int shape_find(struct shape* shape, struct object* name);
+
+/// Returns shape with member 'name' added to 'shape', the shape
+/// is created the first time the transition is taken.
+struct shape* shape_add(struct shape* shape, struct object* name);
+
+/// Moves instance to shape 'to', which has to be a transition from the
+/// current shape, grows the slots if needed. Value of the new member is set to 'v'.
+void instance_transition(struct object_instance* instance, struct shape* to, struct value v);
@@ -72,6 +72,18 @@ size_t dissasemble_instruction(FILE* f, u8* ins) {
         case OP_PUSH_NONE:
             fprintf(f, "PUSH_NONE");
             return 1;
+        case OP_GET_INDEX:
+            fprintf(f, "GET_INDEX");
+            return 1;
+        case OP_SET_INDEX:
+            fprintf(f, "SET_INDEX");
+            return 1;
+        case OP_LIST_LEN:
+            fprintf(f, "LIST_LEN");
+            return 1;
+        case OP_LIST_APPEND:
+            fprintf(f, "LIST_APPEND");
+            return 1;
         case OP_DROPN:
             fprintf(f, "DROPN %d", ins[1]);
             return 2;
@@ -99,6 +111,9 @@ size_t dissasemble_instruction(FILE* f, u8* ins) {
         case OP_GET_LOCAL:
             fprintf(f, "GET_LOCAL %d", READ_2BYTES_BE(ins + 1));
             return 3;
+        case OP_NEW_LIST:
+            fprintf(f, "NEW_LIST %d", READ_2BYTES_BE(ins + 1));
+            return 3;
         case OP_PUSH_INT:
             fprintf(f, "PUSH_INT %d", READ_4BYTES_BE(ins + 1));
             return 5;
@@ -113,7 +128,7 @@ size_t dissasemble_instruction(FILE* f, u8* ins) {
             return 5;
         case OP_BRANCH_FALSE_SHORT:
             fprintf(f, "BRANCH_FALSE_SHORT %d", READ_2BYTES_BE(ins + 1));
-            return 5;
+            return 3;
         case OP_GET_GLOBAL:
             fprintf(f, "GET_GLOBAL %d", READ_4BYTES_BE(ins + 1));
             return 5;
@@ -141,6 +156,96 @@ size_t dissasemble_instruction(FILE* f, u8* ins) {
         case OP_DISPATCH_METHOD:
             fprintf(f, "DISPATCH_METHOD %d %d", READ_4BYTES_BE(ins + 1), *(ins + 5));
             return 6;
+        case OP_R_MOVE:
+            fprintf(f, "R_MOVE r%d r%d", READ_2BYTES_BE(ins + 1), READ_2BYTES_BE(ins + 3));
+            return 5;
+        case OP_R_LOAD_INT:
+            fprintf(f, "R_LOAD_INT r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_LOAD_BOOL:
+            fprintf(f, "R_LOAD_BOOL r%d %d", READ_2BYTES_BE(ins + 1), *(ins + 3));
+            return 4;
+        case OP_R_LOAD_NONE:
+            fprintf(f, "R_LOAD_NONE r%d", READ_2BYTES_BE(ins + 1));
+            return 3;
+        case OP_R_LOAD_LITERAL:
+            fprintf(f, "R_LOAD_LITERAL r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_GET_GLOBAL:
+            fprintf(f, "R_GET_GLOBAL r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_SET_GLOBAL:
+            fprintf(f, "R_SET_GLOBAL r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_VAL_GLOBAL:
+            fprintf(f, "R_VAL_GLOBAL r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_VAR_GLOBAL:
+            fprintf(f, "R_VAR_GLOBAL r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_BRANCH_FALSE:
+            fprintf(f, "R_BRANCH_FALSE r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_IADD:
+        case OP_R_ISUB:
+        case OP_R_IMUL:
+        case OP_R_IDIV:
+        case OP_R_IMOD:
+        case OP_R_ILESS:
+        case OP_R_ILESSEQ:
+        case OP_R_IGREATER:
+        case OP_R_IGREATEREQ:
+        case OP_R_EQ:
+        case OP_R_NEQ:
+            fprintf(f, "R_BINARY 0x%x r%d r%d r%d", *ins, READ_2BYTES_BE(ins + 1),
+                    READ_2BYTES_BE(ins + 3), READ_2BYTES_BE(ins + 5));
+            return 7;
+        case OP_R_INEG:
+            fprintf(f, "R_INEG r%d r%d", READ_2BYTES_BE(ins + 1), READ_2BYTES_BE(ins + 3));
+            return 5;
+        case OP_R_CALL_FUNC:
+            fprintf(f, "R_CALL_FUNC r%d %d", READ_2BYTES_BE(ins + 1), *(ins + 3));
+            return 4;
+        case OP_R_DISPATCH_METHOD:
+            fprintf(f, "R_DISPATCH_METHOD r%d %d %d", READ_2BYTES_BE(ins + 1),
+                    READ_4BYTES_BE(ins + 3), *(ins + 7));
+            return 8;
+        case OP_R_PRINT:
+            fprintf(f, "R_PRINT r%d %d", READ_2BYTES_BE(ins + 1), *(ins + 3));
+            return 4;
+        case OP_R_RETURN:
+            fprintf(f, "R_RETURN r%d", READ_2BYTES_BE(ins + 1));
+            return 3;
+        case OP_R_NEW_OBJECT:
+            fprintf(f, "R_NEW_OBJECT r%d %d", READ_2BYTES_BE(ins + 1), READ_4BYTES_BE(ins + 3));
+            return 7;
+        case OP_R_GET_MEMBER:
+            fprintf(f, "R_GET_MEMBER r%d r%d %d", READ_2BYTES_BE(ins + 1),
+                    READ_2BYTES_BE(ins + 3), READ_4BYTES_BE(ins + 5));
+            return 9;
+        case OP_R_SET_MEMBER:
+            fprintf(f, "R_SET_MEMBER r%d r%d %d", READ_2BYTES_BE(ins + 1),
+                    READ_2BYTES_BE(ins + 3), READ_4BYTES_BE(ins + 5));
+            return 9;
+        case OP_R_NEW_LIST:
+            fprintf(f, "R_NEW_LIST r%d r%d %d", READ_2BYTES_BE(ins + 1),
+                    READ_2BYTES_BE(ins + 3), READ_2BYTES_BE(ins + 5));
+            return 7;
+        case OP_R_GET_INDEX:
+            fprintf(f, "R_GET_INDEX r%d r%d r%d", READ_2BYTES_BE(ins + 1),
+                    READ_2BYTES_BE(ins + 3), READ_2BYTES_BE(ins + 5));
+            return 7;
+        case OP_R_SET_INDEX:
+            fprintf(f, "R_SET_INDEX r%d r%d r%d", READ_2BYTES_BE(ins + 1),
+                    READ_2BYTES_BE(ins + 3), READ_2BYTES_BE(ins + 5));
+            return 7;
+        case OP_R_LIST_LEN:
+            fprintf(f, "R_LIST_LEN r%d r%d", READ_2BYTES_BE(ins + 1), READ_2BYTES_BE(ins + 3));
+            return 5;
+        case OP_R_LIST_APPEND:
+            fprintf(f, "R_LIST_APPEND r%d r%d r%d", READ_2BYTES_BE(ins + 1),
+                    READ_2BYTES_BE(ins + 3), READ_2BYTES_BE(ins + 5));
+            return 7;
         default:
             fprintf(f, "UNKNOWN_INSTRUCTION 0x%x", *ins);
             return 1;
@@ -148,18 +253,18 @@ size_t dissasemble_instruction(FILE* f, u8* ins) {
 }
 
 void disassemble_value(FILE* f, struct value v, bool shrt) {
-    switch (v.type) {
+    switch (VALUE_TYPE(v)) {
         case VAL_INT:
-            fprintf(f, "INT: %d", v.integer);
+            fprintf(f, "INT: %d", AS_CINT(v));
             break;
         case VAL_BOOL:
-            fprintf(f, "BOOL: %d", v.boolean);
+            fprintf(f, "BOOL: %d", AS_BOOL(v));
             break;
         case VAL_DOUBLE:
-            fprintf(f, "DOUBLE: %f", v.double_num);
+            fprintf(f, "DOUBLE: %f", AS_DOUBLE(v));
             break;
         case VAL_OBJECT:
-            dissasemble_object(f, v.object, shrt);
+            dissasemble_object(f, AS_OBJECT(v), shrt);
             break;
         case VAL_NONE:
             fprintf(f, "NONE");
@@ -170,7 +275,11 @@ void disassemble_value(FILE* f, struct value v, bool shrt) {
 void dissasemble_object(FILE* f, struct object* obj, bool shrt) {
     switch (obj->type) {
         case OBJECT_STRING:
-            fprintf(f, "STRING \"%s\"", as_string(obj)->data);
+            if (as_string(obj)->data == NULL) {
+                fprintf(f, "ROPE length: %lu", as_string(obj)->size);
+            } else {
+                fprintf(f, "STRING \"%s\"", as_string(obj)->data);
+            }
             break;
         case OBJECT_FUNCTION: {
             struct object_function* fun = as_function(obj);
@@ -186,7 +295,7 @@ void dissasemble_object(FILE* f, struct object* obj, bool shrt) {
         }
         case OBJECT_CLASS: {
             struct object_class* class = as_class(obj);
-            fprintf(f, "CLASS name: %u, methods: %lu", class->name, class->methods.count);
+            fprintf(f, "CLASS name: %u, methods: %u", class->name, class->vtable_len);
             break;
         }
         case OBJECT_INSTANCE: {
@@ -194,6 +303,15 @@ void dissasemble_object(FILE* f, struct object* obj, bool shrt) {
             fprintf(f, "INSTANCE of class %u", instance->klass->name);
             break;
         }
+        case OBJECT_LIST: {
+            fprintf(f, "LIST length: %u", as_list(obj)->len);
+            break;
+        }
+        case OBJECT_ARRAY: {
+            struct object_array* array = as_array(obj);
+            fprintf(f, "%s ARRAY length: %u", array->kind == ARRAY_INT ? "INT" : "DOUBLE", array->len);
+            break;
+        }
         default:
             UNREACHABLE();
     }
@@ -7,22 +7,73 @@
 #include "hashtable.h"
 #include "memory.h"
 #include "dissasembler.h"
+#include "memory/block_alloc.h"
+
+#include <time.h>
+
+#ifdef __PARALLEL_MARK__
+#include <pthread.h>
+#include <sched.h>
+#include "ws_deque.h"
+#endif
 
-#define IS_MARKED(val) (((val) & 1) == 1)
 
 void init_gc(struct gc_state* gc) {
     gc->wl_capacity = 0;
     gc->wl_count = 0;
     gc->worklist = NULL;
-    gc->next_gc = GC_THRESHOLD_START;
+    gc->rs_capacity = 0;
+    gc->rs_count = 0;
+    gc->remembered = NULL;
+    init_gc_policy(&gc->policy);
+    gc->next_gc = gc->policy.min_threshold;
+    gc->young_bytes = 0;
+    gc->minor = false;
+    gc->phase = GC_IDLE;
+    gc->mark_threads = 1;
+    gc->compact_pending = false;
+    gc->young_capacity = 0;
+    gc->young_count = 0;
+    gc->young = NULL;
+    gc->sweep_pos = 0;
     gc->gc_off = false;
+    gc->minor_count = 0;
+    gc->major_count = 0;
+    gc->compact_count = 0;
+    gc->total_ns = 0;
+    gc->max_pause_ns = 0;
+    gc->steps = 0;
+    gc->mark_ns = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+        gc->pauses[i] = 0;
+    }
 }
 
 void free_gc(struct gc_state* gc) {
-    free(gc->worklist);
+    mem_free(gc->worklist);
+    mem_free(gc->remembered);
+    mem_free(gc->young);
     init_gc(gc);
 }
 
+void gc_set_policy(struct gc_state* gc, const struct gc_policy* policy) {
+    gc->policy = *policy;
+    gc->next_gc = policy->min_threshold;
+}
+
+void gc_remember(struct gc_state* gc, struct object* obj) {
+    obj->gc_data |= GC_REMEMBERED;
+    gc->remembered = mem_handle_capacity(MEM_GC, gc->remembered, gc->rs_count,
+                                         &gc->rs_capacity, sizeof(*gc->remembered));
+    gc->remembered[gc->rs_count++] = obj;
+}
+
+void gc_add_young(struct gc_state* gc, struct object* obj) {
+    gc->young = mem_handle_capacity(MEM_GC, gc->young, gc->young_count,
+                                    &gc->young_capacity, sizeof(*gc->young));
+    gc->young[gc->young_count++] = obj;
+}
+
 static void mark_val(struct gc_state*, struct value*);
 
 static void mark_table(struct gc_state* gc, struct table* table) {
@@ -30,23 +81,26 @@ static void mark_table(struct gc_state* gc, struct table* table) {
         struct entry* e = &table->entries[i];
         mark_val(gc, &e->key);
         // TODO: Maybe not necessary
-        if (e->key.type != VAL_NONE) {
+        if (!IS_NONE(e->key)) {
             mark_val(gc, &e->val);
         }
     }
 }
 
 static void mark_object(struct gc_state* gc, struct object* obj) {
-    if (obj == NULL || IS_MARKED(obj->gc_data)) {
+    if (obj == NULL) {
         return;
     }
-    obj->gc_data = 1;
-    gc->worklist = handle_capacity(gc->worklist, gc->wl_count,
-                                   &gc->wl_capacity, sizeof(*gc->worklist));
-    if (gc->worklist == NULL) {
-        fprintf(stderr, "Allocation failed for internal GC data, aborting\n");
-        exit(-11);
+    // Old objects are not traced by the minor collection, the young objects
+    // they point to are reached through the remembered set.
+    if (gc->minor && !(obj->gc_data & GC_YOUNG)) {
+        return;
+    }
+    if (heap_mark(obj)) {
+        return;
     }
+    gc->worklist = mem_handle_capacity(MEM_GC, gc->worklist, gc->wl_count,
+                                       &gc->wl_capacity, sizeof(*gc->worklist));
     gc->worklist[gc->wl_count++] = obj;
 
 #ifdef __GC_DEBUG__
@@ -56,9 +110,13 @@ static void mark_object(struct gc_state* gc, struct object* obj) {
 #endif
 }
 
+void gc_shade(struct gc_state* gc, struct object* obj) {
+    mark_object(gc, obj);
+}
+
 static void mark_val(struct gc_state* gc, struct value* v) {
-    if (v->type == VAL_OBJECT) {
-        mark_object(gc, v->object);
+    if (IS_OBJECT(*v)) {
+        mark_object(gc, AS_OBJECT(*v));
     }
 }
 
@@ -74,7 +132,10 @@ static void mark_roots(vm_t* vm) {
     }
 
     // globals
-    mark_table(&vm->gc, &vm->globals);
+    mark_table(&vm->gc, &vm->globals.names);
+    for (size_t i = 0; i < vm->globals.len; ++i) {
+        mark_val(&vm->gc, &vm->globals.slots[i].value);
+    }
 
     // locals in frames
     for (size_t i = 0; i < vm->frame_len; ++i) {
@@ -84,26 +145,63 @@ static void mark_roots(vm_t* vm) {
     }
 }
 
-static void close_obj(vm_t* vm, struct object* obj) {
+typedef void (*visit_fn)(void* ctx, struct object* obj);
+
+static inline void visit_value(struct value v, visit_fn visit, void* ctx) {
+    if (IS_OBJECT(v)) {
+        visit(ctx, AS_OBJECT(v));
+    }
+}
+
+/// Calls 'visit' on the objects that 'obj' points to, it is shared by the
+/// serial and the parallel marker.
+static inline void visit_children(struct object* obj, visit_fn visit, void* ctx) {
     switch (obj->type) {
         case OBJECT_FUNCTION:
-        case OBJECT_STRING:
         case OBJECT_NATIVE:
+        case OBJECT_ARRAY:
             break;
-        // TODO: Probably not necessary
+        case OBJECT_STRING: {
+            struct object_string* s = as_string(obj);
+            if (s->left != NULL) {
+                visit(ctx, &s->left->object);
+                visit(ctx, &s->right->object);
+            }
+            break;
+        }
         case OBJECT_CLASS: {
-            struct object_class* c = as_class(obj);
-            mark_table(&vm->gc, &c->methods);
+            // Keys of the method table are the same names, the values are indexes
+            struct object_class* klass = as_class(obj);
+            for (u16 i = 0; i < klass->vtable_len; ++i) {
+                visit(ctx, klass->method_names[i]);
+            }
             break;
         }
         case OBJECT_INSTANCE: {
             struct object_instance* c = as_instance(obj);
-            mark_table(&vm->gc, &c->members);
+            for (u32 i = 0; i < c->shape->count; ++i) {
+                visit_value(c->slots[i], visit, ctx);
+            }
+            break;
+        }
+        case OBJECT_LIST: {
+            struct object_list* list = as_list(obj);
+            for (u32 i = 0; i < list->len; ++i) {
+                visit_value(list->items[i], visit, ctx);
+            }
             break;
         }
     }
 }
 
+static void visit_mark(void* gc, struct object* obj) {
+    mark_object(gc, obj);
+}
+
+static void close_obj(vm_t* vm, struct object* obj) {
+    visit_children(obj, visit_mark, &vm->gc);
+}
+
 static void trace_references(vm_t* vm) {
     struct gc_state* gc = &vm->gc;
     while (gc->wl_count > 0) {
@@ -112,36 +210,363 @@ static void trace_references(vm_t* vm) {
     }
 }
 
-static void sweep(vm_t* vm) {
-    struct object** obj = &vm->objects;
-    while (*obj != NULL) {
-        if (IS_MARKED((*obj)->gc_data)) {
-            (*obj)->gc_data = 0;
-            obj = &(*obj)->next;
-        } else {
-            struct object* unreached = *obj;
+static u64 now_ns() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (u64)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+#ifdef __PARALLEL_MARK__
+struct mark_worker {
+    struct ws_deque deque;
+    struct mark_workers* all;
+    u32 id;
+    pthread_t thread;
+};
+
+struct mark_workers {
+    struct mark_worker* workers;
+    u32 count;
+    /// Workers that may still have objects to trace, the marking is over
+    /// when it drops to zero.
+    atomic_int active;
+};
+
+static void visit_mark_parallel(void* worker, struct object* obj) {
+    // Most of the objects are already marked, plain load is cheaper than the
+    // atomic or.
+    if (obj == NULL || heap_is_marked_atomic(obj)) {
+        return;
+    }
+    if (!heap_mark_atomic(obj)) {
+        ws_push(&((struct mark_worker*)worker)->deque, obj);
+    }
+}
+
+/// Looks for an object in the deques of other workers, returns NULL when
+/// all workers are out of work.
+static struct object* steal_object(struct mark_worker* w) {
+    struct mark_workers* all = w->all;
+    while (atomic_load(&all->active) > 0) {
+        for (u32 i = 1; i < all->count; ++i) {
+            struct ws_deque* victim = &all->workers[(w->id + i) % all->count].deque;
+            if (ws_size(victim) <= 0) {
+                continue;
+            }
+            // Stays active while holding the object, so the others do not finish.
+            atomic_fetch_add(&all->active, 1);
+            struct object* obj = ws_steal(victim);
+            if (obj != NULL && obj != WS_ABORT) {
+                return obj;
+            }
+            atomic_fetch_sub(&all->active, 1);
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void* mark_worker_run(void* arg) {
+    struct mark_worker* w = arg;
+    for (;;) {
+        struct object* obj;
+        while ((obj = ws_take(&w->deque)) != NULL) {
+            visit_children(obj, visit_mark_parallel, w);
+        }
+        atomic_fetch_sub(&w->all->active, 1);
+        obj = steal_object(w);
+        if (obj == NULL) {
+            return NULL;
+        }
+        visit_children(obj, visit_mark_parallel, w);
+    }
+}
+
+/// Traces the gray objects in the worklist with 'count' threads, every
+/// thread has a deque and steals from the others when it runs out of work.
+static void trace_parallel(vm_t* vm, u32 count) {
+    struct gc_state* gc = &vm->gc;
+    struct mark_workers all;
+    all.workers = malloc(count * sizeof(*all.workers));
+    if (all.workers == NULL) {
+        fprintf(stderr, "Allocation failed for internal GC data, aborting\n");
+        exit(-11);
+    }
+    all.count = count;
+    atomic_init(&all.active, count);
+    for (u32 i = 0; i < count; ++i) {
+        init_ws_deque(&all.workers[i].deque);
+        all.workers[i].all = &all;
+        all.workers[i].id = i;
+    }
+    for (size_t i = 0; i < gc->wl_count; ++i) {
+        ws_push(&all.workers[i % count].deque, gc->worklist[i]);
+    }
+    gc->wl_count = 0;
+
+    for (u32 i = 1; i < count; ++i) {
+        pthread_create(&all.workers[i].thread, NULL, mark_worker_run, &all.workers[i]);
+    }
+    mark_worker_run(&all.workers[0]);
+    for (u32 i = 1; i < count; ++i) {
+        pthread_join(all.workers[i].thread, NULL);
+    }
+    for (u32 i = 0; i < count; ++i) {
+        free_ws_deque(&all.workers[i].deque);
+    }
+    free(all.workers);
+}
+#endif
+
+/// Marks everything that is reachable, with more threads if the parallel
+/// marker is compiled in.
+static void mark_heap(vm_t* vm) {
+    u64 begin = now_ns();
+    mark_roots(vm);
+#ifdef __PARALLEL_MARK__
+    if (vm->gc.mark_threads > 1) {
+        trace_parallel(vm, vm->gc.mark_threads);
+    }
+#endif
+    trace_references(vm);
+    vm->gc.mark_ns += now_ns() - begin;
+}
+
+/// Removes strings that are going to be swept from the interning table.
+static void purge_strings(vm_t* vm) {
+    struct table* t = &vm->strings;
+    for (size_t i = 0; i < t->capacity; ++i) {
+        struct entry* e = &t->entries[i];
+        if (IS_OBJECT(e->key) && !heap_is_marked(AS_OBJECT(e->key))) {
+            table_delete(t, e->key);
+        }
+    }
+}
+
+/// Removes the young strings that are going to be swept from the interning
+/// table, without going through the whole table.
+static void purge_young_strings(vm_t* vm) {
+    for (size_t i = 0; i < vm->gc.young_count; ++i) {
+        struct object* obj = vm->gc.young[i];
+        if (obj->type == OBJECT_STRING && !heap_is_marked(obj)
+            && as_string(obj)->interned) {
+            table_delete(&vm->strings, NEW_OBJECT(obj));
+        }
+    }
+}
+
+/// Traces the young objects that old objects point to.
+static void trace_remembered(vm_t* vm) {
+    struct gc_state* gc = &vm->gc;
+    for (size_t i = 0; i < gc->rs_count; ++i) {
+        struct object* obj = gc->remembered[i];
+        obj->gc_data &= ~GC_REMEMBERED;
+        close_obj(vm, obj);
+    }
+    gc->rs_count = 0;
+}
+
+static void free_unreached(struct object* unreached) {
 #ifdef __GC_DEBUG__
     GC_LOG("Sweeping object %p: ", unreached);
     dissasemble_object(stderr, unreached, true);
     GC_LOG("\n");
 #endif
-            *obj = (*obj)->next;
-            free_object(unreached);
+    free_object(unreached);
+}
+
+/// Frees the unmarked old objects in word 'w' of the heap bitmaps.
+static void free_dead(size_t w) {
+    u64 dead = heap_objects[w] & ~heap_marks[w];
+    while (dead != 0) {
+        struct object* obj = heap_granule(w * 64 + __builtin_ctzll(dead));
+        dead &= dead - 1;
+        // Objects allocated after the marking are young, they are not swept.
+        if (!(obj->gc_data & GC_YOUNG)) {
+            free_unreached(obj);
+        }
+    }
+}
+
+/// Frees the unmarked objects in word 'w' and clears the marks. Live
+/// objects are not touched.
+static void sweep_word(size_t w) {
+    free_dead(w);
+    heap_marks[w] = 0;
+}
+
+/// Frees the unmarked objects of 'young'' and promotes the rest to the old
+/// generation. The marks of the promoted objects are kept, if 'unmark'
+/// is false, the sweep of the old objects clears them.
+static void sweep_young_objects(struct object** young, size_t count, bool unmark) {
+    for (size_t i = 0; i < count; ++i) {
+        struct object* obj = young[i];
+        if (heap_is_marked(obj)) {
+            if (unmark) {
+                heap_unmark(obj);
+            }
+            obj->gc_data &= ~GC_YOUNG;
+        } else {
+            free_unreached(obj);
         }
     }
 }
 
+static void sweep(vm_t* vm) {
+    sweep_young_objects(vm->gc.young, vm->gc.young_count, false);
+    vm->gc.young_count = 0;
+    vm->gc.young_bytes = 0;
+    size_t words = heap_bitmap_words();
+    for (size_t w = 0; w < words; ++w) {
+        sweep_word(w);
+    }
+}
+
+static void record_pause(struct gc_state* gc, u64 begin) {
+    u64 pause = now_ns() - begin;
+    gc->total_ns += pause;
+    if (pause > gc->max_pause_ns) {
+        gc->max_pause_ns = pause;
+    }
+    int bucket = 0;
+    for (u64 limit = 10000; pause >= limit && bucket < GC_PAUSE_BUCKETS - 1; limit *= 10) {
+        bucket += 1;
+    }
+    gc->pauses[bucket] += 1;
+}
+
+/// Empties the remembered set, used by major collections after which
+/// nothing stays young.
+static void forget_remembered(struct gc_state* gc) {
+    for (size_t i = 0; i < gc->rs_count; ++i) {
+        gc->remembered[i]->gc_data &= ~GC_REMEMBERED;
+    }
+    gc->rs_count = 0;
+}
+
+/// Called when a major collection is over. Sets the threshold of the next
+/// one from the surviving data and requests a compaction if the free blocks
+/// take too much of the heap. The stress test compacts after every major
+/// collection.
+static void end_major(struct gc_state* gc) {
+    gc->major_count += 1;
+    gc->next_gc = gc_policy_threshold(&gc->policy, mem_taken());
+    size_t percent = gc->policy.compact_fragmentation;
+#ifdef __GC_STRESS__
+    gc->compact_pending = percent > 0;
+#else
+    size_t free = heap_free_listed();
+    if (percent > 0 && free >= GC_COMPACT_MIN_FREE && free * 100 > heap_used() * percent) {
+        gc->compact_pending = true;
+    }
+#endif
+}
+
+/// Marking is done, the strings table is purged right away so that
+/// new_string can not return a string that is going to be swept.
+static void finish_marking(vm_t* vm) {
+    struct gc_state* gc = &vm->gc;
+    purge_strings(vm);
+    forget_remembered(gc);
+    // The young objects become old, the sweep frees the dead ones with the
+    // rest. The survivors must be old before the program stores new objects
+    // into them, or the barrier would not remember them.
+    for (size_t i = 0; i < gc->young_count; ++i) {
+        gc->young[i]->gc_data &= ~GC_YOUNG;
+    }
+    gc->young_count = 0;
+    gc->young_bytes = 0;
+    gc->sweep_pos = 0;
+    gc->phase = GC_SWEEPING;
+}
+
+static void mark_step(vm_t* vm, size_t work) {
+    struct gc_state* gc = &vm->gc;
+    while (work > 0 && gc->wl_count > 0) {
+        close_obj(vm, gc->worklist[--gc->wl_count]);
+        work -= 1;
+    }
+    if (gc->wl_count > 0) {
+        return;
+    }
+    // New objects are black, so only the objects the program moved from
+    // white ones to the roots are left.
+    mark_roots(vm);
+    trace_references(vm);
+    finish_marking(vm);
+}
+
+/// Sweeps 'work' words of the bitmaps.
+static void sweep_step(vm_t* vm, size_t work) {
+    struct gc_state* gc = &vm->gc;
+    size_t words = heap_bitmap_words();
+    for (; work > 0 && gc->sweep_pos < words; --work) {
+        sweep_word(gc->sweep_pos++);
+    }
+    if (gc->sweep_pos >= words) {
+        gc->phase = GC_IDLE;
+        end_major(gc);
+    }
+}
+
+static void step(vm_t* vm, size_t work) {
+    if (vm->gc.phase == GC_MARKING) {
+        mark_step(vm, work);
+    } else if (vm->gc.phase == GC_SWEEPING) {
+        sweep_step(vm, work);
+    }
+}
+
+void gc_start_cycle(vm_t* vm) {
+    if (vm->gc.gc_off || vm->gc.phase != GC_IDLE) {
+        return;
+    }
+    u64 begin = now_ns();
+    GC_LOG("=== GC CYCLE BEGIN ===\n");
+    vm->gc.minor = false;
+    vm->gc.phase = GC_MARKING;
+#ifdef __PARALLEL_MARK__
+    if (vm->gc.mark_threads > 1) {
+        // The parallel marker does the whole marking at once, only the
+        // sweep is incremental.
+        mark_heap(vm);
+        finish_marking(vm);
+        record_pause(&vm->gc, begin);
+        return;
+    }
+#endif
+    mark_roots(vm);
+    record_pause(&vm->gc, begin);
+}
+
+void gc_step(vm_t* vm) {
+    if (vm->gc.gc_off || vm->gc.phase == GC_IDLE) {
+        return;
+    }
+    u64 begin = now_ns();
+    step(vm, vm->gc.policy.step_work);
+    vm->gc.steps += 1;
+    record_pause(&vm->gc, begin);
+}
+
 void gc_collect(vm_t* vm) {
     if (vm->gc.gc_off) {
         GC_LOG("Collection was called but GC is turned off\n");
         return;
     }
+    u64 begin = now_ns();
     GC_LOG("=== GC BEGIN ===\n");
+    while (vm->gc.phase != GC_IDLE) {
+        step(vm, SIZE_MAX);
+    }
     size_t before = mem_taken();
     GC_LOG("Taken memory: %lu/%luB\n", before, mem_total());
 
-    mark_roots(vm);
-    trace_references(vm);
+    // Everything is traced, so the remembered set is not needed.
+    vm->gc.minor = false;
+    forget_remembered(&vm->gc);
+    mark_heap(vm);
+    purge_strings(vm);
     GC_LOG("Begin sweeping\n");
     sweep(vm);
 
@@ -149,4 +574,225 @@ void gc_collect(vm_t* vm) {
     GC_LOG("Taken memory: %lu/%luB\n", after, mem_total());
     GC_LOG("Difference: %luB\n", before - after);
     GC_LOG("=== GC END ===\n\n");
+    end_major(&vm->gc);
+    record_pause(&vm->gc, begin);
+}
+
+void gc_collect_young(vm_t* vm) {
+    if (vm->gc.gc_off) {
+        GC_LOG("Collection was called but GC is turned off\n");
+        return;
+    }
+    if (vm->gc.phase != GC_IDLE) {
+        GC_LOG("Minor collection skipped, major cycle in progress\n");
+        return;
+    }
+    u64 begin = now_ns();
+    GC_LOG("=== MINOR GC BEGIN ===\n");
+#ifdef __GC_DEBUG__
+    size_t before = mem_taken();
+#endif
+
+    vm->gc.minor = true;
+    mark_roots(vm);
+    trace_remembered(vm);
+    trace_references(vm);
+    purge_young_strings(vm);
+    sweep_young_objects(vm->gc.young, vm->gc.young_count, true);
+    vm->gc.young_count = 0;
+    vm->gc.young_bytes = 0;
+    vm->gc.minor = false;
+
+#ifdef __GC_DEBUG__
+    GC_LOG("Difference: %luB\n", before - mem_taken());
+#endif
+    GC_LOG("=== MINOR GC END ===\n\n");
+    vm->gc.minor_count += 1;
+    record_pause(&vm->gc, begin);
+}
+
+static inline struct object* forward(struct object* obj) {
+    return obj == NULL ? NULL : heap_forward(obj);
+}
+
+static inline void forward_value(struct value* v) {
+    if (IS_OBJECT(*v)) {
+        *v = NEW_OBJECT(heap_forward(AS_OBJECT(*v)));
+    }
+}
+
+static void forward_table(struct table* t) {
+    for (size_t i = 0; i < t->capacity; ++i) {
+        // Keys are strings, their hash does not depend on the address.
+        forward_value(&t->entries[i].key);
+        forward_value(&t->entries[i].val);
+    }
+}
+
+static void forward_shapes(struct shape* shape) {
+    shape->name = forward(shape->name);
+    for (struct shape* child = shape->children; child != NULL; child = child->sibling) {
+        forward_shapes(child);
+    }
+}
+
+static void forward_chunk(struct bc_chunk* c) {
+    for (size_t i = 0; i < c->code_len; ++i) {
+        if (ins_has_object(c->code[i].op)) {
+            c->code[i].object = forward(c->code[i].object);
+        }
+    }
+    for (size_t i = 0; i < c->caches_len; ++i) {
+        c->caches[i].name = forward(c->caches[i].name);
+    }
+    for (size_t i = 0; i < c->method_caches_len; ++i) {
+        struct method_cache* mc = &c->method_caches[i];
+        mc->name = forward(mc->name);
+        for (u8 j = 0; j < mc->len; ++j) {
+            mc->ways[j].klass = as_class(forward(&mc->ways[j].klass->object));
+            mc->ways[j].method = as_function(forward(&mc->ways[j].method->object));
+        }
+    }
+}
+
+/// Rewrites the pointers in 'obj', which is not moved yet.
+static void forward_object(struct object* obj) {
+    switch (obj->type) {
+        case OBJECT_STRING: {
+            struct object_string* s = as_string(obj);
+            if (s->left != NULL) {
+                s->left = as_string(heap_forward(s->left));
+                s->right = as_string(heap_forward(s->right));
+            }
+            if (s->data != NULL) {
+                s->data = heap_forward(s->data);
+            }
+            break;
+        }
+        case OBJECT_FUNCTION:
+            forward_chunk(&as_function(obj)->bc);
+            break;
+        case OBJECT_NATIVE:
+        case OBJECT_ARRAY:
+            break;
+        case OBJECT_CLASS: {
+            struct object_class* klass = as_class(obj);
+            forward_table(&klass->methods);
+            for (u16 i = 0; i < klass->vtable_len; ++i) {
+                klass->method_names[i] = heap_forward(klass->method_names[i]);
+                klass->vtable[i] = as_function(heap_forward(klass->vtable[i]));
+            }
+            forward_shapes(klass->shape);
+            break;
+        }
+        case OBJECT_INSTANCE: {
+            struct object_instance* instance = as_instance(obj);
+            instance->klass = as_class(heap_forward(instance->klass));
+            for (u32 i = 0; i < instance->shape->count; ++i) {
+                forward_value(&instance->slots[i]);
+            }
+            if (instance->slots == instance->inline_slots) {
+                instance->slots = as_instance(heap_forward(obj))->inline_slots;
+            }
+            break;
+        }
+        case OBJECT_LIST: {
+            struct object_list* list = as_list(obj);
+            for (u32 i = 0; i < list->len; ++i) {
+                forward_value(&list->items[i]);
+            }
+            break;
+        }
+    }
+}
+
+/// Rewrites the roots, every location has to be rewritten exactly once.
+static void forward_roots(vm_t* vm) {
+    for (size_t i = 0; i < vm->const_pool.len; ++i) {
+        vm->const_pool.data[i] = forward(vm->const_pool.data[i]);
+    }
+    // Registers of a caller can be above the locals of the callee, the
+    // stack is rewritten up to the end of the highest frame.
+    size_t stack_end = vm->stack_len;
+    for (size_t i = 0; i < vm->frame_len; ++i) {
+        struct call_frame* frame = &vm->frames[i];
+        size_t end = frame->slots - vm->op_stack + frame->function->locals;
+        stack_end = end > stack_end ? end : stack_end;
+        frame->function = as_function(heap_forward(frame->function));
+    }
+    for (size_t i = 0; i < stack_end; ++i) {
+        forward_value(&vm->op_stack[i]);
+    }
+    forward_table(&vm->globals.names);
+    for (size_t i = 0; i < vm->globals.len; ++i) {
+        forward_value(&vm->globals.slots[i].value);
+    }
+    forward_table(&vm->strings);
+}
+
+void gc_compact(vm_t* vm) {
+    struct gc_state* gc = &vm->gc;
+    gc->compact_pending = false;
+    if (gc->gc_off) {
+        return;
+    }
+    u64 begin = now_ns();
+    GC_LOG("=== GC COMPACTION BEGIN ===\n");
+    while (gc->phase != GC_IDLE) {
+        step(vm, SIZE_MAX);
+    }
+    size_t before = heap_used();
+
+    gc->minor = false;
+    forget_remembered(gc);
+    mark_heap(vm);
+    purge_strings(vm);
+    sweep_young_objects(gc->young, gc->young_count, false);
+    gc->young_count = 0;
+    gc->young_bytes = 0;
+    size_t words = heap_bitmap_words();
+    for (size_t w = 0; w < words; ++w) {
+        free_dead(w);
+    }
+    // Only the objects and the blocks they own are marked, the characters
+    // of strings move too.
+    for (size_t w = 0; w < words; ++w) {
+        for (u64 live = heap_objects[w] & heap_marks[w]; live != 0; live &= live - 1) {
+            struct object* obj = heap_granule(w * 64 + __builtin_ctzll(live));
+            if (obj->type == OBJECT_STRING && as_string(obj)->data != NULL) {
+                heap_mark(as_string(obj)->data);
+            }
+        }
+    }
+    if (heap_prepare_compaction()) {
+        forward_roots(vm);
+        for (size_t w = 0; w < words; ++w) {
+            for (u64 live = heap_objects[w] & heap_marks[w]; live != 0; live &= live - 1) {
+                forward_object(heap_granule(w * 64 + __builtin_ctzll(live)));
+            }
+        }
+        heap_finish_compaction();
+        gc->compact_count += 1;
+    } else {
+        for (size_t w = 0; w < words; ++w) {
+            heap_marks[w] = 0;
+        }
+    }
+
+    GC_LOG("Used heap: %lu -> %luB\n", before, heap_used());
+    GC_LOG("=== GC COMPACTION END ===\n\n");
+    (void)before;
+    gc->major_count += 1;
+    gc->next_gc = gc_policy_threshold(&gc->policy, mem_taken());
+    record_pause(gc, begin);
+}
+
+void gc_free_all() {
+    size_t words = heap_bitmap_words();
+    for (size_t w = 0; w < words; ++w) {
+        for (u64 objects = heap_objects[w]; objects != 0; objects &= objects - 1) {
+            free_object(heap_granule(w * 64 + __builtin_ctzll(objects)));
+        }
+        heap_marks[w] = 0;
+    }
 }
@@ -2,28 +2,154 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
+#include "common.h"
+#include "object.h"
+#include "gc_policy.h"
+
 #ifdef __GC_DEBUG__
 #define GC_LOG(format, ...) do { fprintf(stderr, format, ##__VA_ARGS__); } while (false)
 #else
 #define GC_LOG(format, ...)
 #endif
 
-#define GC_THRESHOLD_START 1024 * 1024 // 1kb
+// Bits of 'gc_data' in objects, the mark bits are in a bitmap of the heap
+// (see heap_mark).
+/// The object was allocated after the last collection.
+#define GC_YOUNG 2
+/// The (old) object is in the remembered set.
+#define GC_REMEMBERED 4
+
+/// The heap is compacted only if there are at least this many bytes in the
+/// free blocks, see gc_policy.compact_fragmentation.
+#define GC_COMPACT_MIN_FREE (4 * 1024 * 1024)
+
+/// Pauses are counted in buckets <10us, <100us, <1ms, <10ms, <100ms, more.
+#define GC_PAUSE_BUCKETS 6
+
+enum gc_phase {
+    GC_IDLE,
+    /// Marked objects that are in the worklist are gray, the rest are black.
+    GC_MARKING,
+    GC_SWEEPING,
+};
 
 typedef struct vm_state vm_t;
 
+/**
+ * The heap has two generations. New objects are young ('young'), a minor
+ * collection traces only them and the ones that survive are promoted to the
+ * old generation. Old objects are not in any list, the GC finds them in
+ * the object bitmap of the heap. They are traced only by the major
+ * collection, which runs when the heap grows over 'next_gc'. The policy
+ * sets it after every major collection.
+ *
+ * A minor collection starts from the roots and from the remembered set,
+ * the old objects that were written a pointer to a young object. Every
+ * store into an object has to go through gc_write_barrier.
+ *
+ * The major collection is incremental: after it starts (gc_start_cycle)
+ * every allocation does a step that traces or sweeps at most 'policy.step_work'
+ * objects. While marking, the barrier shades the stored objects so a black
+ * object never points to a white one. Roots are written without a barrier,
+ * so they are scanned again before marking finishes. Minor collections do
+ * not run during the cycle, young objects are swept with the old ones.
+ * Mark bits are not in the objects but in a bitmap of the heap. The sweep
+ * scans it together with the object bitmap, word by word, and does not write
+ * to the live objects.
+ *
+ * Objects are not moved by the collections, since the C code keeps pointers
+ * to them over allocations. When a major collection leaves the heap too
+ * fragmented, it only sets 'compact_pending' and the interpreter calls
+ * gc_compact at the next call or jump, where all pointers are in the roots.
+ */
 struct gc_state {
     size_t wl_count;
     size_t wl_capacity;
     struct object** worklist;
 
+    size_t rs_count;
+    size_t rs_capacity;
+    struct object** remembered;
+
+    /// Objects allocated since the last collection.
+    size_t young_count;
+    size_t young_capacity;
+    struct object** young;
+
     size_t next_gc;
+    /// Bytes allocated since the last collection.
+    size_t young_bytes;
+    /// The running collection traces only young objects.
+    bool minor;
+
+    enum gc_phase phase;
+    /// Word of the bitmaps that is swept next.
+    size_t sweep_pos;
+    /// Threads that mark the heap in major collections, the marking is then
+    /// not incremental. Only with the PARALLEL_MARK build option.
+    u32 mark_threads;
+    bool compact_pending;
+
+    struct gc_policy policy;
 
     bool gc_off;
+
+    // Statistics printed by 'caby execute --stats'.
+    u64 minor_count;
+    u64 major_count;
+    u64 compact_count;
+    u64 total_ns;
+    u64 max_pause_ns;
+    u64 steps;
+    /// Time spent marking in full collections.
+    u64 mark_ns;
+    u64 pauses[GC_PAUSE_BUCKETS];
 };
 
 void init_gc(struct gc_state* gc);
 
 void free_gc(struct gc_state* gc);
 
+/// Replaces the default policy, the threshold starts at its minimum.
+void gc_set_policy(struct gc_state* gc, const struct gc_policy* policy);
+
+/// Full collection of both generations.
 void gc_collect(vm_t* vm);
+
+/// Collects only the young objects.
+void gc_collect_young(vm_t* vm);
+
+/// Starts an incremental major collection.
+void gc_start_cycle(vm_t* vm);
+
+/// Does a bounded amount of work of the running major collection.
+void gc_step(vm_t* vm);
+
+/// Full collection that also slides the live objects to the start of the heap
+/// and rewrites all pointers to them. It can be called only from the interpreter
+/// loop, no C code may hold a pointer to an object.
+void gc_compact(vm_t* vm);
+
+void gc_remember(struct gc_state* gc, struct object* obj);
+
+/// Adds a new object to the young generation.
+void gc_add_young(struct gc_state* gc, struct object* obj);
+
+/// Frees all objects of the heap.
+void gc_free_all();
+
+/// Marks the object gray if it is white.
+void gc_shade(struct gc_state* gc, struct object* obj);
+
+/// Has to be called when 'v' is stored into 'obj'.
+static inline void gc_write_barrier(struct gc_state* gc, struct object* obj, struct value v) {
+    if (!IS_OBJECT(v)) {
+        return;
+    }
+    if (gc->phase == GC_MARKING) {
+        gc_shade(gc, AS_OBJECT(v));
+    }
+    if ((AS_OBJECT(v)->gc_data & GC_YOUNG) && !(obj->gc_data & (GC_YOUNG | GC_REMEMBERED))) {
+        gc_remember(gc, obj);
+    }
+}
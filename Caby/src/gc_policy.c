@@ -0,0 +1,118 @@
+#include "gc_policy.h"
+#include "memory/block_alloc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+struct gc_option {
+    const char* flag;
+    const char* env;
+    size_t offset;
+    /// The value is in bytes and can have a k, m or g suffix.
+    bool bytes;
+    size_t min;
+    size_t max;
+    const char* help;
+};
+
+static const struct gc_option options[] = {
+    {"--heap-size", "CABY_HEAP_SIZE", offsetof(struct gc_policy, heap_size), true,
+     MINIMUM_HEAP_SIZE, SIZE_MAX, "Size of the heap, allocations over it fail."},
+    {"--gc-live-ratio", "CABY_GC_LIVE_RATIO", offsetof(struct gc_policy, live_ratio), false,
+     1, 100, "Percentage of the heap the live data should take after a collection."},
+    {"--gc-min-threshold", "CABY_GC_MIN_THRESHOLD", offsetof(struct gc_policy, min_threshold), true,
+     0, SIZE_MAX, "Heap size under which the major collection does not run."},
+    {"--gc-max-threshold", "CABY_GC_MAX_THRESHOLD", offsetof(struct gc_policy, max_threshold), true,
+     0, SIZE_MAX, "Heap size over which the major collection always runs."},
+    {"--gc-nursery", "CABY_GC_NURSERY", offsetof(struct gc_policy, nursery_size), true,
+     1, SIZE_MAX, "Bytes allocated between minor collections."},
+    {"--gc-step-work", "CABY_GC_STEP_WORK", offsetof(struct gc_policy, step_work), false,
+     1, SIZE_MAX, "Objects traced or swept by one incremental step."},
+    {"--gc-compact", "CABY_GC_COMPACT", offsetof(struct gc_policy, compact_fragmentation), false,
+     0, 100, "Percentage of free blocks that triggers compaction, 0 turns it off."},
+};
+
+#define OPTIONS_LEN (sizeof(options) / sizeof(*options))
+
+void init_gc_policy(struct gc_policy* p) {
+    p->heap_size = GC_DEFAULT_HEAP_SIZE;
+    p->live_ratio = GC_DEFAULT_LIVE_RATIO;
+    p->min_threshold = GC_DEFAULT_MIN_THRESHOLD;
+    p->max_threshold = 0;
+    p->nursery_size = GC_DEFAULT_NURSERY_SIZE;
+    p->step_work = GC_DEFAULT_STEP_WORK;
+    p->compact_fragmentation = GC_DEFAULT_COMPACT_FRAGMENTATION;
+}
+
+/// Parses 'str' into the field of the option, returns false if it is not
+/// a valid value.
+static bool set_option(struct gc_policy* p, const struct gc_option* o, const char* str) {
+    char* end;
+    unsigned long long v = strtoull(str, &end, 10);
+    if (end == str || *str == '-') {
+        return false;
+    }
+    if (o->bytes && *end != '\0' && end[1] == '\0') {
+        int shift = 0;
+        switch (*end) {
+            case 'k': case 'K': shift = 10; break;
+            case 'm': case 'M': shift = 20; break;
+            case 'g': case 'G': shift = 30; break;
+            default: return false;
+        }
+        if (v > SIZE_MAX >> shift) {
+            return false;
+        }
+        v <<= shift;
+        end += 1;
+    }
+    if (*end != '\0' || v < o->min || v > o->max) {
+        return false;
+    }
+    *(size_t*)((char*)p + o->offset) = v;
+    return true;
+}
+
+bool gc_policy_from_env(struct gc_policy* p) {
+    for (size_t i = 0; i < OPTIONS_LEN; ++i) {
+        const char* str = getenv(options[i].env);
+        if (str != NULL && !set_option(p, &options[i], str)) {
+            fprintf(stderr, "Invalid value of %s: '%s'\n", options[i].env, str);
+            return false;
+        }
+    }
+    return true;
+}
+
+int gc_policy_parse_arg(struct gc_policy* p, const char* argv[]) {
+    for (size_t i = 0; i < OPTIONS_LEN; ++i) {
+        if (strcmp(argv[0], options[i].flag) != 0) {
+            continue;
+        }
+        if (argv[1] == NULL || !set_option(p, &options[i], argv[1])) {
+            fprintf(stderr, "Invalid value of %s: '%s'\n", options[i].flag,
+                    argv[1] == NULL ? "" : argv[1]);
+            return -1;
+        }
+        return 2;
+    }
+    return 0;
+}
+
+size_t gc_policy_threshold(const struct gc_policy* p, size_t live) {
+    size_t max = p->max_threshold == 0 || p->max_threshold > p->heap_size
+               ? p->heap_size : p->max_threshold;
+    size_t t = live / p->live_ratio * 100;
+    if (t < p->min_threshold) {
+        t = p->min_threshold;
+    }
+    return t < max ? t : max;
+}
+
+void gc_policy_usage(FILE* f) {
+    for (size_t i = 0; i < OPTIONS_LEN; ++i) {
+        fprintf(f, "    %s <%s> - %s (%s)\n", options[i].flag, options[i].bytes ? "bytes" : "n",
+                options[i].help, options[i].env);
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/// Default size of the heap pool.
+#define GC_DEFAULT_HEAP_SIZE (1024ul * 1024 * 1024)
+/// The major collection does not run before the heap has this many bytes.
+#define GC_DEFAULT_MIN_THRESHOLD (1024ul * 1024)
+/// Live data should take half of the threshold, the heap can double
+/// before the next major collection.
+#define GC_DEFAULT_LIVE_RATIO 50
+/// Bytes allocated by the VM after which the young objects are collected.
+#define GC_DEFAULT_NURSERY_SIZE (256ul * 1024)
+/// Objects traced or swept by one incremental step, it bounds the pause.
+#define GC_DEFAULT_STEP_WORK 1024
+/// The heap is compacted when free blocks take this percentage of its used part.
+#define GC_DEFAULT_COMPACT_FRAGMENTATION 50
+
+/**
+ * Settings of the GC, they trade memory for the time spent collecting.
+ *
+ * After every major collection the threshold of the next one is set so that
+ * the data that survived takes 'live_ratio' percent of it. It is kept between
+ * 'min_threshold' and 'max_threshold', so it shrinks when the live data does.
+ * A smaller ratio means fewer collections and a bigger heap.
+ *
+ * The settings are read from the environment (CABY_HEAP_SIZE, CABY_GC_*) and
+ * the options of 'caby execute' override them, see gc_policy_usage.
+ */
+struct gc_policy {
+    /// Size of the heap pool, allocations over it fail.
+    size_t heap_size;
+    /// Percentage of the threshold that the live data should take.
+    size_t live_ratio;
+    size_t min_threshold;
+    /// Zero means the size of the heap.
+    size_t max_threshold;
+    size_t nursery_size;
+    size_t step_work;
+    /// Zero turns the compaction off.
+    size_t compact_fragmentation;
+};
+
+void init_gc_policy(struct gc_policy* p);
+
+/// Reads the settings from the environment variables, returns false
+/// (after printing the error) if one of them is invalid.
+bool gc_policy_from_env(struct gc_policy* p);
+
+/// Returns the number of arguments 'argv' used if it starts with an option
+/// of the policy, 0 if it does not, -1 if the value is invalid.
+int gc_policy_parse_arg(struct gc_policy* p, const char* argv[]);
+
+/// Threshold of the next major collection when 'live' bytes survived the last one.
+size_t gc_policy_threshold(const struct gc_policy* p, size_t live);
+
+void gc_policy_usage(FILE* f);
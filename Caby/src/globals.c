@@ -0,0 +1,28 @@
+#include "globals.h"
+#include "common.h"
+#include "memory.h"
+
+void init_globals(struct globals* g) {
+    init_table(&g->names);
+    g->slots = NULL;
+    g->len = 0;
+    g->cap = 0;
+}
+
+void free_globals(struct globals* g) {
+    free_table(&g->names);
+    mem_free(g->slots);
+    init_globals(g);
+}
+
+u32 resolve_global(struct globals* g, struct value name) {
+    struct value slot;
+    if (table_get(&g->names, name, &slot)) {
+        return AS_CINT(slot);
+    }
+    g->slots = mem_handle_capacity(MEM_TABLES, g->slots, g->len, &g->cap, sizeof(*g->slots));
+    g->slots[g->len].value = NEW_NONE();
+    g->slots[g->len].defined = false;
+    table_set(&g->names, name, NEW_INT(g->len));
+    return g->len++;
+}
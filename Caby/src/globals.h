@@ -0,0 +1,35 @@
+#pragma once
+
+#include "common.h"
+#include "object.h"
+#include "hashtable.h"
+
+struct global_slot {
+    struct value value;
+    /// Set by the definition of the variable, accessing the slot
+    /// before that is an error.
+    bool defined;
+};
+
+/**
+ * Global variables of a program.
+ *
+ * Every global is identified by a slot. Instructions that access globals
+ * get the slot when the code is decoded, so at runtime they only index
+ * an array and the names are needed just for error messages.
+ */
+struct globals {
+    /// Maps names of globals to their slots.
+    struct table names;
+    struct global_slot* slots;
+    size_t len;
+    size_t cap;
+};
+
+void init_globals(struct globals* g);
+
+void free_globals(struct globals* g);
+
+/// Returns slot of the global called 'name', a new (undefined) slot
+/// is added the first time a name is seen.
+u32 resolve_global(struct globals* g, struct value name);
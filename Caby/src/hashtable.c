@@ -1,100 +1,191 @@
 #include "hashtable.h"
 #include "common.h"
 #include "object.h"
+#include "memory.h"
 #include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/// Control bytes of entries without a key, both have the top bit set.
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xFE
+
+/// Hash bits kept in the control byte.
+static inline u8 hash_ctrl(u32 hash) {
+    return hash & 0x7F;
+}
+
+/// Hash bits that select the first group of the probe sequence.
+static inline size_t hash_group(u32 hash) {
+    return hash >> 7;
+}
+
+/// Returns a mask with bit 'i' set if the i-th control byte of the group is 'c'.
+static inline u32 group_match(const u8* group, u8 c) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+    u32 mask = 0;
+    for (u32 i = 0; i < TABLE_GROUP; ++i) {
+        mask |= (u32)(group[i] == c) << i;
+    }
+    return mask;
+#endif
+}
+
+/// Returns a mask of the empty and deleted entries of the group.
+static inline u32 group_match_free(const u8* group) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    u32 mask = 0;
+    for (u32 i = 0; i < TABLE_GROUP; ++i) {
+        mask |= (u32)(group[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+/*
+ * The probe sequence goes through the groups, the i-th step skips i groups.
+ * The number of groups is a power of two, so every group is visited before
+ * the sequence repeats, and there is always an empty entry because of the
+ * load limit.
+ */
+#define FOR_EACH_GROUP(t, hash, g)                                          \
+    for (size_t g##_mask = (t)->capacity / TABLE_GROUP - 1,                 \
+                g = hash_group(hash) & g##_mask, g##_step = 1;;             \
+         g = (g + g##_step++) & g##_mask)
 
 void init_table(struct table* t) {
     memset(t, 0, sizeof(*t));
 }
 
 void free_table(struct table* t) {
-    free(t->entries);
+    mem_free(t->entries);
     init_table(t);
 }
 
-/// Returns the entry where the key should be inserted if it's not in table,
-/// otherwise returns entry saved under the key.
-static struct entry* find_entry(struct entry* entries, size_t capacity,
-                                struct value key) {
-    // Assume the capacity is a power of two and do fast modulo using and.
-    u32 hash = value_hash(key);
-    u32 idx = hash & (capacity - 1);
-    struct entry* tombstone = NULL;
-
-    for (;;) {
-        struct entry* e = &entries[idx];
-        if (e->key.type == VAL_NONE) {
-            // empty entry
-            if (e->val.type == VAL_NONE) {
-                return tombstone != NULL ? tombstone : e;
-            } else {
-                // tombstone
-                // Save first occurence of encountered tombstone
-                if (tombstone == NULL) {
-                    tombstone = e;
-                }
+static struct entry* find_entry(struct table* t, struct value key, u32 hash) {
+    u8 c = hash_ctrl(hash);
+    FOR_EACH_GROUP(t, hash, g) {
+        const u8* group = &t->ctrl[g * TABLE_GROUP];
+        for (u32 m = group_match(group, c); m != 0; m &= m - 1) {
+            struct entry* e = &t->entries[g * TABLE_GROUP + __builtin_ctz(m)];
+            if (value_eq(e->key, key)) {
+                return e;
             }
-        } else if (value_eq(e->key, key)) {
-            return e;
         }
+        if (group_match(group, CTRL_EMPTY) != 0) {
+            return NULL;
+        }
+    }
+    UNREACHABLE();
+}
 
-        idx = (idx + 1) & (capacity - 1);
+/// Returns the index of the first empty or deleted entry in the probe sequence.
+static size_t find_free(struct table* t, u32 hash) {
+    FOR_EACH_GROUP(t, hash, g) {
+        u32 m = group_match_free(&t->ctrl[g * TABLE_GROUP]);
+        if (m != 0) {
+            return g * TABLE_GROUP + __builtin_ctz(m);
+        }
     }
     UNREACHABLE();
 }
 
+/// Reallocates the table to 'capacity' entries, which also drops the deleted ones.
 static void adjust_capacity(struct table* t, size_t capacity) {
-    struct entry* entries = malloc(sizeof(*entries) * capacity);
+    struct entry* old = t->entries;
+    size_t old_capacity = t->capacity;
 
+    t->entries = mem_alloc(MEM_TABLES, capacity * (sizeof(*t->entries) + 1));
+    t->ctrl = (u8*)(t->entries + capacity);
+    t->capacity = capacity;
+    t->used = t->count;
+    memset(t->ctrl, CTRL_EMPTY, capacity);
     for (size_t i = 0; i < capacity; ++i) {
-        entries[i].key = NEW_NONE();
-        entries[i].val = NEW_NONE();
+        t->entries[i].key = NEW_NONE();
+        t->entries[i].val = NEW_NONE();
     }
-    t->count = 0;
 
-    // Rehash the entire table
-    for (size_t i = 0; i < t->capacity; ++i) {
-        struct entry* e = &t->entries[i];
-        if (e->key.type == VAL_NONE) {
+    // Rehash the entire table, the keys are known to be distinct
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (IS_NONE(old[i].key)) {
             continue;
         }
-
-        struct entry* dest = find_entry(entries, capacity, e->key);
-        dest->key = e->key;
-        dest->val = e->val;
-        t->count += 1;
+        u32 hash = value_hash(old[i].key);
+        size_t idx = find_free(t, hash);
+        t->ctrl[idx] = hash_ctrl(hash);
+        t->entries[idx] = old[i];
     }
-    free(t->entries);
-
-    t->entries = entries;
-    t->capacity = capacity;
+    mem_free(old);
 }
 
 bool table_set(struct table* t, struct value key, struct value val) {
-    if (t->count >= t->capacity * TABLE_MAX_LOAD) {
-        u64 capacity = get_cap(t->capacity);
+    u32 hash = value_hash(key);
+    if (t->used + 1 > t->capacity * TABLE_MAX_LOAD) {
+        if (t->count != 0) {
+            struct entry* e = find_entry(t, key, hash);
+            if (e != NULL) {
+                e->val = val;
+                return false;
+            }
+        }
+        // If the deleted entries take most of the table, it is enough
+        // to get rid of them.
+        size_t capacity = t->capacity;
+        if (capacity == 0) {
+            capacity = TABLE_GROUP;
+        } else if (t->count + 1 > capacity * TABLE_MAX_LOAD / 2) {
+            capacity *= 2;
+        }
         adjust_capacity(t, capacity);
     }
 
-    struct entry* e = find_entry(t->entries, t->capacity, key);
-    bool is_new_key = e->key.type == VAL_NONE;
-    // Only increment count if the bucket doesn't contain tombstone
-    if (is_new_key && e->val.type == VAL_NONE) {
-        t->count += 1;
+    // Look for the key and remember the first entry it can be inserted to
+    u8 c = hash_ctrl(hash);
+    size_t idx = SIZE_MAX;
+    FOR_EACH_GROUP(t, hash, g) {
+        const u8* group = &t->ctrl[g * TABLE_GROUP];
+        for (u32 m = group_match(group, c); m != 0; m &= m - 1) {
+            struct entry* e = &t->entries[g * TABLE_GROUP + __builtin_ctz(m)];
+            if (value_eq(e->key, key)) {
+                e->val = val;
+                return false;
+            }
+        }
+        u32 avail = group_match_free(group);
+        if (idx == SIZE_MAX && avail != 0) {
+            idx = g * TABLE_GROUP + __builtin_ctz(avail);
+        }
+        if (group_match(group, CTRL_EMPTY) != 0) {
+            break;
+        }
     }
 
-    e->key = key;
-    e->val = val;
-    return is_new_key;
+    if (t->ctrl[idx] == CTRL_EMPTY) {
+        t->used += 1;
+    }
+    t->ctrl[idx] = c;
+    t->entries[idx].key = key;
+    t->entries[idx].val = val;
+    t->count += 1;
+    return true;
 }
 
-bool table_get(struct table* t, struct value key, struct value* val) {
+struct entry* table_find(struct table* t, struct value key) {
     if (t->count == 0) {
-        return false;
+        return NULL;
     }
+    return find_entry(t, key, value_hash(key));
+}
 
-    struct entry* e = find_entry(t->entries, t->capacity, key);
-    if (e->key.type == VAL_NONE) {
+bool table_get(struct table* t, struct value key, struct value* val) {
+    struct entry* e = table_find(t, key);
+    if (e == NULL) {
         return false;
     }
 
@@ -103,17 +194,46 @@ bool table_get(struct table* t, struct value key, struct value* val) {
 }
 
 bool table_delete(struct table* t, struct value key) {
-    if (t->count == 0) {
+    struct entry* e = table_find(t, key);
+    if (e == NULL) {
         return false;
     }
 
-    struct entry* e = find_entry(t->entries, t->capacity, key);
-    if (e->key.type == VAL_NONE) {
-        return false;
+    size_t idx = e - t->entries;
+    // An entry of a group with an empty one can be emptied, no probe
+    // sequence went past this group.
+    size_t group = idx / TABLE_GROUP * TABLE_GROUP;
+    if (group_match(&t->ctrl[group], CTRL_EMPTY) != 0) {
+        t->ctrl[idx] = CTRL_EMPTY;
+        t->used -= 1;
+    } else {
+        t->ctrl[idx] = CTRL_DELETED;
     }
-
-    // tombstone
-    e->key.type = VAL_NONE;
-    e->val = NEW_BOOL(true);
+    e->key = NEW_NONE();
+    e->val = NEW_NONE();
+    t->count -= 1;
     return true;
 }
+
+struct object_string* table_find_string(struct table* t, const char* chars,
+                                        u64 len, u32 hash) {
+    if (t->count == 0) {
+        return NULL;
+    }
+
+    u8 c = hash_ctrl(hash);
+    FOR_EACH_GROUP(t, hash, g) {
+        const u8* group = &t->ctrl[g * TABLE_GROUP];
+        for (u32 m = group_match(group, c); m != 0; m &= m - 1) {
+            struct entry* e = &t->entries[g * TABLE_GROUP + __builtin_ctz(m)];
+            struct object_string* s = as_string(AS_OBJECT(e->key));
+            if (s->hash == hash && s->size == len && memcmp(s->data, chars, len) == 0) {
+                return s;
+            }
+        }
+        if (group_match(group, CTRL_EMPTY) != 0) {
+            return NULL;
+        }
+    }
+    UNREACHABLE();
+}
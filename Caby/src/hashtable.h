@@ -4,17 +4,35 @@
 #include "common.h"
 #include "object.h"
 
-#define TABLE_MAX_LOAD 0.75
+/// Number of slots whose control bytes are compared at once.
+#define TABLE_GROUP 16
+/// The table grows when 7/8 of its slots are used or deleted.
+#define TABLE_MAX_LOAD 0.875
 
 struct entry {
     struct value key;
     struct value val;
 };
 
+/**
+ * Open addressing table in the style of Swiss tables. Every entry has a
+ * control byte which says whether the entry is empty, deleted, or holds
+ * a key with the given low 7 bits of the hash. The control bytes of
+ * TABLE_GROUP entries are compared at once (with SSE2 when available),
+ * so the keys are compared only for the entries with matching hash bits.
+ *
+ * Keys of empty and deleted entries are none, the table can be iterated
+ * by going through all 'capacity' entries and skipping those.
+ */
 struct table {
+    /// Number of keys in the table.
     size_t count;
+    /// Number of entries that are not empty, the deleted ones included.
+    size_t used;
     size_t capacity;
     struct entry* entries;
+    /// Control byte of every entry, allocated together with the entries.
+    u8* ctrl;
 };
 
 void init_table(struct table* t);
@@ -27,4 +45,13 @@ bool table_set(struct table* t, struct value key, struct value val);
 
 bool table_get(struct table* t, struct value key, struct value* val);
 
+/// Returns the entry with the key or NULL if there is no such entry.
+/// The pointer is valid until the table is modified.
+struct entry* table_find(struct table* t, struct value key);
+
 bool table_delete(struct table* t, struct value key);
+
+/// Returns string key of the table with the given contents or NULL if there
+/// is none. Used to intern strings, 'hash' has to be computed by hashString.
+struct object_string* table_find_string(struct table* t, const char* chars,
+                                        u64 len, u32 hash);
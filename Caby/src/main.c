@@ -7,6 +7,7 @@
 #include "vm.h"
 #include "dissasembler.h"
 #include "bytecode.h"
+#include "gc_policy.h"
 
 #define EQ(right, i) (strcmp(argv[(i)], (right)) == 0)
 
@@ -28,26 +29,45 @@ void usage() {
     fprintf(stderr, " commands:\n");
     fprintf(stderr, "  disassemble <file> - Serializes bytecode from file and disassembles it.\n");
     fprintf(stderr, "  execute <file> - Serializes bytecode from file and executes it.\n");
+    fprintf(stderr, "    --source <file> - Source code of the program, used in error messages.\n");
+    fprintf(stderr, "    --stats - Prints statistics of the inline caches, the GC (collections, pauses)\n");
+    fprintf(stderr, "              and the memory by category and peak RSS when the program ends.\n");
+    fprintf(stderr, "    --mark-threads <n> - Number of threads marking the heap (PARALLEL_MARK builds).\n");
+    fprintf(stderr, "  GC settings, they can be also set by the environment variables in parentheses:\n");
+    gc_policy_usage(stderr);
 }
 
-static int disassemble(const char* argv[]) {
+static int disassemble(const char* argv[], struct gc_policy* policy) {
     const char* filename = *argv++;
 
+    init_heap(policy->heap_size);
     u32 ep;
     vm_t vm = read_program(filename, &ep);
 
     disassemble_constant_pool(stdout, &vm.const_pool);
     free_vm_state(&vm);
+    done_heap();
 
     return 0;
 }
 
-static int execute(const char* argv[]) {
+static int execute(const char* argv[], struct gc_policy* policy) {
     const char* filename = NULL;
     const char* source = NULL;
+    bool stats = false;
+    u32 mark_threads = 1;
     for (;*argv != NULL; ++ argv) {
-        if (strcmp(*argv, "--source") == 0) {
+        int used = gc_policy_parse_arg(policy, argv);
+        if (used < 0) {
+            exit(4);
+        } else if (used > 0) {
+            argv += used - 1;
+        } else if (strcmp(*argv, "--source") == 0) {
             source = *(++argv);
+        } else if (strcmp(*argv, "--stats") == 0) {
+            stats = true;
+        } else if (strcmp(*argv, "--mark-threads") == 0 && argv[1] != NULL) {
+            mark_threads = strtoul(*(++argv), NULL, 10);
         } else {
             filename = *argv;
         }
@@ -58,13 +78,26 @@ static int execute(const char* argv[]) {
         exit(4);
     }
 
+    init_heap(policy->heap_size);
     u32 ep;
     vm_t vm = read_program(filename, &ep);
     vm.filename = source;
+    gc_set_policy(&vm.gc, policy);
+#ifdef __PARALLEL_MARK__
+    vm.gc.mark_threads = mark_threads > 0 ? mark_threads : 1;
+#else
+    if (mark_threads > 1) {
+        fprintf(stderr, "Parallel marking is not compiled in, using one thread.\n");
+    }
+#endif
 
     interpret(&vm, ep);
+    if (stats) {
+        print_stats(&vm, stderr);
+    }
 
     free_vm_state(&vm);
+    done_heap();
 
     return 0;
 }
@@ -75,20 +108,22 @@ int main(int argc, const char* argv[]) {
         exit(1);
     }
 
-    // 1MB heap
-    init_heap(1024 * 1024 * 1024);
+    struct gc_policy policy;
+    init_gc_policy(&policy);
+    if (!gc_policy_from_env(&policy)) {
+        exit(4);
+    }
     int exit = 1;
     for (int i = 0; i < argc; ++ i) {
         if (EQ("disassemble", i)) {
-            exit = disassemble(argv + 2);
+            exit = disassemble(argv + 2, &policy);
         } else if (EQ("execute", i)) {
-            exit = execute(argv + 2);
+            exit = execute(argv + 2, &policy);
         }
     }
     if (exit == 1) {
         usage();
     }
 
-    done_heap();
     return exit;
 }
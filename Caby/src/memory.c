@@ -7,16 +7,49 @@
 #include <string.h>
 #include <assert.h>
 
+/// Prefix of every block from mem_alloc, 16 bytes so that the data
+/// keeps the alignment of malloc.
+struct mem_header {
+    size_t size;
+    size_t category;
+};
+
+/// Only the VM thread allocates, the parallel marker uses plain malloc.
+static size_t mem_bytes[MEM_CATEGORIES];
+static size_t mem_bytes_total;
+
+static const char* mem_names[MEM_CATEGORIES] = {
+    [MEM_OBJECTS] = "object data",
+    [MEM_TABLES] = "tables",
+    [MEM_BYTECODE] = "bytecode",
+    [MEM_STACKS] = "stacks",
+    [MEM_GC] = "gc",
+};
 
 void* vmalloc(vm_t* vm, size_t size) {
 #ifdef __GC_STRESS__
     assert(vm != NULL);
-    gc_collect(vm);
+    // Collections on every allocation check the write barriers, every few
+    // of them is a major one.
+    u64 n = vm->gc.minor_count + vm->gc.major_count;
+    if (vm->gc.phase != GC_IDLE) {
+        gc_step(vm);
+    } else if (n % 32 == 31) {
+        gc_collect(vm);
+    } else if (n % 8 == 7) {
+        gc_start_cycle(vm);
+    } else {
+        gc_collect_young(vm);
+    }
     return heap_alloc(size);
 #else
-    if (mem_taken() > vm->gc.next_gc) {
-        gc_collect(vm);
-        vm->gc.next_gc *= GC_HEAP_GROW_FACTOR;
+    vm->gc.young_bytes += size;
+    if (vm->gc.phase != GC_IDLE) {
+        gc_step(vm);
+    } else if (mem_taken() > vm->gc.next_gc) {
+        gc_start_cycle(vm);
+    } else if (vm->gc.young_bytes > vm->gc.policy.nursery_size) {
+        gc_collect_young(vm);
     }
     void* mem = heap_alloc(size);
     if (!mem) {
@@ -42,12 +75,80 @@ void* vcalloc(vm_t* vm, size_t num, size_t size) {
     return mem;
 }
 
+void* vmalloc_no_gc(size_t size) {
+    void* mem = heap_alloc(size);
+    if (!mem) {
+        fprintf(stderr, "VM run out of memory\n");
+        exit(41);
+    }
+    return mem;
+}
+
 void vfree(void* ptr) {
     heap_free(ptr);
 }
 
+static void* mem_account(struct mem_header* h, enum mem_category category, size_t size) {
+    if (h == NULL) {
+        fprintf(stderr, "Failed to allocate %lu bytes from OS\n", size);
+        exit(-2);
+    }
+    h->size = size;
+    h->category = category;
+    mem_bytes[category] += size;
+    mem_bytes_total += size;
+    return h + 1;
+}
+
+void* mem_alloc(enum mem_category category, size_t size) {
+    return mem_account(malloc(sizeof(struct mem_header) + size), category, size);
+}
+
+void* mem_calloc(enum mem_category category, size_t num, size_t size) {
+    return mem_account(calloc(1, sizeof(struct mem_header) + num * size), category, num * size);
+}
+
+void* mem_realloc(enum mem_category category, void* ptr, size_t size) {
+    struct mem_header* h = NULL;
+    if (ptr != NULL) {
+        h = (struct mem_header*)ptr - 1;
+        mem_bytes[h->category] -= h->size;
+        mem_bytes_total -= h->size;
+    }
+    return mem_account(realloc(h, sizeof(*h) + size), category, size);
+}
+
+void mem_free(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    struct mem_header* h = (struct mem_header*)ptr - 1;
+    mem_bytes[h->category] -= h->size;
+    mem_bytes_total -= h->size;
+    free(h);
+}
+
+void* mem_handle_capacity(enum mem_category category, void* array,
+                          size_t cnt, size_t* cap, size_t len) {
+    if (cnt >= *cap) {
+        *cap = get_cap(*cap);
+        array = mem_realloc(category, array, *cap * len);
+    }
+    return array;
+}
+
+size_t mem_category_bytes(enum mem_category category) {
+    return mem_bytes[category];
+}
+
+const char* mem_category_name(enum mem_category category) {
+    return mem_names[category];
+}
+
 size_t mem_taken() {
-    return heap_taken();
+    // The value stack is allocated at its full size when the VM starts, but
+    // its pages are mapped only when the program gets there.
+    return heap_taken() + mem_bytes_total - mem_bytes[MEM_STACKS];
 }
 
 size_t mem_total() {
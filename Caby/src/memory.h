@@ -13,8 +13,55 @@ void* vmalloc(vm_t* vm, size_t size);
  */
 void* vcalloc(vm_t* vm, size_t num, size_t size);
 
+/// Allocates memory without running the GC, for places that
+/// can't guarantee that all their objects are reachable.
+void* vmalloc_no_gc(size_t size);
+
 void vfree(void* ptr);
 
+/// Parts of the VM's memory outside the GC heap, see mem_alloc.
+enum mem_category {
+    /// Parts of objects that are not in the GC heap: vtables, shapes
+    /// and member slots of instances that outgrew the inline ones.
+    MEM_OBJECTS,
+    /// Hash tables and global slots.
+    MEM_TABLES,
+    /// Bytecode, decoded instructions, their caches and the constant pool.
+    MEM_BYTECODE,
+    /// The value stack and call frames.
+    MEM_STACKS,
+    /// Worklist, remembered set and the arrays of young objects.
+    MEM_GC,
+    MEM_CATEGORIES,
+};
+
+/**
+ * Allocates 'size' bytes with the system allocator and counts them to
+ * 'category'. These bytes count to mem_taken, so they are part of the heap
+ * size the GC threshold is compared with. Aborts when out of memory.
+ * The memory has to be freed by mem_free.
+ */
+void* mem_alloc(enum mem_category category, size_t size);
+
+void* mem_calloc(enum mem_category category, size_t num, size_t size);
+
+/// Resizes memory from mem_alloc, 'ptr' may be NULL.
+void* mem_realloc(enum mem_category category, void* ptr, size_t size);
+
+/// Frees memory from mem_alloc, does nothing if 'ptr' is NULL.
+void mem_free(void* ptr);
+
+/// handle_capacity for memory from mem_alloc.
+void* mem_handle_capacity(enum mem_category category, void* array,
+                          size_t cnt, size_t* cap, size_t len);
+
+/// Bytes currently allocated by mem_alloc for 'category'.
+size_t mem_category_bytes(enum mem_category category);
+
+const char* mem_category_name(enum mem_category category);
+
+/// Bytes taken by objects in the GC heap and by memory from mem_alloc,
+/// apart from the stacks. The GC threshold is compared with it.
 size_t mem_taken();
 
 size_t mem_total();
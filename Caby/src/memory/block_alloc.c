@@ -3,24 +3,107 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#define BITMAP_WORDS ((SIZE_CLASSES + 63) / 64)
+
+/// Free block, the link is stored in its (unused) data.
+struct free_block {
+    struct heap_header header;
+    struct free_block* next;
+};
 
-/// FIXME: Not thread-safe
 void* mempool;
+uint64_t* heap_objects;
+uint64_t* heap_marks;
 size_t mempool_taken;
 size_t mempool_total;
 
+/// First byte of the pool that was never handed out.
+static uint8_t* wilderness;
+static uint8_t* pool_end;
+static struct free_block* free_lists[SIZE_CLASSES];
+/// Bit 'i' is set if free_lists[i] is not empty.
+static uint64_t nonempty[BITMAP_WORDS];
+/// Bytes of the blocks in the free lists.
+static size_t free_listed;
+
+/*
+ * Forwarding table of the compaction. The live blocks are numbered in the
+ * order of their addresses, 'fwd_addr' has the new address of every one
+ * and 'fwd_first' the number of the first live block in each bitmap word.
+ * The number of a block is then the first one of its word plus the marks
+ * before it in the word.
+ */
+static size_t* fwd_first;
+static void** fwd_addr;
+static uint8_t* fwd_end;
+
 #ifdef __MEM_DEBUG__
 #define MEM_LOG(fmt, ...) do { fprintf(stderr, fmt, ##__VA_ARGS__);} while (false)
 #else
 #define MEM_LOG(fmt, ...)
 #endif
 
-static struct heap_header* init_header(void* at) {
-    struct heap_header* h = at;
-    h->len = 0;
-    h->next = NULL;
-    h->taken = false;
-    return h;
+/// Returns the smallest class which blocks can hold 'size' bytes.
+/// All classes can hold the free list link.
+static size_t class_of(size_t size) {
+    if (size <= SMALL_MAX) {
+        return size == 0 ? 0 : (size - 1) / SMALL_STEP;
+    }
+    size_t s = size - 1;
+    int bits = 63 - __builtin_clzl(s);
+    // 's >> (bits - 2)' is 4 to 7, these are the four classes of the power of two
+    return SMALL_CLASSES + (bits - 8) * 4 + ((s >> (bits - 2)) - 4);
+}
+
+static size_t class_size(size_t cls) {
+    if (cls < SMALL_CLASSES) {
+        return (cls + 1) * SMALL_STEP;
+    }
+    cls -= SMALL_CLASSES;
+    return (5 + cls % 4) << (cls / 4 + 6);
+}
+
+static void push_free(struct heap_header* h) {
+    // The largest class the block is big enough for
+    size_t cls = class_of(h->len);
+    if (class_size(cls) > h->len) {
+        cls -= 1;
+    }
+    struct free_block* b = (struct free_block*)h;
+    b->next = free_lists[cls];
+    free_lists[cls] = b;
+    free_listed += h->len;
+    nonempty[cls / 64] |= 1ull << (cls % 64);
+}
+
+static struct heap_header* pop_free(size_t cls) {
+    struct free_block* b = free_lists[cls];
+    free_lists[cls] = b->next;
+    free_listed -= b->header.len;
+    if (b->next == NULL) {
+        nonempty[cls / 64] &= ~(1ull << (cls % 64));
+    }
+    return &b->header;
+}
+
+/// Returns the first non-empty class bigger or equal to 'cls',
+/// SIZE_CLASSES if there is none.
+static size_t next_nonempty(size_t cls) {
+    for (size_t w = cls / 64; w < BITMAP_WORDS; ++w) {
+        uint64_t bits = nonempty[w];
+        if (w == cls / 64) {
+            bits &= ~0ull << (cls % 64);
+        }
+        if (bits != 0) {
+            return w * 64 + __builtin_ctzll(bits);
+        }
+    }
+    return SIZE_CLASSES;
 }
 
 void init_heap(size_t size) {
@@ -33,66 +116,74 @@ void init_heap(size_t size) {
         fprintf(stderr, "Failed to allocate %lu bytes from OS\n", size);
         exit(-2);
     }
-
-    struct heap_header* header = init_header(mempool);
+    // Pages of the bitmaps are mapped only when the pool gets there.
+    heap_objects = calloc(size / HEAP_MARK_GRANULE / 64 + 1, sizeof(*heap_objects));
+    heap_marks = calloc(size / HEAP_MARK_GRANULE / 64 + 1, sizeof(*heap_marks));
+    if (heap_objects == NULL || heap_marks == NULL) {
+        fprintf(stderr, "Failed to allocate %lu bytes from OS\n", size / HEAP_MARK_GRANULE / 8);
+        exit(-2);
+    }
     mempool_taken = 0;
-    header->len = size - sizeof(*header);
+    free_listed = 0;
+    wilderness = mempool;
+    pool_end = wilderness + size;
+    for (size_t i = 0; i < SIZE_CLASSES; ++i) {
+        free_lists[i] = NULL;
+    }
+    for (size_t i = 0; i < BITMAP_WORDS; ++i) {
+        nonempty[i] = 0;
+    }
 }
 
 void done_heap() {
     MEM_LOG("Freeing heap, remaining allocated memory: %luB\n", mempool_taken);
     free(mempool);
+    free(heap_objects);
+    free(heap_marks);
 }
 
 void* heap_alloc(size_t size) {
-    if (size < MIN_SPLIT) {
-        size = MIN_SPLIT;
-    }
-
-    struct heap_header* it = mempool;
-    while (it->taken || it->len < size) {
-        if (it->next != NULL) {
-            it = it->next;
-        } else {
-            break;
-        }
-    }
-
-    if (it->taken || it->len < size) {
+    size_t cls = class_of(size);
+    if (cls >= SIZE_CLASSES) {
         return NULL;
     }
+    size = class_size(cls);
 
-    it->taken = true;
-
-    // Split this block into another block if the allocation is small enough,
-    // if not then keep the original size.
-    // Be extra careful here, because all types are unsigned.
-    if (it->len - size >= MIN_SPLIT + sizeof(struct heap_header)) {
-        struct heap_header* h = init_header((uint8_t*)it + sizeof(*it) + size);
-        h->len = it->len - sizeof(*h) - size;
-        it->len = size;
-        h->next = it->next;
-        it->next = h;
-        MEM_LOG("Splitting block %lu / %lu\n", it->len, h->len);
+    struct heap_header* h;
+    if (free_lists[cls] != NULL) {
+        h = pop_free(cls);
+    } else if ((size_t)(pool_end - wilderness) >= sizeof(*h) + size) {
+        h = (struct heap_header*)wilderness;
+        h->len = size;
+        wilderness += sizeof(*h) + size;
+    } else {
+        size_t bigger = next_nonempty(cls + 1);
+        if (bigger == SIZE_CLASSES) {
+            return NULL;
+        }
+        h = pop_free(bigger);
+        // Split the block if the rest fits at least the smallest class
+        if (h->len >= size + sizeof(struct heap_header) + SMALL_STEP) {
+            struct heap_header* rest = (struct heap_header*)((uint8_t*)(h + 1) + size);
+            rest->len = h->len - size - sizeof(*rest);
+            h->len = size;
+            push_free(rest);
+            MEM_LOG("Splitting block %lu / %lu\n", h->len, rest->len);
+        }
     }
 
-    mempool_taken += it->len;
-    MEM_LOG("Allocating %lu memory (%lu/%lu)\n", it->len + sizeof(*it), mempool_taken, mempool_total);
-    return (uint8_t*)it + sizeof(*it);
+    mempool_taken += h->len;
+    MEM_LOG("Allocating %lu memory (%lu/%lu)\n", h->len, mempool_taken, mempool_total);
+    return h + 1;
 }
 
 void heap_free(void* ptr) {
-    struct heap_header* it = (struct heap_header*)((uint8_t*)ptr - sizeof(*it));
-    mempool_taken -= it->len;
-    MEM_LOG("Freeing block, size: %lu (%lu/%lu)\n", it->len, mempool_taken, mempool_total);
-    it->taken = false;
-    struct heap_header* next = it->next;
-    // Merge blocks that are next to this one and also free
-    while (next != NULL && !next->taken) {
-        it->len += sizeof(*next) + next->len;
-        it->next = next->next;
-        next = next->next;
-    }
+    struct heap_header* h = (struct heap_header*)ptr - 1;
+    size_t i = heap_mark_index(ptr);
+    heap_objects[i / 64] &= ~((uint64_t)1 << (i % 64));
+    mempool_taken -= h->len;
+    MEM_LOG("Freeing block, size: %lu (%lu/%lu)\n", h->len, mempool_taken, mempool_total);
+    push_free(h);
 }
 
 size_t heap_total() {
@@ -102,3 +193,92 @@ size_t heap_total() {
 size_t heap_taken() {
     return mempool_taken;
 }
+
+size_t heap_bitmap_words() {
+    return heap_mark_index(wilderness) / 64 + 1;
+}
+
+size_t heap_used() {
+    return wilderness - (uint8_t*)mempool;
+}
+
+size_t heap_free_listed() {
+    return free_listed;
+}
+
+bool heap_prepare_compaction() {
+    size_t words = heap_bitmap_words();
+    size_t live = 0;
+    for (size_t w = 0; w < words; ++w) {
+        live += __builtin_popcountll(heap_marks[w]);
+    }
+    fwd_first = malloc(words * sizeof(*fwd_first));
+    fwd_addr = malloc((live + 1) * sizeof(*fwd_addr));
+    if (fwd_first == NULL || fwd_addr == NULL) {
+        free(fwd_first);
+        free(fwd_addr);
+        return false;
+    }
+    uint8_t* to = mempool;
+    size_t n = 0;
+    for (size_t w = 0; w < words; ++w) {
+        fwd_first[w] = n;
+        for (uint64_t marks = heap_marks[w]; marks != 0; marks &= marks - 1) {
+            struct heap_header* h = (struct heap_header*)heap_granule(w * 64 + __builtin_ctzll(marks)) - 1;
+            fwd_addr[n++] = to + sizeof(*h);
+            to += sizeof(*h) + h->len;
+        }
+    }
+    fwd_end = to;
+    return true;
+}
+
+void* heap_forward(const void* ptr) {
+    size_t i = heap_mark_index(ptr);
+    uint64_t before = heap_marks[i / 64] & (((uint64_t)1 << (i % 64)) - 1);
+    return fwd_addr[fwd_first[i / 64] + __builtin_popcountll(before)];
+}
+
+void heap_finish_compaction() {
+    size_t words = heap_bitmap_words();
+    size_t n = 0;
+    mempool_taken = 0;
+    // Blocks only move down, so the ones that were not moved yet are not
+    // overwritten and their object bits are still in place.
+    for (size_t w = 0; w < words; ++w) {
+        uint64_t marks = heap_marks[w];
+        heap_marks[w] = 0;
+        for (; marks != 0; marks &= marks - 1) {
+            size_t i = w * 64 + __builtin_ctzll(marks);
+            struct heap_header* h = (struct heap_header*)heap_granule(i) - 1;
+            uint8_t* to = fwd_addr[n++];
+            bool object = (heap_objects[i / 64] >> (i % 64)) & 1;
+            heap_objects[i / 64] &= ~((uint64_t)1 << (i % 64));
+            mempool_taken += h->len;
+            memmove(to - sizeof(*h), h, sizeof(*h) + h->len);
+            if (object) {
+                heap_set_object(to);
+            }
+        }
+    }
+    free(fwd_first);
+    free(fwd_addr);
+
+    // The rest of the pool is unused again, its pages are given back to the OS.
+    uint8_t* old_end = wilderness;
+    wilderness = fwd_end;
+    free_listed = 0;
+    for (size_t i = 0; i < SIZE_CLASSES; ++i) {
+        free_lists[i] = NULL;
+    }
+    for (size_t i = 0; i < BITMAP_WORDS; ++i) {
+        nonempty[i] = 0;
+    }
+#ifdef __linux__
+    uintptr_t page = 4096;
+    uintptr_t from = ((uintptr_t)wilderness + page - 1) & ~(page - 1);
+    if ((uintptr_t)old_end > from) {
+        madvise((void*)from, (uintptr_t)old_end - from, MADV_DONTNEED);
+    }
+#endif
+}
@@ -3,22 +3,35 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#define MIN_SPLIT 32
 #define MINIMUM_HEAP_SIZE 512lu
 
+/*
+ * Segregated size-class allocator.
+ *
+ * Every allocation is rounded up to a size class. Small classes go up
+ * to SMALL_MAX in steps of SMALL_STEP, they cover the objects of the VM
+ * (strings, instances, functions...). Larger sizes have four classes for
+ * every power of two. Each class has a list of free blocks, freeing
+ * pushes the block to the list of its class and allocation pops it,
+ * both in constant time.
+ *
+ * If the list of the class is empty, the block is cut from the not yet
+ * used end of the pool, or from a free block of a bigger class (the rest
+ * of it goes back to the free lists). Non-empty classes are tracked in
+ * a bitmap, so finding the bigger block does not depend on the number of blocks.
+ */
+#define SMALL_STEP 16
+#define SMALL_MAX 256
+#define SMALL_CLASSES (SMALL_MAX / SMALL_STEP)
+/// Four classes for every power of two up to 2^40.
+#define SIZE_CLASSES (SMALL_CLASSES + 4 * 32)
+
+/// Precedes every block.
 struct heap_header {
+    /// Usable size of the block, at least the size of its class.
     size_t len;
-    struct heap_header* next;
-    bool taken;
 };
 
-// #define SET_TAKEN(header) do { (header)->next &= 1; } while (false)
-// #define SET_FREE(header) do { (header)->next &= 0; } while (false)
-// #define IS_TAKEN(header) ((uintptr_t)(header)->next & 1ULL)
-// #define GET_NEXT(header) ((struct heap_header*)(((uintptr_t)(header)->next) & ~(1ULL)))
-// #define SET_NEXT(header, ptr) do { (header)->next = (struct heap_header*)(((uintptr_t)(header)->next & 1ULL) & (uintptr_t)(ptr)); } while (false)
-
-
 void init_heap(size_t size);
 
 void done_heap();
@@ -30,3 +43,88 @@ void heap_free(void* ptr);
 size_t heap_total();
 
 size_t heap_taken();
+
+/// Bytes between the start of the pool and its never used part.
+size_t heap_used();
+
+/// Bytes of the free blocks, the allocator can reuse them only for
+/// allocations of their size class or smaller.
+size_t heap_free_listed();
+
+/*
+ * Bitmaps of the GC, one bit for every HEAP_MARK_GRANULE bytes of the pool.
+ * 'heap_objects' has the bits of blocks that hold VM objects (set by
+ * heap_set_object, cleared by heap_free), so the GC finds all objects by
+ * scanning it. 'heap_marks' are the mark bits, the collector does not have
+ * to write to the live objects.
+ */
+#define HEAP_MARK_GRANULE 8
+
+extern void* mempool;
+extern uint64_t* heap_objects;
+extern uint64_t* heap_marks;
+
+static inline size_t heap_mark_index(const void* ptr) {
+    return ((const uint8_t*)ptr - (const uint8_t*)mempool) / HEAP_MARK_GRANULE;
+}
+
+static inline void* heap_granule(size_t index) {
+    return (uint8_t*)mempool + index * HEAP_MARK_GRANULE;
+}
+
+static inline void heap_set_object(const void* ptr) {
+    size_t i = heap_mark_index(ptr);
+    heap_objects[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+static inline bool heap_is_marked(const void* ptr) {
+    size_t i = heap_mark_index(ptr);
+    return (heap_marks[i / 64] >> (i % 64)) & 1;
+}
+
+/// Sets the mark bit of the block, returns whether it was set before.
+static inline bool heap_mark(const void* ptr) {
+    size_t i = heap_mark_index(ptr);
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    bool was = (heap_marks[i / 64] & bit) != 0;
+    heap_marks[i / 64] |= bit;
+    return was;
+}
+
+static inline bool heap_is_marked_atomic(const void* ptr) {
+    size_t i = heap_mark_index(ptr);
+    return (__atomic_load_n(&heap_marks[i / 64], __ATOMIC_RELAXED) >> (i % 64)) & 1;
+}
+
+/// heap_mark for more threads at once.
+static inline bool heap_mark_atomic(const void* ptr) {
+    size_t i = heap_mark_index(ptr);
+    uint64_t bit = (uint64_t)1 << (i % 64);
+    return (__atomic_fetch_or(&heap_marks[i / 64], bit, __ATOMIC_RELAXED) & bit) != 0;
+}
+
+static inline void heap_unmark(const void* ptr) {
+    size_t i = heap_mark_index(ptr);
+    heap_marks[i / 64] &= ~((uint64_t)1 << (i % 64));
+}
+
+/// Number of bitmap words that cover the used part of the pool.
+size_t heap_bitmap_words();
+
+/*
+ * Sliding compaction, the live blocks are moved to the start of the pool in
+ * their order. The caller marks all blocks that are live (objects and the
+ * blocks they own) and calls heap_prepare_compaction, which computes their
+ * new addresses. Then it rewrites every pointer to a block with heap_forward
+ * and heap_finish_compaction moves the blocks, clears the marks and empties
+ * the free lists.
+ */
+
+/// Returns false if there is not enough memory for the forwarding table,
+/// nothing is moved then and the marks have to be cleared by the caller.
+bool heap_prepare_compaction();
+
+/// New address of the live block 'ptr'.
+void* heap_forward(const void* ptr);
+
+void heap_finish_compaction();
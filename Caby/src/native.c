@@ -1,9 +1,11 @@
 #include "native.h"
 #include "object.h"
+#include "array_ops.h"
 
 #include <math.h>
 
-struct value clock_nat(int arg_cnt, struct value* args) {
+struct value clock_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    (void)vm;
     if (arg_cnt != 0) {
         fprintf(stderr, "Wrong number of arguments!");
         exit(1);
@@ -14,18 +16,19 @@ struct value clock_nat(int arg_cnt, struct value* args) {
 // Converts value of type int or double to double,
 // otherwise causes runtime error.
 static double val_to_double(struct value v) {
-    switch (v.type) {
+    switch (VALUE_TYPE(v)) {
         case VAL_INT:
-            return v.integer;
+            return AS_CINT(v);
         case VAL_DOUBLE:
-            return v.double_num;
+            return AS_DOUBLE(v);
         default:
             fprintf(stderr, "Expected int or double in pow function\n");
             exit(1);
     }
 }
 
-struct value pow_nat(int arg_cnt, struct value* args) {
+struct value pow_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    (void)vm;
     if (arg_cnt != 2) {
         fprintf(stderr, "Wrong number of arguments!");
         exit(1);
@@ -34,3 +37,167 @@ struct value pow_nat(int arg_cnt, struct value* args) {
     double exponent = val_to_double(args[0]);
     return NEW_DOUBLE(pow(base, exponent));
 }
+
+// Reports wrong use of a native function and exits.
+static void native_error(const char* name, const char* msg) {
+    fprintf(stderr, "%s: %s\n", name, msg);
+    exit(1);
+}
+
+static void check_arity(const char* name, int arg_cnt, int arity) {
+    if (arg_cnt != arity) {
+        native_error(name, "Wrong number of arguments!");
+    }
+}
+
+static struct object_array* to_array(const char* name, struct value v) {
+    if (!IS_OBJECT(v) || AS_OBJECT(v)->type != OBJECT_ARRAY) {
+        native_error(name, "Expected an array");
+    }
+    return as_array(AS_OBJECT(v));
+}
+
+// Checks that both arrays have the same kind and length.
+static void check_same(const char* name, struct object_array* a, struct object_array* b) {
+    if (a->kind != b->kind) {
+        native_error(name, "Arrays must have the same kind");
+    }
+    if (a->len != b->len) {
+        native_error(name, "Arrays must have the same length");
+    }
+}
+
+// Creates array of 'kind' from its only argument, which is either
+// the length of a zeroed array or a list of the numbers.
+static struct value make_array(vm_t* vm, const char* name, enum array_kind kind,
+                               int arg_cnt, struct value* args) {
+    check_arity(name, arg_cnt, 1);
+    if (IS_INT(args[0])) {
+        if (AS_CINT(args[0]) < 0) {
+            native_error(name, "Array length must not be negative");
+        }
+        return NEW_OBJECT(new_array(vm, kind, AS_CINT(args[0])));
+    }
+    if (!IS_OBJECT(args[0]) || AS_OBJECT(args[0])->type != OBJECT_LIST) {
+        native_error(name, "Expected a length or a list");
+    }
+    // Natives don't run at points where the heap is compacted,
+    // the list stays where it is.
+    struct object_list* list = as_list(AS_OBJECT(args[0]));
+    struct object_array* array = new_array(vm, kind, list->len);
+    for (u32 i = 0; i < list->len; ++i) {
+        struct value v = list->items[i];
+        if (kind == ARRAY_INT && IS_INT(v)) {
+            array->ints[i] = AS_CINT(v);
+        } else if (kind == ARRAY_DOUBLE && (IS_INT(v) || IS_DOUBLE(v))) {
+            array->doubles[i] = val_to_double(v);
+        } else {
+            native_error(name, kind == ARRAY_INT ? "Expected a list of ints"
+                                                 : "Expected a list of numbers");
+        }
+    }
+    return NEW_OBJECT(array);
+}
+
+struct value int_array_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    return make_array(vm, "int_array", ARRAY_INT, arg_cnt, args);
+}
+
+struct value double_array_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    return make_array(vm, "double_array", ARRAY_DOUBLE, arg_cnt, args);
+}
+
+struct value array_fill_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    (void)vm;
+    check_arity("array_fill", arg_cnt, 2);
+    struct object_array* a = to_array("array_fill", args[1]);
+    struct value v = args[0];
+    if (a->kind == ARRAY_INT) {
+        if (!IS_INT(v)) {
+            native_error("array_fill", "Expected an int");
+        }
+        i32_fill(a->ints, AS_CINT(v), a->len);
+    } else {
+        if (!IS_INT(v) && !IS_DOUBLE(v)) {
+            native_error("array_fill", "Expected a number");
+        }
+        f64_fill(a->doubles, val_to_double(v), a->len);
+    }
+    return args[1];
+}
+
+struct value array_sum_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    (void)vm;
+    check_arity("array_sum", arg_cnt, 1);
+    struct object_array* a = to_array("array_sum", args[0]);
+    if (a->kind == ARRAY_INT) {
+        return NEW_INT(i32_sum(a->ints, a->len));
+    }
+    return NEW_DOUBLE(f64_sum(a->doubles, a->len));
+}
+
+struct value array_min_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    (void)vm;
+    check_arity("array_min", arg_cnt, 1);
+    struct object_array* a = to_array("array_min", args[0]);
+    if (a->len == 0) {
+        return NEW_NONE();
+    }
+    if (a->kind == ARRAY_INT) {
+        return NEW_INT(i32_min(a->ints, a->len));
+    }
+    return NEW_DOUBLE(f64_min(a->doubles, a->len));
+}
+
+struct value array_max_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    (void)vm;
+    check_arity("array_max", arg_cnt, 1);
+    struct object_array* a = to_array("array_max", args[0]);
+    if (a->len == 0) {
+        return NEW_NONE();
+    }
+    if (a->kind == ARRAY_INT) {
+        return NEW_INT(i32_max(a->ints, a->len));
+    }
+    return NEW_DOUBLE(f64_max(a->doubles, a->len));
+}
+
+struct value array_dot_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    (void)vm;
+    check_arity("array_dot", arg_cnt, 2);
+    struct object_array* a = to_array("array_dot", args[1]);
+    struct object_array* b = to_array("array_dot", args[0]);
+    check_same("array_dot", a, b);
+    if (a->kind == ARRAY_INT) {
+        return NEW_INT(i32_dot(a->ints, b->ints, a->len));
+    }
+    return NEW_DOUBLE(f64_dot(a->doubles, b->doubles, a->len));
+}
+
+struct value array_add_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    check_arity("array_add", arg_cnt, 2);
+    struct object_array* a = to_array("array_add", args[1]);
+    struct object_array* b = to_array("array_add", args[0]);
+    check_same("array_add", a, b);
+    struct object_array* res = new_array(vm, a->kind, a->len);
+    if (a->kind == ARRAY_INT) {
+        i32_add(res->ints, a->ints, b->ints, a->len);
+    } else {
+        f64_add(res->doubles, a->doubles, b->doubles, a->len);
+    }
+    return NEW_OBJECT(res);
+}
+
+struct value array_mul_nat(vm_t* vm, int arg_cnt, struct value* args) {
+    check_arity("array_mul", arg_cnt, 2);
+    struct object_array* a = to_array("array_mul", args[1]);
+    struct object_array* b = to_array("array_mul", args[0]);
+    check_same("array_mul", a, b);
+    struct object_array* res = new_array(vm, a->kind, a->len);
+    if (a->kind == ARRAY_INT) {
+        i32_mul(res->ints, a->ints, b->ints, a->len);
+    } else {
+        f64_mul(res->doubles, a->doubles, b->doubles, a->len);
+    }
+    return NEW_OBJECT(res);
+}
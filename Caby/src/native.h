@@ -7,10 +7,28 @@
 /// access them accordingly, so first argument
 /// is at args[arg_cnt - 1], second at args[arg_cnt - 2]
 /// and so on...
+/// The VM is passed so natives can allocate objects, the
+/// heap is never compacted during a native call.
 #include <time.h>
 
 #include "object.h"
 
-struct value clock_nat(int arg_cnt, struct value* args);
+struct value clock_nat(vm_t* vm, int arg_cnt, struct value* args);
 
-struct value pow_nat(int arg_cnt, struct value* args);
+struct value pow_nat(vm_t* vm, int arg_cnt, struct value* args);
+
+/// Array natives, they take the length of a new zeroed array or a list
+/// of the numbers, see object_array.
+struct value int_array_nat(vm_t* vm, int arg_cnt, struct value* args);
+struct value double_array_nat(vm_t* vm, int arg_cnt, struct value* args);
+
+/// Bulk operations on arrays, see array_ops.h. array_fill returns the
+/// array, array_add and array_mul return new arrays, array_min and
+/// array_max return none for empty arrays.
+struct value array_fill_nat(vm_t* vm, int arg_cnt, struct value* args);
+struct value array_sum_nat(vm_t* vm, int arg_cnt, struct value* args);
+struct value array_min_nat(vm_t* vm, int arg_cnt, struct value* args);
+struct value array_max_nat(vm_t* vm, int arg_cnt, struct value* args);
+struct value array_dot_nat(vm_t* vm, int arg_cnt, struct value* args);
+struct value array_add_nat(vm_t* vm, int arg_cnt, struct value* args);
+struct value array_mul_nat(vm_t* vm, int arg_cnt, struct value* args);
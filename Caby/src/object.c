@@ -1,4 +1,5 @@
 #include "object.h"
+#include "memory/block_alloc.h"
 #include "bytecode.h"
 #include "class.h"
 #include "vm.h"
@@ -6,16 +7,16 @@
 #include <assert.h>
 
 bool is_object_type(struct value* val, enum object_type type) {
-    return val->type == VAL_OBJECT && val->object->type == type;
+    return IS_OBJECT(*val) && AS_OBJECT(*val)->type == type;
 }
 
 struct object* to_object(struct value val) {
-    return val.object;
+    return AS_OBJECT(val);
 }
 
 struct object* to_object_s(struct value val) {
-    if (val.type == VAL_OBJECT) {
-        return val.object;
+    if (IS_OBJECT(val)) {
+        return AS_OBJECT(val);
     }
     return NULL;
 }
@@ -32,32 +33,104 @@ static u32 hashString(const char* key, int length) {
 
 void init_object(vm_t* vm, struct object* obj, enum object_type type) {
     obj->type = type;
-    obj->next = vm->objects;
-    vm->objects = obj;
-    obj->gc_data = 0;
+    obj->gc_data = GC_YOUNG;
+    heap_set_object(obj);
+    gc_add_young(&vm->gc, obj);
+    // Objects created during marking are black, so the marking finishes
+    // even if the program keeps allocating.
+    if (vm->gc.phase == GC_MARKING) {
+        heap_mark(obj);
+    }
 }
 
 struct object_string* new_string(vm_t* vm, const char* str) {
-    struct object_string* n = vmalloc(vm, sizeof(*n));
     size_t len = strlen(str);
+    u32 hash = hashString(str, len);
+    struct object_string* interned = table_find_string(&vm->strings, str, len, hash);
+    if (interned != NULL) {
+        return interned;
+    }
+    struct object_string* n = vmalloc(vm, sizeof(*n));
     n->size = len;
-    n->hash = hashString(str, n->size);
+    n->hash = hash;
+    n->interned = true;
+    n->left = NULL;
+    n->right = NULL;
     n->data = vmalloc(vm, len + 1);
     memcpy(n->data, str, n->size);
     n->data[n->size] = '\0';
     init_object(vm, &n->object, OBJECT_STRING);
+    table_set(&vm->strings, NEW_OBJECT(n), NEW_NONE());
     return n;
 }
 
 struct object_string* new_string_move(vm_t* vm, char* str, u32 len) {
+    u32 hash = hashString(str, len);
+    struct object_string* interned = table_find_string(&vm->strings, str, len, hash);
+    if (interned != NULL) {
+        vfree(str);
+        return interned;
+    }
     struct object_string* n = vmalloc(vm, sizeof(*n));
     n->size = len;
     n->data = str;
-    n->hash = hashString(str, len);
+    n->hash = hash;
+    n->interned = true;
+    n->left = NULL;
+    n->right = NULL;
     init_object(vm, &n->object, OBJECT_STRING);
+    table_set(&vm->strings, NEW_OBJECT(n), NEW_NONE());
     return n;
 }
 
+struct object_string* new_rope(vm_t* vm, struct object_string* left,
+                               struct object_string* right) {
+    struct object_string* n = vmalloc(vm, sizeof(*n));
+    n->size = left->size + right->size;
+    n->hash = 0;
+    n->interned = false;
+    n->data = NULL;
+    n->left = left;
+    n->right = right;
+    init_object(vm, &n->object, OBJECT_STRING);
+    gc_write_barrier(&vm->gc, &n->object, NEW_OBJECT(left));
+    gc_write_barrier(&vm->gc, &n->object, NEW_OBJECT(right));
+    return n;
+}
+
+const char* string_chars(struct object_string* s) {
+    if (s->data != NULL) {
+        return s->data;
+    }
+    char* data = vmalloc_no_gc(s->size + 1);
+    data[s->size] = '\0';
+    // Copy the leaves from the right end, the tree is walked with an explicit
+    // stack since ropes built in a loop are as deep as the number of iterations.
+    size_t pos = s->size;
+    size_t len = 0;
+    size_t cap = 0;
+    struct object_string** stack = NULL;
+    stack = handle_capacity(stack, len, &cap, sizeof(*stack));
+    stack[len++] = s;
+    while (len > 0) {
+        struct object_string* n = stack[--len];
+        if (n->data != NULL) {
+            pos -= n->size;
+            memcpy(data + pos, n->data, n->size);
+            continue;
+        }
+        stack = handle_capacity(stack, len + 1, &cap, sizeof(*stack));
+        stack[len++] = n->left;
+        stack[len++] = n->right;
+    }
+    free(stack);
+    s->data = data;
+    s->hash = hashString(data, s->size);
+    s->left = NULL;
+    s->right = NULL;
+    return data;
+}
+
 struct object_string* as_string(struct object* object) {
     return (struct object_string*)object;
 }
@@ -69,11 +142,13 @@ struct object_string* as_string_s(struct object* object) {
     return NULL;
 }
 
-struct object_function* new_function(vm_t* vm, u8 arity, u16 locals, struct bc_chunk c, u32 name) {
+struct object_function* new_function(vm_t* vm, u8 arity, u16 locals, u16 stack_size,
+                                     struct bc_chunk c, u32 name) {
     struct object_function* f = vmalloc(vm, sizeof(*f));
     init_object(vm, &f->object, OBJECT_FUNCTION);
     f->arity = arity;
     f->locals = locals;
+    f->stack_size = stack_size;
     f->bc = c;
     f->name = name;
     return f;
@@ -108,11 +183,63 @@ struct object_native* as_native_s(struct object* object) {
     return NULL;
 }
 
+struct object_list* new_list(vm_t* vm, u32 capacity) {
+    struct object_list* list = vmalloc(vm, sizeof(*list));
+    list->items = capacity == 0 ? NULL : mem_alloc(MEM_OBJECTS, capacity * sizeof(*list->items));
+    list->len = 0;
+    list->capacity = capacity;
+    init_object(vm, &list->object, OBJECT_LIST);
+    return list;
+}
+
+void list_append(struct object_list* list, struct value v) {
+    if (list->len == list->capacity) {
+        list->capacity = list->capacity < 4 ? 4 : list->capacity * 2;
+        list->items = mem_realloc(MEM_OBJECTS, list->items,
+                                  list->capacity * sizeof(*list->items));
+    }
+    list->items[list->len++] = v;
+}
+
+struct object_list* as_list(struct object* object) {
+    return (struct object_list*)object;
+}
+
+struct object_list* as_list_s(struct object* object) {
+    if (object->type == OBJECT_LIST) {
+        return as_list(object);
+    }
+    return NULL;
+}
+
+struct object_array* new_array(vm_t* vm, enum array_kind kind, u32 len) {
+    struct object_array* array = vmalloc(vm, sizeof(*array));
+    size_t item_size = kind == ARRAY_INT ? sizeof(*array->ints) : sizeof(*array->doubles);
+    array->kind = kind;
+    array->len = len;
+    array->ints = len == 0 ? NULL : mem_calloc(MEM_OBJECTS, len, item_size);
+    init_object(vm, &array->object, OBJECT_ARRAY);
+    return array;
+}
+
+struct object_array* as_array(struct object* object) {
+    return (struct object_array*)object;
+}
+
+struct object_array* as_array_s(struct object* object) {
+    if (object->type == OBJECT_ARRAY) {
+        return as_array(object);
+    }
+    return NULL;
+}
+
 void free_object(struct object* obj) {
     switch (obj->type) {
         case OBJECT_STRING: {
             struct object_string* s = as_string(obj);
-            vfree(s->data);
+            if (s->data != NULL) {
+                vfree(s->data);
+            }
             break;
         }
         case OBJECT_FUNCTION: {
@@ -124,13 +251,19 @@ void free_object(struct object* obj) {
             break;
         }
         case OBJECT_CLASS: {
-            struct object_class* c = as_class(obj);
-            free_table(&c->methods);
+            free_class(as_class(obj));
             break;
         }
         case OBJECT_INSTANCE: {
-            struct object_instance* i = as_instance(obj);
-            free_table(&i->members);
+            free_instance(as_instance(obj));
+            break;
+        }
+        case OBJECT_LIST: {
+            mem_free(as_list(obj)->items);
+            break;
+        }
+        case OBJECT_ARRAY: {
+            mem_free(as_array(obj)->ints);
             break;
         }
         default:
@@ -140,37 +273,49 @@ void free_object(struct object* obj) {
 }
 
 void free_value(struct value* val) {
-    if (val->type == VAL_OBJECT) {
-        free_object(val->object);
+    if (IS_OBJECT(*val)) {
+        free_object(AS_OBJECT(*val));
     }
 }
 
 u32 value_hash(struct value v) {
     u8* p;
     size_t len;
-    switch (v.type) {
+    // The payload is copied out so that the hash does not depend on
+    // the layout of the value.
+    int integer;
+    bool boolean;
+    double double_num;
+    struct object* object;
+    switch (VALUE_TYPE(v)) {
         case VAL_INT:
-            p = (u8*)&v.integer;
-            len = sizeof(v.integer);
+            integer = AS_CINT(v);
+            p = (u8*)&integer;
+            len = sizeof(integer);
             break;
         case VAL_BOOL:
-            p = (u8*)&v.boolean;
-            len = sizeof(v.boolean);
+            boolean = AS_BOOL(v);
+            p = (u8*)&boolean;
+            len = sizeof(boolean);
             break;
         case VAL_DOUBLE:
-            p = (u8*)&v.double_num;
-            len = sizeof(v.double_num);
+            double_num = AS_DOUBLE(v);
+            p = (u8*)&double_num;
+            len = sizeof(double_num);
             break;
         case VAL_OBJECT:
-            // TODO: should be able to use the below pointer hash when strings are interned
-            switch(v.object->type) {
+            object = AS_OBJECT(v);
+            // Strings are interned, but their hash is computed anyway
+            // and it is spread better than the hash of the pointer
+            switch(object->type) {
                 case OBJECT_STRING: {
-                    struct object_string* s = as_string(v.object);
+                    struct object_string* s = as_string(object);
+                    string_chars(s);
                     return s->hash;
                 }
                 default:
-                    p = (u8*)&v.object;
-                    len = sizeof(v.object);
+                    p = (u8*)&object;
+                    len = sizeof(object);
             }
             break;
         case VAL_NONE:
@@ -187,16 +332,16 @@ u32 value_hash(struct value v) {
 
 #define VALUE_COMPARE(FUN_NAME, OPERATOR) \
 bool FUN_NAME(struct value v1, struct value v2) {  \
-    if (v1.type != v2.type) {  \
+    if (VALUE_TYPE(v1) != VALUE_TYPE(v2)) {  \
         return false;  \
     }  \
-    switch (v1.type) {  \
+    switch (VALUE_TYPE(v1)) {  \
         case VAL_INT:  \
-            return v1.integer OPERATOR v2.integer;  \
+            return AS_CINT(v1) OPERATOR AS_CINT(v2);  \
         case VAL_BOOL:  \
-            return v1.boolean OPERATOR v2.boolean;  \
+            return AS_BOOL(v1) OPERATOR AS_BOOL(v2);  \
         case VAL_DOUBLE:  \
-            return v1.double_num OPERATOR v2.double_num;  \
+            return AS_DOUBLE(v1) OPERATOR AS_DOUBLE(v2);  \
         case VAL_NONE:  \
             return false;  \
         default:  \
@@ -213,33 +358,32 @@ VALUE_COMPARE(value_greatereq, >=)
 #undef VALUE_COMPARE
 
 bool value_eq(struct value v1, struct value v2) {
-    if (v1.type != v2.type) {
+    if (VALUE_TYPE(v1) != VALUE_TYPE(v2)) {
         return false;
     }
-    switch (v1.type) {
+    switch (VALUE_TYPE(v1)) {
         case VAL_INT:
-            return v1.integer == v2.integer;
+            return AS_CINT(v1) == AS_CINT(v2);
         case VAL_BOOL:
-            return v1.boolean == v2.boolean;
+            return AS_BOOL(v1) == AS_BOOL(v2);
         case VAL_DOUBLE:
-            return v1.double_num == v2.double_num;
+            return AS_DOUBLE(v1) == AS_DOUBLE(v2);
         case VAL_OBJECT:
-            switch (v1.object->type) {
-                case OBJECT_STRING: {
-                    // TODO: use the below pointer comparison when strings are interned
-                    struct object_string* s1 = as_string(v1.object);
-                    struct object_string* s2 = as_string(v2.object);
-                    if (s1->size != s2->size)
-                        return false;
-                    if (s1->hash != s2->hash)
-                        return false;
-                    return memcmp(s1->data, s2->data, s1->size) == 0;
+            if (AS_OBJECT(v1) == AS_OBJECT(v2)) {
+                return true;
+            }
+            if (AS_OBJECT(v1)->type == OBJECT_STRING && AS_OBJECT(v2)->type == OBJECT_STRING) {
+                struct object_string* s1 = as_string(AS_OBJECT(v1));
+                struct object_string* s2 = as_string(AS_OBJECT(v2));
+                // Different interned strings can't be equal
+                if ((s1->interned && s2->interned) || s1->size != s2->size) {
+                    return false;
                 }
-                default:
-                    // Equal means "the same object" in the shallow sense,
-                    // not structurally equal
-                    return v1.object == v2.object;
+                return memcmp(string_chars(s1), string_chars(s2), s1->size) == 0;
             }
+            // Equal means "the same object" in the shallow sense,
+            // not structurally equal
+            return false;
         case VAL_NONE:
             return true;
     }
@@ -18,6 +18,8 @@ enum object_type {
     OBJECT_NATIVE,
     OBJECT_CLASS,
     OBJECT_INSTANCE,
+    OBJECT_LIST,
+    OBJECT_ARRAY,
 };
 
 /**
@@ -25,7 +27,6 @@ enum object_type {
  * functions and so on.
  */
 struct object {
-    struct object* next;
     enum object_type type;
     /// Internal data used for GC (ie. marked, generation and so on...)
     u8 gc_data;
@@ -33,31 +34,89 @@ struct object {
 
 void init_object(vm_t* vm, struct object* obj, enum object_type type);
 
+/// Concatenations that produce shorter strings are done right away.
+#define ROPE_MIN_LENGTH 64
+
+/**
+ * String object.
+ *
+ * Strings are interned, equal strings created by new_string(_move) are
+ * the same object. Longer concatenations produce ropes instead: the string
+ * only points to its two operands and the characters are copied when they
+ * are needed for the first time (see string_chars). This keeps building
+ * a string piece by piece linear. Ropes are not interned.
+ */
 struct object_string {
     struct object object;
     /// Length of the string WITHOUT zero terminator.
     u64 size;
+    /// Valid only if 'data' is set.
     u32 hash;
-    /// Contains zero terminated string.
+    /// Whether the string is in the VM's interning table, if not it has
+    /// to be compared by contents.
+    bool interned;
+    /// Contains zero terminated string, NULL for ropes that were not
+    /// flattened yet.
     char* data;
+    /// Operands of the rope, cleared once it is flattened.
+    struct object_string* left;
+    struct object_string* right;
 };
 
 struct object_function {
     struct object object;
     u8 arity;
     u16 locals;
+    /// Maximum number of values the function can have on the operand stack.
+    u16 stack_size;
     struct bc_chunk bc;
     /// Index to constant pool
     u32 name;
 };
 
-typedef struct value (*native_fn_t)(int arg_cnt, struct value* args);
+typedef struct value (*native_fn_t)(vm_t* vm, int arg_cnt, struct value* args);
 
 struct object_native {
     struct object object;
     native_fn_t function;
 };
 
+/**
+ * List of values.
+ *
+ * The items are kept in one contiguous array, which grows twice its size
+ * when it is full, so appending is amortized constant time and indexing
+ * does not have to follow any pointers besides the array.
+ */
+struct object_list {
+    struct object object;
+    struct value* items;
+    u32 len;
+    u32 capacity;
+};
+
+enum array_kind {
+    ARRAY_INT,
+    ARRAY_DOUBLE,
+};
+
+/**
+ * Array of numbers of one kind with fixed length.
+ *
+ * The numbers are packed without the value tags, so the bulk natives
+ * (see array_ops.h) can process them with vector instructions. The
+ * array holds no references, the GC does not look into it.
+ */
+struct object_array {
+    struct object object;
+    enum array_kind kind;
+    u32 len;
+    union {
+        i32* ints;
+        double* doubles;
+    };
+};
+
 enum value_type {
     VAL_INT,
     VAL_BOOL,
@@ -66,6 +125,79 @@ enum value_type {
     VAL_NONE,
 };
 
+#ifdef __NAN_BOXING__
+/**
+ * Basically POD (data types + pointers to objects) values which are
+ * expected to reside on VM operand stack.
+ *
+ * The value is packed into one 64 bit word. Doubles are stored as they
+ * are, every other type lives in the unused payload of quiet NaN:
+ *  - object pointers have the sign bit set and 48 bit pointer in payload,
+ *  - integers have bit 48 set and the 32 bit integer in low bits,
+ *  - none, false and true are the constants 1, 2 and 3 in the payload.
+ * NaN produced by arithmetic is canonicalized so it never looks like
+ * one of the tagged values.
+ */
+struct value {
+    u64 bits;
+};
+
+#define VALUE_SIGN_BIT ((u64)0x8000000000000000)
+#define VALUE_QNAN ((u64)0x7ffc000000000000)
+#define VALUE_CANONICAL_NAN ((u64)0x7ff8000000000000)
+#define VALUE_TAG_INT ((u64)0x0001000000000000)
+#define VALUE_NONE_BITS (VALUE_QNAN | 1)
+#define VALUE_FALSE_BITS (VALUE_QNAN | 2)
+#define VALUE_TRUE_BITS (VALUE_QNAN | 3)
+
+static inline struct value new_double_value(double d) {
+    struct value v;
+    if (d != d) {
+        v.bits = VALUE_CANONICAL_NAN;
+    } else {
+        memcpy(&v.bits, &d, sizeof(d));
+    }
+    return v;
+}
+
+static inline double value_as_double(struct value v) {
+    double d;
+    memcpy(&d, &v.bits, sizeof(d));
+    return d;
+}
+
+#define NEW_INT(VAL) (struct value){.bits = VALUE_QNAN | VALUE_TAG_INT | (u32)(VAL)}
+#define NEW_BOOL(VAL) (struct value){.bits = (VAL) ? VALUE_TRUE_BITS : VALUE_FALSE_BITS}
+#define NEW_DOUBLE(VAL) new_double_value(VAL)
+#define NEW_OBJECT(VAL) (struct value){.bits = VALUE_SIGN_BIT | VALUE_QNAN | (u64)(uintptr_t)(VAL)}
+#define NEW_NONE() (struct value){.bits = VALUE_NONE_BITS}
+
+#define IS_DOUBLE(VAL) (((VAL).bits & VALUE_QNAN) != VALUE_QNAN)
+#define IS_OBJECT(VAL) (((VAL).bits & (VALUE_SIGN_BIT | VALUE_QNAN)) == (VALUE_SIGN_BIT | VALUE_QNAN))
+#define IS_INT(VAL) (((VAL).bits & (VALUE_SIGN_BIT | VALUE_QNAN | VALUE_TAG_INT)) == (VALUE_QNAN | VALUE_TAG_INT))
+#define IS_BOOL(VAL) (((VAL).bits | 1) == VALUE_TRUE_BITS)
+#define IS_NONE(VAL) ((VAL).bits == VALUE_NONE_BITS)
+
+#define AS_CINT(VAL) ((int)(u32)(VAL).bits)
+#define AS_BOOL(VAL) ((VAL).bits == VALUE_TRUE_BITS)
+#define AS_DOUBLE(VAL) value_as_double(VAL)
+#define AS_OBJECT(VAL) ((struct object*)(uintptr_t)((VAL).bits & ~(VALUE_SIGN_BIT | VALUE_QNAN)))
+
+static inline enum value_type value_type(struct value v) {
+    if (IS_DOUBLE(v)) {
+        return VAL_DOUBLE;
+    } else if (IS_OBJECT(v)) {
+        return VAL_OBJECT;
+    } else if (IS_INT(v)) {
+        return VAL_INT;
+    } else if (IS_NONE(v)) {
+        return VAL_NONE;
+    }
+    return VAL_BOOL;
+}
+
+#define VALUE_TYPE(VAL) value_type(VAL)
+#else
 /**
  * Basically POD (data types + pointers to objects) values which are
  * expected to reside on VM operand stack.
@@ -86,9 +218,18 @@ struct value {
 #define NEW_OBJECT(VAL) (struct value){.type = VAL_OBJECT, .object = (struct object*)(VAL)}
 #define NEW_NONE() (struct value){.type = VAL_NONE}
 
-/// To improve clarity of some functions
-#define AS_OBJECT(VAL) NEW_OBJECT(VAL)
+#define VALUE_TYPE(VAL) ((VAL).type)
+#define IS_INT(VAL) ((VAL).type == VAL_INT)
+#define IS_BOOL(VAL) ((VAL).type == VAL_BOOL)
+#define IS_DOUBLE(VAL) ((VAL).type == VAL_DOUBLE)
+#define IS_OBJECT(VAL) ((VAL).type == VAL_OBJECT)
+#define IS_NONE(VAL) ((VAL).type == VAL_NONE)
+
 #define AS_CINT(VAL) ((VAL).integer)
+#define AS_BOOL(VAL) ((VAL).boolean)
+#define AS_DOUBLE(VAL) ((VAL).double_num)
+#define AS_OBJECT(VAL) ((VAL).object)
+#endif
 
 /*
  * Following functions serve as constructors, converters and checkers
@@ -119,12 +260,21 @@ struct object_string* new_string(vm_t* vm, const char* str);
 /// len is the length of the string without zero terminator.
 struct object_string* new_string_move(vm_t* vm, char* str, u32 len);
 
+/// Returns a rope which is concatenation of 'left' and 'right'.
+struct object_string* new_rope(vm_t* vm, struct object_string* left,
+                               struct object_string* right);
+
+/// Returns the zero terminated contents of the string, ropes are flattened.
+/// Does not trigger the GC.
+const char* string_chars(struct object_string* s);
+
 struct object_string* as_string(struct object* object);
 
 struct object_string* as_string_s(struct object* object);
 
 /// Returns new function object, takes ownership of 'name'.
-struct object_function* new_function(vm_t* vm, u8 arity, u16 locals, struct bc_chunk c, u32 name);
+struct object_function* new_function(vm_t* vm, u8 arity, u16 locals, u16 stack_size,
+                                     struct bc_chunk c, u32 name);
 
 struct object_function* as_function(struct object* object);
 
@@ -136,6 +286,23 @@ struct object_native* as_native(struct object* object);
 
 struct object_native* as_native_s(struct object* object);
 
+/// Returns new empty list with space for 'capacity' items.
+struct object_list* new_list(vm_t* vm, u32 capacity);
+
+/// Appends 'v' to the end of the list, the caller is responsible for the write barrier.
+void list_append(struct object_list* list, struct value v);
+
+struct object_list* as_list(struct object* object);
+
+struct object_list* as_list_s(struct object* object);
+
+/// Returns new array of 'len' zeros.
+struct object_array* new_array(vm_t* vm, enum array_kind kind, u32 len);
+
+struct object_array* as_array(struct object* object);
+
+struct object_array* as_array_s(struct object* object);
+
 // Computes hash of a value.
 // (Hashing of strings is separate, this hashes the pointer to string.)
 u32 value_hash(struct value v);
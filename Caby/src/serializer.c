@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <string.h>
 #include "serializer.h"
 #include "bytecode.h"
 #include "common.h"
@@ -44,6 +45,10 @@ void serialize_instruction(FILE* f, struct bc_chunk* c) {
         case OP_NEQ:
         case OP_INEG:
         case OP_PUSH_NONE:
+        case OP_GET_INDEX:
+        case OP_SET_INDEX:
+        case OP_LIST_LEN:
+        case OP_LIST_APPEND:
             break;
         // Two byte size instructions
         case OP_PRINT:
@@ -59,6 +64,7 @@ void serialize_instruction(FILE* f, struct bc_chunk* c) {
         case OP_PUSH_SHORT:
         case OP_SET_LOCAL:
         case OP_GET_LOCAL:
+        case OP_NEW_LIST:
             write_word(c, read_2bytes_le(f));
             break;
         // Five byte size instructions
@@ -80,6 +86,64 @@ void serialize_instruction(FILE* f, struct bc_chunk* c) {
             write_dword(c, read_4bytes_le(f));
             write_byte(c, fgetc(f));
             break;
+        // Register instructions, all of them start with a slot
+        case OP_R_LOAD_NONE:
+        case OP_R_RETURN:
+            write_word(c, read_2bytes_le(f));
+            break;
+        case OP_R_LOAD_BOOL:
+        case OP_R_CALL_FUNC:
+        case OP_R_PRINT:
+            write_word(c, read_2bytes_le(f));
+            write_byte(c, fgetc(f));
+            break;
+        case OP_R_MOVE:
+        case OP_R_INEG:
+        case OP_R_LIST_LEN:
+            write_word(c, read_2bytes_le(f));
+            write_word(c, read_2bytes_le(f));
+            break;
+        case OP_R_LOAD_INT:
+        case OP_R_LOAD_LITERAL:
+        case OP_R_GET_GLOBAL:
+        case OP_R_SET_GLOBAL:
+        case OP_R_VAL_GLOBAL:
+        case OP_R_VAR_GLOBAL:
+        case OP_R_NEW_OBJECT:
+        case OP_R_BRANCH_FALSE:
+            write_word(c, read_2bytes_le(f));
+            write_dword(c, read_4bytes_le(f));
+            break;
+        case OP_R_IADD:
+        case OP_R_ISUB:
+        case OP_R_IMUL:
+        case OP_R_IDIV:
+        case OP_R_IMOD:
+        case OP_R_ILESS:
+        case OP_R_ILESSEQ:
+        case OP_R_IGREATER:
+        case OP_R_IGREATEREQ:
+        case OP_R_EQ:
+        case OP_R_NEQ:
+        case OP_R_NEW_LIST:
+        case OP_R_GET_INDEX:
+        case OP_R_SET_INDEX:
+        case OP_R_LIST_APPEND:
+            write_word(c, read_2bytes_le(f));
+            write_word(c, read_2bytes_le(f));
+            write_word(c, read_2bytes_le(f));
+            break;
+        case OP_R_DISPATCH_METHOD:
+            write_word(c, read_2bytes_le(f));
+            write_dword(c, read_4bytes_le(f));
+            write_byte(c, fgetc(f));
+            break;
+        case OP_R_GET_MEMBER:
+        case OP_R_SET_MEMBER:
+            write_word(c, read_2bytes_le(f));
+            write_word(c, read_2bytes_le(f));
+            write_dword(c, read_4bytes_le(f));
+            break;
         default:
             fprintf(stderr, "Unknown instruction opcode in deserialize: 0x%x\n", ins);
             exit(-3);
@@ -94,13 +158,14 @@ struct object_function* serialize_function(FILE* f, vm_t* vm) {
     u32 name = read_4bytes_le(f);
     u8 parameters = fgetc(f);
     u16 locals_cnt = read_2bytes_le(f);
+    u16 stack_size = read_2bytes_le(f);
     u32 body_len = read_4bytes_le(f);
     struct bc_chunk bc;
     init_bc_chunk(&bc);
     for (u32 i = 0; i < body_len; ++i) {
         serialize_instruction(f, &bc);
     }
-    return new_function(vm, parameters, locals_cnt, bc, name);
+    return new_function(vm, parameters, locals_cnt, stack_size, bc, name);
 }
 
 struct object* serialize_object(FILE* f, vm_t* vm) {
@@ -125,17 +190,16 @@ struct object* serialize_object(FILE* f, vm_t* vm) {
             u32 name = read_4bytes_le(f);
 
             u16 methods_len = read_2bytes_le(f);
-            struct table methods;
-            init_table(&methods);
+            struct object_class* klass = new_class(vm, name, methods_len);
             for (size_t i = 0; i < methods_len; ++ i) {
                 u32 fun = read_4bytes_le(f);
                 struct object_function* method = as_function_s(vm->const_pool.data[fun]);
                 assert(method != NULL);
                 struct object_string* name = as_string_s(vm->const_pool.data[method->name]);
                 assert(name != NULL);
-                table_set(&methods, NEW_OBJECT(name), NEW_INT(fun));
+                class_add_method(klass, (struct object*)name, method);
             }
-            return (struct object*)new_class(vm, name, methods);
+            return (struct object*)klass;
         }
         default:
             fprintf(stderr, "Unknown tag in serialize: 0x%x\n", tag);
@@ -156,11 +220,24 @@ void serialize_constant_pool(FILE* f, vm_t* vm) {
     }
 }
 
+/// Reads the file header and returns its flags.
+static u8 serialize_header(FILE* f) {
+    char magic[sizeof(BC_HEADER_MAGIC) - 1];
+    if (fread(magic, 1, sizeof(magic), f) != sizeof(magic)
+        || memcmp(magic, BC_HEADER_MAGIC, sizeof(magic)) != 0) {
+        fprintf(stderr, "The file is not a Caby bytecode (wrong header).\n");
+        exit(-3);
+    }
+    return read_1bytes_le(f);
+}
+
 vm_t serialize(FILE* f, u32* ep) {
     vm_t vm;
     init_vm_state(&vm);
     vm.gc.gc_off = true;
+    u8 flags = serialize_header(f);
     serialize_constant_pool(f, &vm);
+    decode_constant_pool(&vm.const_pool, &vm.globals, flags);
     *ep = read_4bytes_le(f);
     vm.gc.gc_off = false;
     return vm;
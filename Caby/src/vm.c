@@ -8,24 +8,31 @@
 #include "class.h"
 #include "dissasembler.h"
 #include "native.h"
+#include "memory.h"
+#include "memory/block_alloc.h"
 
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <assert.h>
 #include <time.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
 
 #ifdef __DEBUG__
-    #define DUMP_INS(ins) do {dissasemble_instruction(stderr, ins);fprintf(stderr, "\n");} while(false)
+    #define DUMP_INS(vm) do {struct bc_chunk* bc = &get_current_fun(vm)->bc; \
+                             dissasemble_instruction(stderr, instruction_bytes(bc, (vm)->ip - bc->code)); \
+                             fprintf(stderr, "\n");} while(false)
 #else
-    #define DUMP_INS(ins)
+    #define DUMP_INS(vm)
 #endif
 
 static void disassemble_stack(vm_t* vm) {
     for (size_t i = 0; i < vm->stack_len; ++i) {
         fprintf(stderr, "[");
-        if (vm->op_stack[i].type == VAL_OBJECT) {
-            fprintf(stderr, "<%p>", vm->op_stack[i].object);
+        if (IS_OBJECT(vm->op_stack[i])) {
+            fprintf(stderr, "<%p>", (void*)AS_OBJECT(vm->op_stack[i]));
         }
         disassemble_value(stderr, vm->op_stack[i], true);
         fprintf(stderr, "]");
@@ -47,7 +54,7 @@ static void runtime_error(vm_t* vm, const char* str, ...) {
     va_list args;
     va_start(args, str);
     struct object_function* f = get_current_fun(vm);
-    size_t loc_idx = range_between(f->bc.data,  vm->ip) - 1;
+    size_t loc_idx = vm->ip - f->bc.code - 1;
     struct loc loc = f->bc.location[loc_idx];
     print_error(vm->filename, loc, str, args);
     va_end(args);
@@ -56,38 +63,62 @@ static void runtime_error(vm_t* vm, const char* str, ...) {
 static void def_native(vm_t* vm, const char* name, native_fn_t fun) {
     push(vm, NEW_OBJECT(new_string(vm, name)));
     push(vm, NEW_OBJECT(new_native(vm, fun)));
-    table_set(&vm->globals, vm->op_stack[0], vm->op_stack[1]);
+    u32 slot = resolve_global(&vm->globals, vm->op_stack[0]);
+    struct global_slot* g = &vm->globals.slots[slot];
+    g->value = vm->op_stack[1];
+    g->defined = true;
     pop(vm);
     pop(vm);
 }
 
 void init_vm_state(vm_t* vm) {
     init_constant_pool(&vm->const_pool);
-    init_table(&vm->globals);
-    vm->locals = NULL;
+    init_globals(&vm->globals);
+    init_table(&vm->strings);
     vm->op_stack = NULL;
-    memset(vm->frames, 0, sizeof(vm->frames));
+    vm->frames = NULL;
     vm->frame_len = 0;
-    vm->stack_cap = 0;
+    vm->frame_cap = 0;
     vm->stack_len = 0;
-    vm->objects = NULL;
     init_gc(&vm->gc);
     vm->filename = NULL;
+    memset(&vm->stats, 0, sizeof(vm->stats));
+}
+
+void alloc_stack(vm_t* vm) {
+    vm->op_stack = mem_alloc(MEM_STACKS, sizeof(*vm->op_stack) * (OP_STACK_SIZE));
 }
 
-void alloc_frames(vm_t* vm) {
-    vm->locals = malloc(sizeof(*vm->locals) * (MAX_LOCALS));
+/// Returns false if locals and operands of 'f' do not fit into
+/// the value stack when they start at 'slots'.
+static bool frame_fits(vm_t* vm, struct object_function* f, struct value* slots) {
+    return slots + f->locals + f->stack_size <= vm->op_stack + OP_STACK_SIZE;
 }
 
-static void push_frame(vm_t* vm, struct object_function* f) {
+/// Pushes a new frame whose locals start at 'slots', where the caller
+/// already put the arguments. The stack code passes the arguments on
+/// top of the stack, the register code passes the register that holds
+/// the first argument. The rest of the locals may contain leftovers of
+/// previous calls, those are cleared so that the GC sees only valid values.
+static enum interpret_result push_frame(vm_t* vm, struct object_function* f, struct value* slots) {
     assert(vm->frame_len > 0);
+    if (!frame_fits(vm, f, slots)) {
+        runtime_error(vm, "Stack overflow");
+        return INTERPRET_ERROR;
+    }
+    vm->frames = mem_handle_capacity(MEM_STACKS, vm->frames, vm->frame_len,
+                                     &vm->frame_cap, sizeof(*vm->frames));
     struct call_frame* new_frame = &vm->frames[vm->frame_len];
-    struct call_frame* previous  = &vm->frames[vm->frame_len - 1];
     new_frame->function = f;
-    new_frame->slots = previous->slots + previous->function->locals;
+    new_frame->slots = slots;
     new_frame->ret = vm->ip;
-    vm->ip = new_frame->function->bc.data;
+    for (u16 i = f->arity; i < f->locals; ++i) {
+        slots[i] = NEW_NONE();
+    }
+    vm->stack_len = slots - vm->op_stack + f->locals;
+    vm->ip = new_frame->function->bc.code;
     vm->frame_len += 1;
+    return INTERPRET_CONTINUE;
 }
 
 static void pop_frame(vm_t* vm) {
@@ -102,23 +133,18 @@ static void pop_frame(vm_t* vm) {
 /// is not owned.
 void free_vm_state(vm_t* vm) {
     // Free all objects in VM heap
-    while (vm->objects) {
-        struct object* to_free = vm->objects;
-        vm->objects = vm->objects->next;
-        free_object(to_free);
-    }
+    gc_free_all();
     free_constant_pool(&vm->const_pool);
-    free_table(&vm->globals);
-    free(vm->locals);
-    free(vm->op_stack);
+    free_globals(&vm->globals);
+    free_table(&vm->strings);
+    mem_free(vm->frames);
+    mem_free(vm->op_stack);
     free_gc(&vm->gc);
     init_vm_state(vm);
 }
 
 void push(vm_t* vm, struct value val) {
-    vm->op_stack = handle_capacity(vm->op_stack, vm->stack_len,
-                                     &vm->stack_cap, sizeof(*vm->op_stack));
-
+    assert(vm->stack_len < OP_STACK_SIZE);
     vm->op_stack[vm->stack_len++] = val;
 }
 
@@ -133,11 +159,11 @@ struct value peek(vm_t* vm, size_t p) {
 
 static struct object_string* pop_string(vm_t* vm) {
     struct value v = pop(vm);
-    if (v.type != VAL_OBJECT || v.object->type != OBJECT_STRING) {
+    if (!IS_OBJECT(v) || AS_OBJECT(v)->type != OBJECT_STRING) {
         runtime_error(vm, "Expected string on top of stack");
         exit(1);
     }
-    return as_string(v.object);
+    return as_string(AS_OBJECT(v));
 }
 
 // =========== Interpreting functions ===========
@@ -151,6 +177,10 @@ struct value interpret_string_concat(vm_t* vm, struct object* o1, struct object*
     struct object_string* str2 = as_string(o2);
 
     u32 size = str1->size + str2->size;
+    if (size >= ROPE_MIN_LENGTH) {
+        return NEW_OBJECT(new_rope(vm, str1, str2));
+    }
+    // Both operands are short, so they are not ropes
     char* new_char = vmalloc(vm, size + 1);
     memcpy(new_char, str1->data, str1->size);
     memcpy(new_char + str1->size, str2->data, str2->size);
@@ -159,19 +189,191 @@ struct value interpret_string_concat(vm_t* vm, struct object* o1, struct object*
     return NEW_OBJECT(new_string_move(vm, new_char, size));
 }
 
-enum interpret_result interpret_print(vm_t* vm) {
-    u8 arg_cnt = READ_1B_IP(vm) - 1;
+/*
+ * Arithmetic shared by the stack and the register instructions. They
+ * store the result into 'res' and return false (after reporting the
+ * error) if the operands have incompatible types.
+ */
+static inline bool arith_add(vm_t* vm, struct value v1, struct value v2, struct value* res) {
+    if (IS_INT(v1) && IS_INT(v2)) {
+        *res = NEW_INT(AS_CINT(v1) + AS_CINT(v2));
+    } else if (IS_DOUBLE(v1) && IS_DOUBLE(v2)) {
+        *res = NEW_DOUBLE(AS_DOUBLE(v1) + AS_DOUBLE(v2));
+    } else if (IS_OBJECT(v1) && IS_OBJECT(v2)
+            && AS_OBJECT(v1)->type == OBJECT_STRING
+            && AS_OBJECT(v2)->type == OBJECT_STRING) {
+        *res = interpret_string_concat(vm, AS_OBJECT(v1), AS_OBJECT(v2));
+    } else {
+        runtime_error(vm, "Incopatible types for operator '+'");
+        return false;
+    }
+    return true;
+}
 
-    struct value v = pop(vm);
-    if (v.type != VAL_OBJECT || v.object->type != OBJECT_STRING) {
+static inline bool arith_sub(vm_t* vm, struct value v1, struct value v2, struct value* res) {
+    if (IS_INT(v1) && IS_INT(v2)) {
+        *res = NEW_INT(AS_CINT(v1) - AS_CINT(v2));
+    } else if (IS_DOUBLE(v1) && IS_DOUBLE(v2)) {
+        *res = NEW_DOUBLE(AS_DOUBLE(v1) - AS_DOUBLE(v2));
+    } else {
+        runtime_error(vm, "Incopatible types for operator '-'");
+        return false;
+    }
+    return true;
+}
+
+static inline bool arith_mul(vm_t* vm, struct value v1, struct value v2, struct value* res) {
+    if (IS_INT(v1) && IS_INT(v2)) {
+        *res = NEW_INT(AS_CINT(v1) * AS_CINT(v2));
+    } else if (IS_DOUBLE(v1) && IS_DOUBLE(v2)) {
+        *res = NEW_DOUBLE(AS_DOUBLE(v1) * AS_DOUBLE(v2));
+    // TODO: List and string multiplication
+    } else {
+        runtime_error(vm, "Incopatible types for operator '*'");
+        return false;
+    }
+    return true;
+}
+
+static inline bool arith_div(vm_t* vm, struct value v1, struct value v2, struct value* res) {
+    if (IS_INT(v1) && IS_INT(v2)) {
+        if (AS_CINT(v2) == 0) {
+            runtime_error(vm, "Division by zero error");
+            return false;
+        }
+        *res = NEW_INT(AS_CINT(v1) / AS_CINT(v2));
+    } else if (IS_DOUBLE(v1) && IS_DOUBLE(v2)) {
+        *res = NEW_DOUBLE(AS_DOUBLE(v1) / AS_DOUBLE(v2));
+    } else {
+        runtime_error(vm, "Incopatible types for operator '/'");
+        return false;
+    }
+    return true;
+}
+
+static inline bool arith_mod(vm_t* vm, struct value v1, struct value v2, struct value* res) {
+    if (IS_INT(v1) && IS_INT(v2)) {
+        if (AS_CINT(v2) == 0) {
+            runtime_error(vm, "Division by zero error");
+            return false;
+        }
+        *res = NEW_INT(AS_CINT(v1) % AS_CINT(v2));
+    } else {
+        runtime_error(vm, "Incopatible types for operator '\%'");
+        return false;
+    }
+    return true;
+}
+
+static inline bool arith_neg(vm_t* vm, struct value v, struct value* res) {
+    if (IS_INT(v)) {
+        *res = NEW_INT(-AS_CINT(v));
+    } else if (IS_DOUBLE(v)) {
+        *res = NEW_DOUBLE(-AS_DOUBLE(v));
+    } else {
+        runtime_error(vm, "Incopatible type for operator unary '-'");
+        return false;
+    }
+    return true;
+}
+
+/// Lists nested deeper than this are printed as '[...]', which also
+/// stops the printing of lists that contain themselves.
+#define PRINT_MAX_DEPTH 16
+
+/// Returns the number at index 'i' of the array.
+static inline struct value array_get(struct object_array* array, u32 i) {
+    return array->kind == ARRAY_INT ? NEW_INT(array->ints[i]) : NEW_DOUBLE(array->doubles[i]);
+}
+
+/// Prints one value, returns false if the value can't be printed.
+static bool print_value(vm_t* vm, struct value v, int depth) {
+    switch (VALUE_TYPE(v)) {
+        case VAL_INT:
+            printf("%d", AS_CINT(v));
+            break;
+        case VAL_BOOL:
+            fputs(AS_BOOL(v) ? "true" : "false", stdout);
+            break;
+        case VAL_DOUBLE:
+            printf("%f", AS_DOUBLE(v));
+            break;
+        case VAL_NONE:
+            printf("none");
+            break;
+        case VAL_OBJECT: {
+            switch (AS_OBJECT(v)->type) {
+                case OBJECT_STRING:
+                    fputs(string_chars(as_string(AS_OBJECT(v))), stdout);
+                    break;
+                case OBJECT_CLASS: {
+                    u32 name_idx = as_class(AS_OBJECT(v))->name;
+                    const char* name = as_string(vm->const_pool.data[name_idx])->data;
+                    printf("<class object '%s' at %p", name, (void*)AS_OBJECT(v));
+                    break;
+                }
+                case OBJECT_INSTANCE: {
+                    printf("<class instance at %p>", (void*)AS_OBJECT(v));
+                    break;
+                }
+                case OBJECT_LIST: {
+                    struct object_list* list = as_list(AS_OBJECT(v));
+                    if (depth == PRINT_MAX_DEPTH) {
+                        fputs("[...]", stdout);
+                        break;
+                    }
+                    putc('[', stdout);
+                    for (u32 i = 0; i < list->len; ++i) {
+                        if (i != 0) {
+                            fputs(", ", stdout);
+                        }
+                        if (!print_value(vm, list->items[i], depth + 1)) {
+                            return false;
+                        }
+                    }
+                    putc(']', stdout);
+                    break;
+                }
+                case OBJECT_ARRAY: {
+                    struct object_array* array = as_array(AS_OBJECT(v));
+                    putc('[', stdout);
+                    for (u32 i = 0; i < array->len; ++i) {
+                        if (i != 0) {
+                            fputs(", ", stdout);
+                        }
+                        if (!print_value(vm, array_get(array, i), depth + 1)) {
+                            return false;
+                        }
+                    }
+                    putc(']', stdout);
+                    break;
+                }
+                default:
+                    runtime_error(vm, "Can't print this type");
+                    return false;
+            }
+            break;
+        }
+        default:
+            UNREACHABLE();
+    }
+    return true;
+}
+
+/// Prints the format string args[0] with the rest of the arguments.
+static enum interpret_result print_values(vm_t* vm, struct value* args, u8 arg_cnt) {
+    arg_cnt -= 1;
+
+    struct value v = *args++;
+    if (!IS_OBJECT(v) || AS_OBJECT(v)->type != OBJECT_STRING) {
         runtime_error(vm, "First 'print' argument must be a string");
         return INTERPRET_ERROR;
     }
-    struct object_string* obj = as_string(v.object);
+    struct object_string* obj = as_string(AS_OBJECT(v));
 
     // TODO: Maybe buffer the output so that if error occurs we don't
     //       print it halfway.
-    for (const char* c = obj->data; *c != '\0'; ++c) {
+    for (const char* c = string_chars(obj); *c != '\0'; ++c) {
         if (*c == '{' && c[1] != '\0' && c[1] == '}') {
             if (arg_cnt == 0) {
                 runtime_error(vm, "There are more '{}' than arguments");
@@ -179,43 +381,8 @@ enum interpret_result interpret_print(vm_t* vm) {
             }
             arg_cnt -= 1;
             c += 1;
-            struct value v = pop(vm);
-            switch (v.type) {
-                case VAL_INT:
-                    printf("%d", v.integer);
-                    break;
-                case VAL_BOOL:
-                    fputs(v.boolean ? "true" : "false", stdout);
-                    break;
-                case VAL_DOUBLE:
-                    printf("%f", v.double_num);
-                    break;
-                case VAL_NONE:
-                    printf("none");
-                    break;
-                case VAL_OBJECT: {
-                    switch (v.object->type) {
-                        case OBJECT_STRING:
-                            fputs(as_string(v.object)->data, stdout);
-                            break;
-                        case OBJECT_CLASS: {
-                            u32 name_idx = as_class(v.object)->name;
-                            const char* name = as_string(vm->const_pool.data[name_idx])->data;
-                            printf("<class object '%s' at %p", name, &obj->object);
-                            break;
-                        }
-                        case OBJECT_INSTANCE: {
-                            printf("<class instance at %p>", &v.object);
-                            break;
-                        }
-                        default:
-                            runtime_error(vm, "Can't print this type");
-                            return INTERPRET_ERROR;
-                    }
-                    break;
-                }
-                default:
-                    UNREACHABLE();
+            if (!print_value(vm, *args++, 0)) {
+                return INTERPRET_ERROR;
             }
         } else if (*c == '\\' && c[1] != '\0') { // Escape sequence
             c += 1;
@@ -230,28 +397,39 @@ enum interpret_result interpret_print(vm_t* vm) {
         runtime_error(vm, "There are more arguments than '{}'.\n");
         return INTERPRET_ERROR;
     }
+    return INTERPRET_CONTINUE;
+}
 
+enum interpret_result interpret_print(vm_t* vm, u8 arg_cnt) {
+    // The format string is on the top, the arguments follow
+    struct value args[UINT8_MAX];
+    for (u8 i = 0; i < arg_cnt; ++i) {
+        args[i] = pop(vm);
+    }
+    if (print_values(vm, args, arg_cnt) == INTERPRET_ERROR) {
+        return INTERPRET_ERROR;
+    }
     push(vm, NEW_NONE());
     return INTERPRET_CONTINUE;
 }
 
-static enum interpret_result interpret_fun_call(vm_t* vm) {
+static enum interpret_result interpret_fun_call(vm_t* vm, u8 arity) {
     struct value v = pop(vm);
-    if (v.type == VAL_OBJECT) {
-        u8 arity = READ_1B_IP(vm);
-        if (v.object->type == OBJECT_FUNCTION) {
-            struct object_function* f = as_function(v.object);
+    if (IS_OBJECT(v)) {
+        if (AS_OBJECT(v)->type == OBJECT_FUNCTION) {
+            struct object_function* f = as_function(AS_OBJECT(v));
             if (arity != f->arity) {
                 runtime_error(vm, "Got '%d' arguments, expected '%d'",
                                 arity, f->arity);
                 return INTERPRET_ERROR;
             }
-            push_frame(vm, f);
-        } else if (v.object->type == OBJECT_NATIVE) {
-            struct object_native* nat = as_native(v.object);
+            // The arguments become the first locals
+            return push_frame(vm, f, vm->op_stack + vm->stack_len - arity);
+        } else if (AS_OBJECT(v)->type == OBJECT_NATIVE) {
+            struct object_native* nat = as_native(AS_OBJECT(v));
             DUMP_STACK(vm);
             struct value* args_offset = vm->op_stack + vm->stack_len - arity;
-            struct value res = nat->function(arity, args_offset);
+            struct value res = nat->function(vm, arity, args_offset);
             vm->stack_len -= arity;
             push(vm, res);
         }
@@ -262,356 +440,1023 @@ static enum interpret_result interpret_fun_call(vm_t* vm) {
     return INTERPRET_CONTINUE;
 }
 
-static enum interpret_result interpret_ins(vm_t* vm, u8 ins) {
-    switch (ins) {
-    case OP_RETURN: {
+/// Calls the function stored in register 'base' with the arguments in
+/// the registers right after it. The result of a native function is
+/// stored to 'base' immediately, bytecode function stores it there
+/// when it returns.
+static enum interpret_result interpret_register_call(vm_t* vm, struct value* base, u8 arg_cnt) {
+    if (IS_OBJECT(*base)) {
+        struct object* obj = AS_OBJECT(*base);
+        if (obj->type == OBJECT_FUNCTION) {
+            struct object_function* f = as_function(obj);
+            if (arg_cnt != f->arity) {
+                runtime_error(vm, "Got '%d' arguments, expected '%d'",
+                                arg_cnt, f->arity);
+                return INTERPRET_ERROR;
+            }
+            return push_frame(vm, f, base + 1);
+        } else if (obj->type == OBJECT_NATIVE) {
+            // Natives take the arguments in the operand stack order,
+            // that is from the last one.
+            struct value args[UINT8_MAX];
+            for (u8 i = 0; i < arg_cnt; ++i) {
+                args[i] = base[arg_cnt - i];
+            }
+            *base = as_native(obj)->function(vm, arg_cnt, args);
+            return INTERPRET_CONTINUE;
+        }
+    }
+    runtime_error(vm, "Only functions can be called");
+    return INTERPRET_ERROR;
+}
+
+/// Returns method of the instance called by the instruction with cache
+/// 'cache' or NULL if the class doesn't have it.
+static inline struct object_function* find_method(vm_t* vm, struct method_cache* cache,
+                                                  struct object_instance* instance) {
+    struct object_class* klass = instance->klass;
+    for (u8 i = 0; i < cache->len; ++i) {
+        if (cache->ways[i].klass == klass) {
+            vm->stats.mc_hits += 1;
+            return cache->ways[i].method;
+        }
+    }
+    vm->stats.mc_misses += 1;
+    struct object_function* f = class_find_method(klass, cache->name);
+    if (f == NULL) {
+        return NULL;
+    }
+    u8 i = cache->len;
+    if (i == INLINE_CACHE_WAYS) {
+        // Megamorphic, the last way keeps changing
+        i -= 1;
+    } else {
+        cache->len += 1;
+    }
+    cache->ways[i].klass = klass;
+    cache->ways[i].method = f;
+    return f;
+}
+
+/// Returns the instance whose members are accessed, or reports an error
+/// and returns NULL if 'receiver' is not an instance.
+static struct object_instance* member_receiver(vm_t* vm, struct value receiver) {
+    struct object_instance* instance = NULL;
+    if (IS_OBJECT(receiver)) {
+        instance = as_instance_s(AS_OBJECT(receiver));
+    }
+    if (instance == NULL) {
+        runtime_error(vm, "Can't access members of given type");
+    }
+    return instance;
+}
+
+/// Calls method of 'self', which is also the first argument of the method.
+/// The callee's locals start at 'slots'.
+static enum interpret_result interpret_dispatch(vm_t* vm, struct value self, struct value* slots,
+                                                struct method_cache* cache, u8 arg_cnt) {
+    // TODO: Implement instance dispatching for other types
+    if (!IS_OBJECT(self) || AS_OBJECT(self)->type != OBJECT_INSTANCE) {
+        runtime_error(vm, "Can't dispatch methods on given type.\n");
+        return INTERPRET_ERROR;
+    }
+    struct object_function* f = find_method(vm, cache, as_instance(AS_OBJECT(self)));
+    if (f == NULL) {
+        runtime_error(vm, "The object doesn't have method '%s'",
+                      as_string(cache->name)->data);
+        return INTERPRET_ERROR;
+    }
+    if (arg_cnt != f->arity) {
+        runtime_error(vm, "Number of arguments: %d, expected %d\n",
+                      arg_cnt, f->arity);
+        return INTERPRET_ERROR;
+    }
+    return push_frame(vm, f, slots);
+}
+
+/// Returns the way of the cache that matches the shape of the instance
+/// or INLINE_CACHE_WAYS on a miss.
+static inline u8 inline_cache_probe(vm_t* vm, struct inline_cache* cache,
+                                    struct object_instance* instance) {
+    for (u8 i = 0; i < cache->len; ++i) {
+        if (cache->ways[i].shape == instance->shape) {
+            if (cache->len == 1) {
+                vm->stats.ic_hits_mono += 1;
+            } else {
+                vm->stats.ic_hits_poly += 1;
+            }
+            return i;
+        }
+    }
+    vm->stats.ic_misses += 1;
+    return INLINE_CACHE_WAYS;
+}
+
+/// Remembers the slot of the member for the shape, 'transition' is the
+/// shape after the member is added or NULL.
+static void inline_cache_update(struct inline_cache* cache, struct shape* shape,
+                                struct shape* transition, u32 slot) {
+    u8 i = cache->len;
+    if (i == INLINE_CACHE_WAYS) {
+        // Megamorphic, the last way keeps changing
+        i -= 1;
+    } else {
+        cache->len += 1;
+    }
+    cache->ways[i].shape = shape;
+    cache->ways[i].transition = transition;
+    cache->ways[i].slot = slot;
+}
+
+/// Returns slot of the member in the instance or NULL if it does not exist.
+static inline struct value* get_member(vm_t* vm, struct inline_cache* cache,
+                                       struct object_instance* instance) {
+    u8 way = inline_cache_probe(vm, cache, instance);
+    if (way != INLINE_CACHE_WAYS) {
+        return &instance->slots[cache->ways[way].slot];
+    }
+    int slot = shape_find(instance->shape, cache->name);
+    if (slot < 0) {
+        return NULL;
+    }
+    inline_cache_update(cache, instance->shape, NULL, slot);
+    return &instance->slots[slot];
+}
+
+static inline void set_member(vm_t* vm, struct inline_cache* cache,
+                              struct object_instance* instance, struct value v) {
+    gc_write_barrier(&vm->gc, &instance->object, v);
+    u8 way = inline_cache_probe(vm, cache, instance);
+    if (way != INLINE_CACHE_WAYS) {
+        if (cache->ways[way].transition == NULL) {
+            instance->slots[cache->ways[way].slot] = v;
+        } else {
+            instance_transition(instance, cache->ways[way].transition, v);
+        }
+        return;
+    }
+    struct shape* shape = instance->shape;
+    int slot = shape_find(shape, cache->name);
+    if (slot >= 0) {
+        instance->slots[slot] = v;
+        inline_cache_update(cache, shape, NULL, slot);
+        return;
+    }
+    struct shape* to = shape_add(shape, cache->name);
+    instance_transition(instance, to, v);
+    inline_cache_update(cache, shape, to, to->count - 1);
+}
+
+/// Returns new list with 'cnt' items copied from 'values'.
+static struct object_list* make_list(vm_t* vm, struct value* values, u32 cnt) {
+    struct object_list* list = new_list(vm, cnt);
+    for (u32 i = 0; i < cnt; ++i) {
+        gc_write_barrier(&vm->gc, &list->object, values[i]);
+        list->items[i] = values[i];
+    }
+    list->len = cnt;
+    return list;
+}
+
+/// Returns the list in 'v' or reports runtime error and returns NULL.
+static inline struct object_list* to_list(vm_t* vm, struct value v) {
+    if (!IS_OBJECT(v) || AS_OBJECT(v)->type != OBJECT_LIST) {
+        runtime_error(vm, "Expected a list");
+        return NULL;
+    }
+    return as_list(AS_OBJECT(v));
+}
+
+/// Stores 'idx' to 'i' if it is an index into 'len' items of a list or an
+/// array ('what'), otherwise reports runtime error and returns false.
+static inline bool check_index(vm_t* vm, const char* what, struct value idx, u32 len, u32* i) {
+    if (!IS_INT(idx)) {
+        runtime_error(vm, "%s index must be an integer", what);
+        return false;
+    }
+    // Negative indexes wrap around to huge ones
+    *i = (u32)AS_CINT(idx);
+    if (*i >= len) {
+        runtime_error(vm, "%s index %d is out of range, the length is %u",
+                      what, AS_CINT(idx), len);
+        return false;
+    }
+    return true;
+}
+
+static inline bool is_array(struct value v) {
+    return IS_OBJECT(v) && AS_OBJECT(v)->type == OBJECT_ARRAY;
+}
+
+/// Stores 'v' at index 'idx' of the array. Ints are converted to doubles
+/// for double arrays, int arrays take only ints.
+static inline bool array_set(vm_t* vm, struct object_array* array, struct value idx, struct value v) {
+    u32 i;
+    if (!check_index(vm, "Array", idx, array->len, &i)) {
+        return false;
+    }
+    if (array->kind == ARRAY_INT) {
+        if (!IS_INT(v)) {
+            runtime_error(vm, "Int array can only hold ints");
+            return false;
+        }
+        array->ints[i] = AS_CINT(v);
+    } else if (IS_DOUBLE(v)) {
+        array->doubles[i] = AS_DOUBLE(v);
+    } else if (IS_INT(v)) {
+        array->doubles[i] = AS_CINT(v);
+    } else {
+        runtime_error(vm, "Double array can only hold numbers");
+        return false;
+    }
+    return true;
+}
+
+/// Stores 'v' at index 'idx' of the list or array in 'l'.
+static inline bool list_set(vm_t* vm, struct value l, struct value idx, struct value v) {
+    if (is_array(l)) {
+        return array_set(vm, as_array(AS_OBJECT(l)), idx, v);
+    }
+    struct object_list* list = to_list(vm, l);
+    u32 i;
+    if (list == NULL || !check_index(vm, "List", idx, list->len, &i)) {
+        return false;
+    }
+    gc_write_barrier(&vm->gc, &list->object, v);
+    list->items[i] = v;
+    return true;
+}
+
+/// Stores the item at index 'idx' of the list or array in 'l' into 'res'.
+static inline bool list_get(vm_t* vm, struct value l, struct value idx, struct value* res) {
+    u32 i;
+    if (is_array(l)) {
+        struct object_array* array = as_array(AS_OBJECT(l));
+        if (!check_index(vm, "Array", idx, array->len, &i)) {
+            return false;
+        }
+        *res = array_get(array, i);
+        return true;
+    }
+    struct object_list* list = to_list(vm, l);
+    if (list == NULL || !check_index(vm, "List", idx, list->len, &i)) {
+        return false;
+    }
+    *res = list->items[i];
+    return true;
+}
+
+/// Stores the length of the list, array or string 'v' into 'res'.
+static inline bool list_len(vm_t* vm, struct value v, struct value* res) {
+    if (IS_OBJECT(v) && AS_OBJECT(v)->type == OBJECT_STRING) {
+        *res = NEW_INT((int)as_string(AS_OBJECT(v))->size);
+        return true;
+    }
+    if (is_array(v)) {
+        *res = NEW_INT(as_array(AS_OBJECT(v))->len);
+        return true;
+    }
+    struct object_list* list = to_list(vm, v);
+    if (list == NULL) {
+        return false;
+    }
+    *res = NEW_INT(list->len);
+    return true;
+}
+
+/// Appends 'v' to the list in 'l'.
+static inline bool list_push(vm_t* vm, struct value l, struct value v) {
+    struct object_list* list = to_list(vm, l);
+    if (list == NULL) {
+        return false;
+    }
+    gc_write_barrier(&vm->gc, &list->object, v);
+    list_append(list, v);
+    return true;
+}
+
+/*
+ * The interpreter loop can be compiled in two flavours. If
+ * __THREADED_DISPATCH__ is defined (GCC and Clang only) every
+ * instruction handler jumps directly to the handler of the next
+ * instruction through a table of label addresses (computed goto).
+ * This gives each handler its own indirect branch, which the CPU
+ * predicts much better than the single shared branch of a switch.
+ * Otherwise a plain portable switch is used.
+ *
+ * Handlers are written with the CASE/DISPATCH macros so that
+ * both flavours share the same code.
+ *
+ * The same loop executes both the stack and the register (OP_R_*)
+ * instructions, a chunk contains only one kind of them (see decode_chunk).
+ * Register instructions address the locals of the current frame
+ * directly, the 'regs' variable caches them and has to be reloaded
+ * (LOAD_REGS) whenever the top frame changes.
+ */
+#ifdef __THREADED_DISPATCH__
+    #define CASE(OP) L_##OP
+    #define DEFAULT() L_DEFAULT
+    #define DISPATCH() do { DUMP_STACK(vm); DUMP_INS(vm); \
+                            ins = vm->ip++; \
+                            goto *dispatch_table[ins->op]; } while (false)
+#else
+    #define CASE(OP) case OP
+    #define DEFAULT() default
+    #define DISPATCH() continue
+#endif
+
+#if defined(__THREADED_DISPATCH__) && defined(__GNUC__)
+// Labels as values and computed goto are GNU extensions. The dispatch
+// table fills all opcodes with the default handler before the real ones.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Woverride-init"
+#endif
+
+#define LOAD_REGS() (regs = TOP_FRAME().slots)
+/// Calls and jumps are the safe points of the compacting GC, the objects
+/// the handler worked with are in the roots already.
+#define SAFEPOINT() do { if (vm->gc.compact_pending) gc_compact(vm); } while (false)
+
+static int run(vm_t* vm) {
+    struct instruction* ins;
+    struct value* regs;
+    LOAD_REGS();
+#ifdef __THREADED_DISPATCH__
+    static void* dispatch_table[256] = {
+        [0 ... 255] = &&L_DEFAULT,
+        [OP_RETURN] = &&L_OP_RETURN,
+        [OP_PRINT] = &&L_OP_PRINT,
+        [OP_PUSH_INT] = &&L_OP_PUSH_INT,
+        [OP_PUSH_LITERAL] = &&L_OP_PUSH_LITERAL,
+        [OP_PUSH_NONE] = &&L_OP_PUSH_NONE,
+        [OP_PUSH_BOOL] = &&L_OP_PUSH_BOOL,
+        [OP_IADD] = &&L_OP_IADD,
+        [OP_ISUB] = &&L_OP_ISUB,
+        [OP_IMUL] = &&L_OP_IMUL,
+        [OP_IDIV] = &&L_OP_IDIV,
+        [OP_IMOD] = &&L_OP_IMOD,
+        [OP_ILESS] = &&L_OP_ILESS,
+        [OP_ILESSEQ] = &&L_OP_ILESSEQ,
+        [OP_IGREATER] = &&L_OP_IGREATER,
+        [OP_IGREATEREQ] = &&L_OP_IGREATEREQ,
+        [OP_EQ] = &&L_OP_EQ,
+        [OP_NEQ] = &&L_OP_NEQ,
+        [OP_INEG] = &&L_OP_INEG,
+        [OP_DROP] = &&L_OP_DROP,
+        [OP_DROPN] = &&L_OP_DROPN,
+        [OP_JMP] = &&L_OP_JMP,
+        [OP_BRANCH] = &&L_OP_BRANCH,
+        [OP_BRANCH_FALSE] = &&L_OP_BRANCH_FALSE,
+        [OP_VAL_GLOBAL] = &&L_OP_VAL_GLOBAL,
+        [OP_VAR_GLOBAL] = &&L_OP_VAR_GLOBAL,
+        [OP_GET_GLOBAL] = &&L_OP_GET_GLOBAL,
+        [OP_SET_GLOBAL] = &&L_OP_SET_GLOBAL,
+        [OP_GET_LOCAL] = &&L_OP_GET_LOCAL,
+        [OP_SET_LOCAL] = &&L_OP_SET_LOCAL,
+        [OP_CALL_FUNC] = &&L_OP_CALL_FUNC,
+        [OP_NEW_OBJECT] = &&L_OP_NEW_OBJECT,
+        [OP_GET_MEMBER] = &&L_OP_GET_MEMBER,
+        [OP_SET_MEMBER] = &&L_OP_SET_MEMBER,
+        [OP_DUP] = &&L_OP_DUP,
+        [OP_DISPATCH_METHOD] = &&L_OP_DISPATCH_METHOD,
+        [OP_NEW_LIST] = &&L_OP_NEW_LIST,
+        [OP_GET_INDEX] = &&L_OP_GET_INDEX,
+        [OP_SET_INDEX] = &&L_OP_SET_INDEX,
+        [OP_LIST_LEN] = &&L_OP_LIST_LEN,
+        [OP_LIST_APPEND] = &&L_OP_LIST_APPEND,
+        [OP_R_MOVE] = &&L_OP_R_MOVE,
+        [OP_R_LOAD_INT] = &&L_OP_R_LOAD_INT,
+        [OP_R_LOAD_BOOL] = &&L_OP_R_LOAD_BOOL,
+        [OP_R_LOAD_NONE] = &&L_OP_R_LOAD_NONE,
+        [OP_R_LOAD_LITERAL] = &&L_OP_R_LOAD_LITERAL,
+        [OP_R_GET_GLOBAL] = &&L_OP_R_GET_GLOBAL,
+        [OP_R_SET_GLOBAL] = &&L_OP_R_SET_GLOBAL,
+        [OP_R_VAL_GLOBAL] = &&L_OP_R_VAL_GLOBAL,
+        [OP_R_VAR_GLOBAL] = &&L_OP_R_VAR_GLOBAL,
+        [OP_R_BRANCH_FALSE] = &&L_OP_R_BRANCH_FALSE,
+        [OP_R_IADD] = &&L_OP_R_IADD,
+        [OP_R_ISUB] = &&L_OP_R_ISUB,
+        [OP_R_IMUL] = &&L_OP_R_IMUL,
+        [OP_R_IDIV] = &&L_OP_R_IDIV,
+        [OP_R_IMOD] = &&L_OP_R_IMOD,
+        [OP_R_ILESS] = &&L_OP_R_ILESS,
+        [OP_R_ILESSEQ] = &&L_OP_R_ILESSEQ,
+        [OP_R_IGREATER] = &&L_OP_R_IGREATER,
+        [OP_R_IGREATEREQ] = &&L_OP_R_IGREATEREQ,
+        [OP_R_EQ] = &&L_OP_R_EQ,
+        [OP_R_NEQ] = &&L_OP_R_NEQ,
+        [OP_R_INEG] = &&L_OP_R_INEG,
+        [OP_R_CALL_FUNC] = &&L_OP_R_CALL_FUNC,
+        [OP_R_DISPATCH_METHOD] = &&L_OP_R_DISPATCH_METHOD,
+        [OP_R_PRINT] = &&L_OP_R_PRINT,
+        [OP_R_RETURN] = &&L_OP_R_RETURN,
+        [OP_R_NEW_OBJECT] = &&L_OP_R_NEW_OBJECT,
+        [OP_R_GET_MEMBER] = &&L_OP_R_GET_MEMBER,
+        [OP_R_SET_MEMBER] = &&L_OP_R_SET_MEMBER,
+        [OP_R_NEW_LIST] = &&L_OP_R_NEW_LIST,
+        [OP_R_GET_INDEX] = &&L_OP_R_GET_INDEX,
+        [OP_R_SET_INDEX] = &&L_OP_R_SET_INDEX,
+        [OP_R_LIST_LEN] = &&L_OP_R_LIST_LEN,
+        [OP_R_LIST_APPEND] = &&L_OP_R_LIST_APPEND,
+    };
+    DISPATCH();
+#else
+    for (;;) {
+    DUMP_STACK(vm);
+    DUMP_INS(vm);
+    ins = vm->ip++;
+    switch (ins->op) {
+#endif
+    CASE(OP_RETURN): {
         if (vm->frame_len > 1) {
+            // Drop locals of the function, the result replaces them
+            struct value res = pop(vm);
+            vm->stack_len = TOP_FRAME().slots - vm->op_stack;
             pop_frame(vm);
+            push(vm, res);
         // Only the last global frame is remaining - Terminating return
         } else {
-            return INTERPRET_RETURN;
+            return 0;
         }
-        break;
-    }
-    case OP_PRINT:
-        return interpret_print(vm);
-    case OP_PUSH_SHORT: {
-        i16 val = READ_2B_IP(vm);
-        push(vm, NEW_INT(val));
-        break;
+        DISPATCH();
     }
-    case OP_PUSH_INT: {
-        i32 val = READ_4B_IP(vm);
+    CASE(OP_PRINT):
+        if (interpret_print(vm, ins->arg) == INTERPRET_ERROR) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_PUSH_INT): {
+        i32 val = ins->arg;
         push(vm, NEW_INT(val));
-        break;
+        DISPATCH();
     }
-    case OP_PUSH_LITERAL: {
-        u32 cp_idx = READ_4B_IP(vm);
-        struct value vobj = NEW_OBJECT(vm->const_pool.data[cp_idx]);
+    CASE(OP_PUSH_LITERAL): {
+        struct value vobj = NEW_OBJECT(ins->object);
         push(vm, vobj);
-        break;
+        DISPATCH();
     }
-    case OP_PUSH_NONE: {
+    CASE(OP_PUSH_NONE): {
         struct value none = NEW_NONE();
         push(vm, none);
-        break;
+        DISPATCH();
     }
-    case OP_PUSH_BOOL: {
-        struct value boolean = NEW_BOOL(READ_1B_IP(vm));
+    CASE(OP_PUSH_BOOL): {
+        struct value boolean = NEW_BOOL(ins->arg);
         push(vm, boolean);
-        break;
+        DISPATCH();
     }
-    case OP_IADD: {
-        struct value v1 = pop(vm);
-        struct value v2 = pop(vm);
-        if (v1.type == VAL_INT && v2.type == VAL_INT) {
-            push(vm, NEW_INT(v1.integer + v2.integer));
-        } else if (v1.type == VAL_DOUBLE && v2.type == VAL_DOUBLE) {
-            push(vm, NEW_DOUBLE(v1.double_num + v2.double_num));
-        } else if (v1.type == VAL_OBJECT && v2.type == VAL_OBJECT
-                && v1.object->type == OBJECT_STRING
-                && v2.object->type == OBJECT_STRING) {
-            push(vm, interpret_string_concat(vm, v1.object, v2.object));
-        } else {
-            runtime_error(vm, "Incopatible types for operator '+'");
-            return INTERPRET_ERROR;
+    CASE(OP_IADD): {
+        // The operands stay on the stack until the result is created,
+        // concatenation of strings allocates and they must stay reachable.
+        struct value res;
+        if (!arith_add(vm, peek(vm, 1), peek(vm, 2), &res)) {
+            goto error;
         }
-        break;
+        vm->stack_len -= 2;
+        push(vm, res);
+        DISPATCH();
     }
-    case OP_ISUB: {
+    CASE(OP_ISUB): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
-        if (v1.type == VAL_INT && v2.type == VAL_INT) {
-            push(vm, NEW_INT(v1.integer - v2.integer));
-        } else if (v1.type == VAL_DOUBLE && v2.type == VAL_DOUBLE) {
-            push(vm, NEW_DOUBLE(v1.double_num - v2.double_num));
-        } else {
-            runtime_error(vm, "Incopatible types for operator '-'");
-            return INTERPRET_ERROR;
+        struct value res;
+        if (!arith_sub(vm, v1, v2, &res)) {
+            goto error;
         }
-        break;
+        push(vm, res);
+        DISPATCH();
     }
-    case OP_IMUL: {
+    CASE(OP_IMUL): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
-        if (v1.type == VAL_INT && v2.type == VAL_INT) {
-            push(vm, NEW_INT(v1.integer * v2.integer));
-        } else if (v1.type == VAL_DOUBLE && v2.type == VAL_DOUBLE) {
-            push(vm, NEW_DOUBLE(v1.double_num * v2.double_num));
-        // TODO: List and string multiplication
-        } else {
-            runtime_error(vm, "Incopatible types for operator '*'");
-            return INTERPRET_ERROR;
+        struct value res;
+        if (!arith_mul(vm, v1, v2, &res)) {
+            goto error;
         }
-        break;
+        push(vm, res);
+        DISPATCH();
     }
-    case OP_IDIV: {
+    CASE(OP_IDIV): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
-        if (v1.type == VAL_INT && v2.type == VAL_INT) {
-            if (v2.integer == 0) {
-                runtime_error(vm, "Division by zero error");
-                return INTERPRET_ERROR;
-            }
-            push(vm, NEW_INT(v1.integer / v2.integer));
-        } else if (v1.type == VAL_DOUBLE && v2.type == VAL_DOUBLE) {
-            push(vm, NEW_DOUBLE(v1.double_num / v2.double_num));
-        } else {
-            runtime_error(vm, "Incopatible types for operator '/'");
-            return INTERPRET_ERROR;
+        struct value res;
+        if (!arith_div(vm, v1, v2, &res)) {
+            goto error;
         }
-        break;
+        push(vm, res);
+        DISPATCH();
     }
-    case OP_IMOD: {
+    CASE(OP_IMOD): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
-        if (v1.type == VAL_INT && v2.type == VAL_INT) {
-            if (v2.integer == 0) {
-                runtime_error(vm, "Division by zero error");
-                return INTERPRET_ERROR;
-            }
-            push(vm, NEW_INT(v1.integer % v2.integer));
-        } else {
-            runtime_error(vm, "Incopatible types for operator '\%'");
-            return INTERPRET_ERROR;
+        struct value res;
+        if (!arith_mod(vm, v1, v2, &res)) {
+            goto error;
         }
-        break;
-
+        push(vm, res);
+        DISPATCH();
     }
-    case OP_ILESS: {
+    CASE(OP_ILESS): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
         bool res = value_less(v1, v2);
         push(vm, NEW_BOOL(res));
-        break;
+        DISPATCH();
     }
-    case OP_ILESSEQ: {
+    CASE(OP_ILESSEQ): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
         bool res = value_lesseq(v1, v2);
         push(vm, NEW_BOOL(res));
-        break;
+        DISPATCH();
     }
-    case OP_IGREATER: {
+    CASE(OP_IGREATER): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
         bool res = value_greater(v1, v2);
         push(vm, NEW_BOOL(res));
-        break;
+        DISPATCH();
     }
-    case OP_IGREATEREQ: {
+    CASE(OP_IGREATEREQ): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
         bool res = value_greatereq(v1, v2);
         push(vm, NEW_BOOL(res));
-        break;
+        DISPATCH();
     }
-    case OP_EQ: {
+    CASE(OP_EQ): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
         bool res = value_eq(v1, v2);
         push(vm, NEW_BOOL(res));
-        break;
+        DISPATCH();
     }
-    case OP_NEQ: {
+    CASE(OP_NEQ): {
         struct value v1 = pop(vm);
         struct value v2 = pop(vm);
         bool res = !value_eq(v1, v2);
         push(vm, NEW_BOOL(res));
-        break;
+        DISPATCH();
     }
-    case OP_INEG: {
+    CASE(OP_INEG): {
         struct value v = pop(vm);
-        if (v.type == VAL_INT) {
-            push(vm, NEW_INT(-v.integer));
-        } else if (v.type == VAL_DOUBLE) {
-            push(vm, NEW_DOUBLE(-v.integer));
-        } else {
-            runtime_error(vm, "Incopatible type for operator unary '-'");
-            return INTERPRET_ERROR;
+        struct value res;
+        if (!arith_neg(vm, v, &res)) {
+            goto error;
         }
-        break;
+        push(vm, res);
+        DISPATCH();
     }
-    case OP_DROP:
+    CASE(OP_DROP):
         pop(vm);
-        break;
-    case OP_DROPN:
-        vm->stack_len -= READ_1B_IP(vm);
-        break;
-    case OP_JMP:
-        vm->ip = &CURRENT_FUNCTION()->bc.data[READ_4BYTES_BE(vm->ip)];
-        break;
-    case OP_BRANCH_FALSE:
-    case OP_BRANCH: {
+        DISPATCH();
+    CASE(OP_DROPN):
+        vm->stack_len -= ins->arg;
+        DISPATCH();
+    CASE(OP_JMP):
+        vm->ip = ins->target;
+        SAFEPOINT();
+        DISPATCH();
+    CASE(OP_BRANCH_FALSE):
+    CASE(OP_BRANCH): {
         struct value val = pop(vm);
-        if (val.type != VAL_BOOL) {
+        if (!IS_BOOL(val)) {
             runtime_error(vm, "Expected type 'bool' in if condition");
-            return INTERPRET_ERROR;
+            goto error;
         }
-        if ((ins == OP_BRANCH && val.boolean) || (ins == OP_BRANCH_FALSE && !val.boolean)) {
-            u32 dest = READ_4BYTES_BE(vm->ip);
-            vm->ip = &CURRENT_FUNCTION()->bc.data[dest];
-        } else {
-            vm->ip += 4;
+        if ((ins->op == OP_BRANCH && AS_BOOL(val)) || (ins->op == OP_BRANCH_FALSE && !AS_BOOL(val))) {
+            vm->ip = ins->target;
         }
-        break;
+        DISPATCH();
     }
-    case OP_VAL_GLOBAL:
-    case OP_VAR_GLOBAL: {
-        struct value val = pop(vm);
-        u32 name_idx = READ_4B_IP(vm);
-        struct object_string* name = read_string_cp(&vm->const_pool, name_idx);
-        struct value name_obj = NEW_OBJECT(name);
-        bool new_v = table_set(&vm->globals, name_obj, val);
-        if (!new_v) {
-            runtime_error(vm, "Error: Variable '%s' is already defined", name->data);
-            return INTERPRET_ERROR;
-        }
-        break;
-    }
-    case OP_GET_GLOBAL: {
-        u32 name_idx = READ_4B_IP(vm);
-        struct object_string* name = read_string_cp(&vm->const_pool, name_idx);
-        struct value name_obj = NEW_OBJECT(name);
-        struct value val;
-        if (!table_get(&vm->globals, name_obj, &val)) {
-            runtime_error(vm, "Error: Access to undefined variable '%s'.", name->data);
-            return INTERPRET_ERROR;
-        }
-        push(vm, val);
-        break;
-    }
-    case OP_SET_GLOBAL: {
-        u32 name_idx = READ_4B_IP(vm);
-        struct object_string* name = read_string_cp(&vm->const_pool, name_idx);
-        struct value name_obj = NEW_OBJECT(name);
-        struct value v = pop(vm);
-        if (table_set(&vm->globals, name_obj, v)) {
-            runtime_error(vm, "Global variable '%s' is not defined!", name->data);
-            return INTERPRET_ERROR;
+    CASE(OP_VAL_GLOBAL):
+    CASE(OP_VAR_GLOBAL): {
+        struct global_slot* g = &vm->globals.slots[ins->arg];
+        if (g->defined) {
+            runtime_error(vm, "Error: Variable '%s' is already defined",
+                          as_string(ins->object)->data);
+            goto error;
         }
-        break;
+        g->value = pop(vm);
+        g->defined = true;
+        DISPATCH();
     }
-    case OP_GET_LOCAL: {
-        u16 slot_idx = READ_2B_IP(vm);
-        struct value v = TOP_FRAME().slots[slot_idx];
+    CASE(OP_GET_GLOBAL): {
+        struct global_slot* g = &vm->globals.slots[ins->arg];
+        if (!g->defined) {
+            runtime_error(vm, "Error: Access to undefined variable '%s'.",
+                          as_string(ins->object)->data);
+            goto error;
+        }
+        push(vm, g->value);
+        DISPATCH();
+    }
+    CASE(OP_SET_GLOBAL): {
+        struct global_slot* g = &vm->globals.slots[ins->arg];
+        if (!g->defined) {
+            runtime_error(vm, "Global variable '%s' is not defined!",
+                          as_string(ins->object)->data);
+            goto error;
+        }
+        g->value = pop(vm);
+        DISPATCH();
+    }
+    CASE(OP_GET_LOCAL): {
+        struct value v = TOP_FRAME().slots[ins->arg];
         push(vm, v);
-        break;
+        DISPATCH();
     }
-    case OP_SET_LOCAL: {
-        u16 frame_idx = READ_2B_IP(vm);
+    CASE(OP_SET_LOCAL): {
         struct value v = pop(vm);
-        TOP_FRAME().slots[frame_idx] = v;
-        break;
+        TOP_FRAME().slots[ins->arg] = v;
+        DISPATCH();
     }
-    case OP_CALL_FUNC: {
-        return interpret_fun_call(vm);
-        break;
+    CASE(OP_CALL_FUNC): {
+        if (interpret_fun_call(vm, ins->arg) == INTERPRET_ERROR) {
+            goto error;
+        }
+        SAFEPOINT();
+        DISPATCH();
     }
-    case OP_NEW_OBJECT: {
-        u32 idx = READ_4B_IP(vm);
-        struct object_instance* ins = new_instance(vm,  as_class(vm->const_pool.data[idx]));
-        struct value ins_v = NEW_OBJECT(ins);
+    CASE(OP_NEW_OBJECT): {
+        struct object_instance* instance = new_instance(vm, as_class(ins->object));
+        struct value ins_v = NEW_OBJECT(instance);
         push(vm, ins_v);
-        break;
-    }
-    case OP_SET_MEMBER:
-    case OP_GET_MEMBER: {
-        u32 name = READ_4B_IP(vm);
-        struct object_instance* instance = as_instance(pop(vm).object);
-        struct object_string* key = as_string(vm->const_pool.data[name]);
-        struct value key_v = NEW_OBJECT(key);
-        struct value val;
-
-        if (ins == OP_GET_MEMBER) {
-            bool exists = table_get(&instance->members, key_v, &val);
-            if (!exists) {
-                runtime_error(vm, "The object doesn't have member '%s'", key->data);
-            }
-            push(vm, val);
-        } else { // OP_SET_MEMBER
-            struct value v = pop(vm);
-            table_set(&instance->members, key_v, v);
+        DISPATCH();
+    }
+    CASE(OP_GET_MEMBER): {
+        struct object_instance* instance = member_receiver(vm, pop(vm));
+        if (instance == NULL) {
+            goto error;
         }
-
-        break;
+        struct value* member = get_member(vm, ins->cache, instance);
+        if (member == NULL) {
+            runtime_error(vm, "The object doesn't have member '%s'",
+                          as_string(ins->cache->name)->data);
+            goto error;
+        }
+        push(vm, *member);
+        DISPATCH();
     }
-    case OP_DUP: {
+    CASE(OP_SET_MEMBER): {
+        struct object_instance* instance = member_receiver(vm, pop(vm));
+        if (instance == NULL) {
+            goto error;
+        }
+        struct value v = pop(vm);
+        set_member(vm, ins->cache, instance, v);
+        DISPATCH();
+    }
+    CASE(OP_DUP): {
         struct value v = peek(vm, 1);
         push(vm, v);
-        break;
-    }
-    case OP_DISPATCH_METHOD: {
-        u32 name = READ_4B_IP(vm);
-        u8 arity = READ_1B_IP(vm);
-        // TODO: Implement instance dispatching for other types
-        // TODO: Properly check for wrong types
-        // Leave the object on the stack because it is
-        // also an argument for the method
-        struct value target = peek(vm, 1);
-        if (target.type == VAL_OBJECT) {
-            struct object* obj = target.object;
-            if (obj->type == OBJECT_INSTANCE) {
-                struct object_instance* instance = as_instance(obj);
-                struct value method_idx;
-                table_get(&instance->klass->methods, 
-                          NEW_OBJECT(vm->const_pool.data[name]), &method_idx);
-                assert(method_idx.type == VAL_INT);
-                u32 idx = AS_CINT(method_idx);
-                struct object_function* f = as_function(vm->const_pool.data[idx]);
-                if (arity != f->arity) {
-                    runtime_error(vm, "Number of arguments: %d, expected %d\n", 
-                                  arity, f->arity);
-                    return INTERPRET_ERROR;
-                }
-                push_frame(vm, f);
-            }
-        } else {
-            runtime_error(vm, "Can't dispatch methods on given type.\n");
-            return INTERPRET_ERROR;
+        DISPATCH();
+    }
+    CASE(OP_DISPATCH_METHOD): {
+        u8 arity = ins->arg;
+        // The object stays on the stack because it is
+        // also the first argument of the method
+        struct value* slots = vm->op_stack + vm->stack_len - arity;
+        if (interpret_dispatch(vm, peek(vm, 1), slots, ins->method, arity)
+                == INTERPRET_ERROR) {
+            goto error;
         }
-        break;
+        SAFEPOINT();
+        DISPATCH();
     }
-    default:
-        runtime_error(vm, "Unknown instruction 0x%x! Skipping...", ins);
+    CASE(OP_NEW_LIST): {
+        // The items stay on the stack until the list is allocated
+        struct value* items = vm->op_stack + vm->stack_len - ins->arg;
+        struct object_list* list = make_list(vm, items, ins->arg);
+        vm->stack_len -= ins->arg;
+        push(vm, NEW_OBJECT(list));
+        DISPATCH();
     }
-    // Some branches return when successfull (like print),
-    // be careful if you add code here.
-    return INTERPRET_CONTINUE;
-}
-
-static int run(vm_t* vm) {
-    u8 ins;
-    while (true) {
-        DUMP_INS(vm->ip);
-        ins = READ_1B_IP(vm);
-        enum interpret_result res = interpret_ins(vm, ins);
-        DUMP_STACK(vm);
-        if (res == INTERPRET_ERROR) {
-            exit(-1);
-        } else if (res == INTERPRET_RETURN) {
+    CASE(OP_GET_INDEX): {
+        struct value idx = pop(vm);
+        struct value item;
+        if (!list_get(vm, pop(vm), idx, &item)) {
+            goto error;
+        }
+        push(vm, item);
+        DISPATCH();
+    }
+    CASE(OP_SET_INDEX): {
+        struct value idx = pop(vm);
+        struct value list = pop(vm);
+        if (!list_set(vm, list, idx, pop(vm))) {
+            goto error;
+        }
+        DISPATCH();
+    }
+    CASE(OP_LIST_LEN): {
+        struct value len;
+        if (!list_len(vm, pop(vm), &len)) {
+            goto error;
+        }
+        push(vm, len);
+        DISPATCH();
+    }
+    CASE(OP_LIST_APPEND): {
+        struct value v = pop(vm);
+        if (!list_push(vm, pop(vm), v)) {
+            goto error;
+        }
+        push(vm, NEW_NONE());
+        DISPATCH();
+    }
+    // ====== Register instructions ======
+    CASE(OP_R_MOVE):
+        regs[ins->reg] = regs[ins->lhs];
+        DISPATCH();
+    CASE(OP_R_LOAD_INT):
+        regs[ins->reg] = NEW_INT((i32)ins->arg);
+        DISPATCH();
+    CASE(OP_R_LOAD_BOOL):
+        regs[ins->reg] = NEW_BOOL(ins->arg);
+        DISPATCH();
+    CASE(OP_R_LOAD_NONE):
+        regs[ins->reg] = NEW_NONE();
+        DISPATCH();
+    CASE(OP_R_LOAD_LITERAL):
+        regs[ins->reg] = NEW_OBJECT(ins->object);
+        DISPATCH();
+    CASE(OP_R_VAL_GLOBAL):
+    CASE(OP_R_VAR_GLOBAL): {
+        struct global_slot* g = &vm->globals.slots[ins->arg];
+        if (g->defined) {
+            runtime_error(vm, "Error: Variable '%s' is already defined",
+                          as_string(ins->object)->data);
+            goto error;
+        }
+        g->value = regs[ins->reg];
+        g->defined = true;
+        DISPATCH();
+    }
+    CASE(OP_R_GET_GLOBAL): {
+        struct global_slot* g = &vm->globals.slots[ins->arg];
+        if (!g->defined) {
+            runtime_error(vm, "Error: Access to undefined variable '%s'.",
+                          as_string(ins->object)->data);
+            goto error;
+        }
+        regs[ins->reg] = g->value;
+        DISPATCH();
+    }
+    CASE(OP_R_SET_GLOBAL): {
+        struct global_slot* g = &vm->globals.slots[ins->arg];
+        if (!g->defined) {
+            runtime_error(vm, "Global variable '%s' is not defined!",
+                          as_string(ins->object)->data);
+            goto error;
+        }
+        g->value = regs[ins->reg];
+        DISPATCH();
+    }
+    CASE(OP_R_BRANCH_FALSE): {
+        struct value val = regs[ins->reg];
+        if (!IS_BOOL(val)) {
+            runtime_error(vm, "Expected type 'bool' in if condition");
+            goto error;
+        }
+        if (!AS_BOOL(val)) {
+            vm->ip = ins->target;
+        }
+        DISPATCH();
+    }
+    CASE(OP_R_IADD):
+        if (!arith_add(vm, regs[ins->lhs], regs[ins->rhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_ISUB):
+        if (!arith_sub(vm, regs[ins->lhs], regs[ins->rhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_IMUL):
+        if (!arith_mul(vm, regs[ins->lhs], regs[ins->rhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_IDIV):
+        if (!arith_div(vm, regs[ins->lhs], regs[ins->rhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_IMOD):
+        if (!arith_mod(vm, regs[ins->lhs], regs[ins->rhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_ILESS):
+        regs[ins->reg] = NEW_BOOL(value_less(regs[ins->lhs], regs[ins->rhs]));
+        DISPATCH();
+    CASE(OP_R_ILESSEQ):
+        regs[ins->reg] = NEW_BOOL(value_lesseq(regs[ins->lhs], regs[ins->rhs]));
+        DISPATCH();
+    CASE(OP_R_IGREATER):
+        regs[ins->reg] = NEW_BOOL(value_greater(regs[ins->lhs], regs[ins->rhs]));
+        DISPATCH();
+    CASE(OP_R_IGREATEREQ):
+        regs[ins->reg] = NEW_BOOL(value_greatereq(regs[ins->lhs], regs[ins->rhs]));
+        DISPATCH();
+    CASE(OP_R_EQ):
+        regs[ins->reg] = NEW_BOOL(value_eq(regs[ins->lhs], regs[ins->rhs]));
+        DISPATCH();
+    CASE(OP_R_NEQ):
+        regs[ins->reg] = NEW_BOOL(!value_eq(regs[ins->lhs], regs[ins->rhs]));
+        DISPATCH();
+    CASE(OP_R_INEG):
+        if (!arith_neg(vm, regs[ins->lhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_CALL_FUNC):
+        if (interpret_register_call(vm, &regs[ins->reg], ins->arg) == INTERPRET_ERROR) {
+            goto error;
+        }
+        LOAD_REGS();
+        SAFEPOINT();
+        DISPATCH();
+    CASE(OP_R_DISPATCH_METHOD):
+        if (interpret_dispatch(vm, regs[ins->reg], &regs[ins->reg], ins->method, ins->arg)
+                == INTERPRET_ERROR) {
+            goto error;
+        }
+        LOAD_REGS();
+        SAFEPOINT();
+        DISPATCH();
+    CASE(OP_R_PRINT):
+        if (print_values(vm, &regs[ins->reg], ins->arg) == INTERPRET_ERROR) {
+            goto error;
+        }
+        regs[ins->reg] = NEW_NONE();
+        DISPATCH();
+    CASE(OP_R_RETURN): {
+        // Only the last global frame is remaining - Terminating return
+        if (vm->frame_len == 1) {
             return 0;
         }
+        struct value res = regs[ins->reg];
+        pop_frame(vm);
+        LOAD_REGS();
+        vm->stack_len = regs - vm->op_stack + CURRENT_FUNCTION()->locals;
+        // The call instruction names the register for the result
+        regs[(vm->ip - 1)->reg] = res;
+        DISPATCH();
+    }
+    CASE(OP_R_NEW_OBJECT):
+        regs[ins->reg] = NEW_OBJECT(new_instance(vm, as_class(ins->object)));
+        DISPATCH();
+    CASE(OP_R_GET_MEMBER): {
+        struct object_instance* instance = member_receiver(vm, regs[ins->arg]);
+        if (instance == NULL) {
+            goto error;
+        }
+        struct value* member = get_member(vm, ins->cache, instance);
+        if (member == NULL) {
+            runtime_error(vm, "The object doesn't have member '%s'",
+                          as_string(ins->cache->name)->data);
+            goto error;
+        }
+        regs[ins->reg] = *member;
+        DISPATCH();
+    }
+    CASE(OP_R_SET_MEMBER): {
+        struct object_instance* instance = member_receiver(vm, regs[ins->reg]);
+        if (instance == NULL) {
+            goto error;
+        }
+        set_member(vm, ins->cache, instance, regs[ins->arg]);
+        DISPATCH();
+    }
+    CASE(OP_R_NEW_LIST):
+        regs[ins->reg] = NEW_OBJECT(make_list(vm, &regs[ins->lhs], ins->rhs));
+        DISPATCH();
+    CASE(OP_R_GET_INDEX):
+        if (!list_get(vm, regs[ins->lhs], regs[ins->rhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_SET_INDEX):
+        if (!list_set(vm, regs[ins->reg], regs[ins->lhs], regs[ins->rhs])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_LIST_LEN):
+        if (!list_len(vm, regs[ins->lhs], &regs[ins->reg])) {
+            goto error;
+        }
+        DISPATCH();
+    CASE(OP_R_LIST_APPEND):
+        if (!list_push(vm, regs[ins->lhs], regs[ins->rhs])) {
+            goto error;
+        }
+        regs[ins->reg] = NEW_NONE();
+        DISPATCH();
+    DEFAULT():
+        runtime_error(vm, "Unknown instruction 0x%x! Skipping...", ins->op);
+        DISPATCH();
+#ifndef __THREADED_DISPATCH__
     }
+    }
+#endif
+
+error:
+    exit(-1);
 }
 
+#if defined(__THREADED_DISPATCH__) && defined(__GNUC__)
+#pragma GCC diagnostic pop
+#endif
+
+#undef CASE
+#undef DEFAULT
+#undef DISPATCH
+#undef LOAD_REGS
+#undef SAFEPOINT
+
 int interpret(vm_t* vm, u32 ep) {
-    alloc_frames(vm);
+    alloc_stack(vm);
 
     def_native(vm, "clock", clock_nat);
     def_native(vm, "pow", pow_nat);
+    def_native(vm, "int_array", int_array_nat);
+    def_native(vm, "double_array", double_array_nat);
+    def_native(vm, "array_fill", array_fill_nat);
+    def_native(vm, "array_sum", array_sum_nat);
+    def_native(vm, "array_min", array_min_nat);
+    def_native(vm, "array_max", array_max_nat);
+    def_native(vm, "array_dot", array_dot_nat);
+    def_native(vm, "array_add", array_add_nat);
+    def_native(vm, "array_mul", array_mul_nat);
 
+    vm->frames = mem_handle_capacity(MEM_STACKS, vm->frames, vm->frame_len,
+                                     &vm->frame_cap, sizeof(*vm->frames));
     struct call_frame* entry = &vm->frames[vm->frame_len++];
     entry->function = (struct object_function*)vm->const_pool.data[ep];
     // There should never be a return from global
     entry->ret = 0;
-    entry->slots = vm->locals;
-    vm->ip = entry->function->bc.data;
+    entry->slots = vm->op_stack;
+    if (!frame_fits(vm, entry->function, entry->slots)) {
+        fprintf(stderr, "Stack overflow: The main function does not fit into the stack.\n");
+        return 1;
+    }
+    for (u16 i = 0; i < entry->function->locals; ++i) {
+        entry->slots[i] = NEW_NONE();
+    }
+    vm->stack_len = entry->function->locals;
+    vm->ip = entry->function->bc.code;
 
     int res = run(vm);
 
     return res;
 }
 
-#undef READ_IP
+void print_stats(vm_t* vm, FILE* f) {
+    struct vm_stats* s = &vm->stats;
+    u64 accesses = s->ic_hits_mono + s->ic_hits_poly + s->ic_misses;
+    fprintf(f, "member accesses:          %lu\n", accesses);
+    fprintf(f, "  monomorphic cache hits: %lu\n", s->ic_hits_mono);
+    fprintf(f, "  polymorphic cache hits: %lu\n", s->ic_hits_poly);
+    fprintf(f, "  cache misses:           %lu (%.1f%%)\n", s->ic_misses,
+            accesses ? 100.0 * s->ic_misses / accesses : 0.0);
+    u64 calls = s->mc_hits + s->mc_misses;
+    fprintf(f, "method calls:             %lu\n", calls);
+    fprintf(f, "  cache hits:             %lu\n", s->mc_hits);
+    fprintf(f, "  cache misses:           %lu (%.1f%%)\n", s->mc_misses,
+            calls ? 100.0 * s->mc_misses / calls : 0.0);
+    struct gc_state* gc = &vm->gc;
+    fprintf(f, "collections:              %lu minor, %lu major\n",
+            gc->minor_count, gc->major_count);
+    fprintf(f, "  compactions:            %lu\n", gc->compact_count);
+    fprintf(f, "  heap:                   %.1f MB used, %.1f MB in free blocks, threshold %.1f MB\n",
+            heap_used() / 1e6, heap_free_listed() / 1e6, gc->next_gc / 1e6);
+    fprintf(f, "  total time:             %.3f ms\n", gc->total_ns / 1e6);
+    fprintf(f, "  incremental steps:      %lu\n", gc->steps);
+    fprintf(f, "  non-incremental marking: %.3f ms\n", gc->mark_ns / 1e6);
+    fprintf(f, "  longest pause:          %.3f ms\n", gc->max_pause_ns / 1e6);
+    const char* buckets[GC_PAUSE_BUCKETS] = {"<10us", "<100us", "<1ms", "<10ms", "<100ms", ">=100ms"};
+    fprintf(f, "  pauses:                ");
+    for (int i = 0; i < GC_PAUSE_BUCKETS; ++i) {
+        fprintf(f, " %s %lu", buckets[i], gc->pauses[i]);
+    }
+    fprintf(f, "\n");
+    fprintf(f, "memory:                   %.1f MB\n", (mem_taken() + mem_category_bytes(MEM_STACKS)) / 1e6);
+    fprintf(f, "  heap objects:           %.1f MB\n", heap_taken() / 1e6);
+    for (int i = 0; i < MEM_CATEGORIES; ++i) {
+        char label[32];
+        snprintf(label, sizeof(label), "%s:", mem_category_name(i));
+        fprintf(f, "  %-24s%.1f MB\n", label, mem_category_bytes(i) / 1e6);
+    }
+#ifdef __linux__
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        fprintf(f, "  peak RSS:               %.1f MB\n", usage.ru_maxrss * 1024 / 1e6);
+    }
+#endif
+}
+
 #undef TOP_FRAME
@@ -5,20 +5,12 @@
 #include "hashtable.h"
 #include "native.h"
 #include "gc.h"
+#include "globals.h"
 
-#define FRAME_DEPTH 128
-#define GC_HEAP_GROW_FACTOR 2
-#define MAX_LOCALS 1 << 16
-
-#define READ_4B_IP(VM) ((VM)->ip += 4, (VM)->ip[-4] << 24 \
-                                     | (VM)->ip[-3] << 16 \
-                                     | (VM)->ip[-2] << 8 \
-                                     | (VM)->ip[-1])
-
-#define READ_2B_IP(VM) ((VM)->ip += 2, (VM)->ip[-2] << 8 \
-                                     | (VM)->ip[-1])
-
-#define READ_1B_IP(VM) (*(VM)->ip++)
+/// Number of values the value stack can hold, set by cmake.
+#ifndef OP_STACK_SIZE
+    #define OP_STACK_SIZE (1 << 20)
+#endif
 
 enum interpret_result {
     INTERPRET_CONTINUE,
@@ -29,35 +21,56 @@ enum interpret_result {
 struct call_frame {
     struct object_function* function;
     /// Address to return to when function ends.
-    u8* ret;
-    /// Points to the beginning of the part of locals array that
-    /// belongs to this function.
+    struct instruction* ret;
+    /// Points to the locals of the function on the value stack, the
+    /// arguments are the first of them. Operand stack of the function
+    /// starts right after the locals.
     struct value* slots;
 };
 
+/// Counters of the inline and method caches, 'caby execute --stats' prints them.
+struct vm_stats {
+    /// Hits of caches that saw only one class.
+    u64 ic_hits_mono;
+    /// Hits of caches that saw more classes.
+    u64 ic_hits_poly;
+    u64 ic_misses;
+    u64 mc_hits;
+    u64 mc_misses;
+};
+
 typedef struct vm_state {
-    struct call_frame frames[FRAME_DEPTH];
-    u16 frame_len;
-    u8* ip;
+    /// Grows when needed, the depth of calls is limited only by the
+    /// size of the value stack.
+    struct call_frame* frames;
+    size_t frame_len;
+    size_t frame_cap;
+    /// Points to the instruction that will be executed next.
+    struct instruction* ip;
 
     struct constant_pool const_pool;
 
+    /// Preallocated, holds OP_STACK_SIZE values. It contains locals of
+    /// all active functions interleaved with their operands. Calls check
+    /// that the callee fits, so push does not have to.
     struct value* op_stack;
     size_t stack_len;
-    size_t stack_cap;
 
-    struct table globals;
+    struct globals globals;
 
-    struct value* locals;
+    /// Interned strings, every string object is in here (as a key), so
+    /// equal strings are the same object. The table does not keep them
+    /// alive, the GC removes strings that are not reachable.
+    struct table strings;
 
-    /// Linked list of all objects in a program
-    struct object* objects;
 
     struct gc_state gc;
 
     // Name of the file that is currently interpreted
     const char* filename;
 
+    struct vm_stats stats;
+
 
 } vm_t;
 
@@ -67,6 +80,8 @@ void free_vm_state(vm_t* vm);
 
 int interpret(vm_t* vm, u32 ep);
 
+void print_stats(vm_t* vm, FILE* f);
+
 void push(vm_t* vm, struct value val);
 
 struct value pop(vm_t* vm);
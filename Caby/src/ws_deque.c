@@ -0,0 +1,99 @@
+#include "ws_deque.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WS_INITIAL_SIZE 1024
+
+static struct ws_array* new_array(int64_t size, struct ws_array* prev) {
+    struct ws_array* a = malloc(sizeof(*a) + size * sizeof(*a->data));
+    if (a == NULL) {
+        fprintf(stderr, "Allocation failed for internal GC data, aborting\n");
+        exit(-11);
+    }
+    a->size = size;
+    a->prev = prev;
+    return a;
+}
+
+void init_ws_deque(struct ws_deque* q) {
+    atomic_init(&q->top, 0);
+    atomic_init(&q->bottom, 0);
+    atomic_init(&q->array, new_array(WS_INITIAL_SIZE, NULL));
+}
+
+void free_ws_deque(struct ws_deque* q) {
+    struct ws_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    while (a != NULL) {
+        struct ws_array* prev = a->prev;
+        free(a);
+        a = prev;
+    }
+    atomic_store_explicit(&q->array, NULL, memory_order_relaxed);
+}
+
+static struct ws_array* grow(struct ws_deque* q, struct ws_array* a, int64_t top, int64_t bottom) {
+    struct ws_array* bigger = new_array(a->size * 2, a);
+    for (int64_t i = top; i < bottom; ++i) {
+        struct object* obj = atomic_load_explicit(&a->data[i % a->size], memory_order_relaxed);
+        atomic_store_explicit(&bigger->data[i % bigger->size], obj, memory_order_relaxed);
+    }
+    atomic_store_explicit(&q->array, bigger, memory_order_release);
+    return bigger;
+}
+
+void ws_push(struct ws_deque* q, struct object* obj) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    struct ws_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    if (b - t > a->size - 1) {
+        a = grow(q, a, t, b);
+    }
+    atomic_store_explicit(&a->data[b % a->size], obj, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+}
+
+struct object* ws_take(struct ws_deque* q) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed) - 1;
+    struct ws_array* a = atomic_load_explicit(&q->array, memory_order_relaxed);
+    atomic_store_explicit(&q->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    struct object* obj = atomic_load_explicit(&a->data[b % a->size], memory_order_relaxed);
+    if (t == b) {
+        // The last object, a thief might be taking it too.
+        if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            obj = NULL;
+        }
+        atomic_store_explicit(&q->bottom, b + 1, memory_order_relaxed);
+    }
+    return obj;
+}
+
+struct object* ws_steal(struct ws_deque* q) {
+    int64_t t = atomic_load_explicit(&q->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+    struct ws_array* a = atomic_load_explicit(&q->array, memory_order_acquire);
+    struct object* obj = atomic_load_explicit(&a->data[t % a->size], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&q->top, &t, t + 1, memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+        return WS_ABORT;
+    }
+    return obj;
+}
+
+int64_t ws_size(struct ws_deque* q) {
+    int64_t b = atomic_load_explicit(&q->bottom, memory_order_relaxed);
+    int64_t t = atomic_load_explicit(&q->top, memory_order_relaxed);
+    return b - t;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct object;
+
+/// Returned by ws_steal when it lost a race with another thread.
+#define WS_ABORT ((struct object*)1)
+
+struct ws_array {
+    int64_t size;
+    /// Arrays replaced by bigger ones, a thief might still read them.
+    struct ws_array* prev;
+    _Atomic(struct object*) data[];
+};
+
+/**
+ * Work-stealing deque of objects (Chase-Lev, as in "Correct and Efficient
+ * Work-Stealing for Weak Memory Models" by Lê et al.).
+ *
+ * Only the owner thread pushes and takes objects at the bottom, other
+ * threads steal from the top.
+ */
+struct ws_deque {
+    _Atomic int64_t top;
+    _Atomic int64_t bottom;
+    _Atomic(struct ws_array*) array;
+};
+
+void init_ws_deque(struct ws_deque* q);
+
+void free_ws_deque(struct ws_deque* q);
+
+/// Owner only.
+void ws_push(struct ws_deque* q, struct object* obj);
+
+/// Owner only, returns NULL if the deque is empty.
+struct object* ws_take(struct ws_deque* q);
+
+/// Returns NULL if the deque is empty or WS_ABORT if the object was
+/// taken by another thread.
+struct object* ws_steal(struct ws_deque* q);
+
+/// Number of objects in the deque, it may be out of date.
+int64_t ws_size(struct ws_deque* q);
@@ -0,0 +1,174 @@
+// Unit tests of the bulk kernels of the number arrays. The kernels are
+// compared with plain loops for all lengths up to a few vectors and for
+// unaligned starts, so both the vector part and the scalar tail are used.
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "../src/array_ops.h"
+
+#define MAX_LEN 70
+// The arrays start up to this many items after a malloc'd address.
+#define MAX_OFFSET 3
+
+static i32 ints_a[MAX_LEN + MAX_OFFSET];
+static i32 ints_b[MAX_LEN + MAX_OFFSET];
+static double doubles_a[MAX_LEN + MAX_OFFSET];
+static double doubles_b[MAX_LEN + MAX_OFFSET];
+
+static void init_data(void) {
+    srand(42);
+    for (int i = 0; i < MAX_LEN + MAX_OFFSET; ++i) {
+        ints_a[i] = rand() % 2001 - 1000;
+        ints_b[i] = rand() % 2001 - 1000;
+        // Small whole numbers, their sums are exact in any order.
+        doubles_a[i] = rand() % 201 - 100;
+        doubles_b[i] = (rand() % 201 - 100) / 4.0;
+    }
+}
+
+TEST(IntReductions) {
+    for (u32 off = 0; off <= MAX_OFFSET; ++off) {
+        const i32* a = ints_a + off;
+        const i32* b = ints_b + off;
+        for (u32 n = 0; n <= MAX_LEN; ++n) {
+            i32 sum = 0, dot = 0;
+            for (u32 i = 0; i < n; ++i) {
+                sum += a[i];
+                dot += a[i] * b[i];
+            }
+            ASSERT_EQ(i32_sum(a, n), sum);
+            ASSERT_EQ(i32_dot(a, b, n), dot);
+            if (n == 0) {
+                continue;
+            }
+            i32 min = a[0], max = a[0];
+            for (u32 i = 1; i < n; ++i) {
+                min = a[i] < min ? a[i] : min;
+                max = a[i] > max ? a[i] : max;
+            }
+            ASSERT_EQ(i32_min(a, n), min);
+            ASSERT_EQ(i32_max(a, n), max);
+        }
+    }
+    return 0;
+}
+
+TEST(IntElementwise) {
+    i32 dst[MAX_LEN + 1];
+    for (u32 off = 0; off <= MAX_OFFSET; ++off) {
+        const i32* a = ints_a + off;
+        const i32* b = ints_b + off;
+        for (u32 n = 0; n <= MAX_LEN; ++n) {
+            // The item after the end must stay untouched.
+            dst[n] = 12345;
+            i32_add(dst, a, b, n);
+            for (u32 i = 0; i < n; ++i) {
+                ASSERT_EQ(dst[i], a[i] + b[i]);
+            }
+            i32_mul(dst, a, b, n);
+            for (u32 i = 0; i < n; ++i) {
+                ASSERT_EQ(dst[i], a[i] * b[i]);
+            }
+            i32_fill(dst, -7, n);
+            for (u32 i = 0; i < n; ++i) {
+                ASSERT_EQ(dst[i], -7);
+            }
+            ASSERT_EQ(dst[n], 12345);
+        }
+    }
+    return 0;
+}
+
+TEST(IntWrapsAround) {
+    i32 a[9];
+    for (int i = 0; i < 9; ++i) {
+        a[i] = INT32_MAX;
+    }
+    // 9 * (2^31 - 1) mod 2^32 is 2^31 - 9
+    ASSERT_EQ(i32_sum(a, 9), INT32_MAX - 8);
+    i32 dst[9];
+    i32_add(dst, a, a, 9);
+    ASSERT_EQ(dst[8], -2);
+    return 0;
+}
+
+TEST(DoubleReductions) {
+    for (u32 off = 0; off <= MAX_OFFSET; ++off) {
+        const double* a = doubles_a + off;
+        const double* b = doubles_b + off;
+        for (u32 n = 0; n <= MAX_LEN; ++n) {
+            double sum = 0, dot = 0;
+            for (u32 i = 0; i < n; ++i) {
+                sum += a[i];
+                dot += a[i] * b[i];
+            }
+            ASSERT_W(f64_sum(a, n) == sum);
+            ASSERT_W(f64_dot(a, b, n) == dot);
+            if (n == 0) {
+                continue;
+            }
+            double min = a[0], max = a[0];
+            for (u32 i = 1; i < n; ++i) {
+                min = a[i] < min ? a[i] : min;
+                max = a[i] > max ? a[i] : max;
+            }
+            ASSERT_W(f64_min(a, n) == min);
+            ASSERT_W(f64_max(a, n) == max);
+        }
+    }
+    return 0;
+}
+
+TEST(DoubleElementwise) {
+    double dst[MAX_LEN + 1];
+    for (u32 off = 0; off <= MAX_OFFSET; ++off) {
+        const double* a = doubles_a + off;
+        const double* b = doubles_b + off;
+        for (u32 n = 0; n <= MAX_LEN; ++n) {
+            dst[n] = 0.5;
+            f64_add(dst, a, b, n);
+            for (u32 i = 0; i < n; ++i) {
+                ASSERT_W(dst[i] == a[i] + b[i]);
+            }
+            f64_mul(dst, a, b, n);
+            for (u32 i = 0; i < n; ++i) {
+                ASSERT_W(dst[i] == a[i] * b[i]);
+            }
+            f64_fill(dst, 2.5, n);
+            for (u32 i = 0; i < n; ++i) {
+                ASSERT_W(dst[i] == 2.5);
+            }
+            ASSERT_W(dst[n] == 0.5);
+        }
+    }
+    return 0;
+}
+
+TEST(InPlace) {
+    i32 a[MAX_LEN];
+    double d[MAX_LEN];
+    for (u32 i = 0; i < MAX_LEN; ++i) {
+        a[i] = (i32)i;
+        d[i] = i;
+    }
+    i32_add(a, a, a, MAX_LEN);
+    i32_mul(a, a, ints_b, MAX_LEN);
+    f64_mul(d, d, d, MAX_LEN);
+    for (u32 i = 0; i < MAX_LEN; ++i) {
+        ASSERT_EQ(a[i], 2 * (i32)i * ints_b[i]);
+        ASSERT_W(d[i] == (double)i * i);
+    }
+    return 0;
+}
+
+int main() {
+    init_data();
+    RUN_TEST(IntReductions);
+    RUN_TEST(IntElementwise);
+    RUN_TEST(IntWrapsAround);
+    RUN_TEST(DoubleReductions);
+    RUN_TEST(DoubleElementwise);
+    RUN_TEST(InPlace);
+    return 0;
+}
@@ -1,3 +1,11 @@
+// Unit tests of the heap allocator. When run as
+// 'blockalloc_test bench [operations] [live blocks]' it measures the
+// allocation throughput instead: it keeps a set of live blocks with sizes
+// of typical VM objects and repeatedly frees a random one and allocates
+// a new one in its place.
+#include <string.h>
+#include <time.h>
+
 #include "test.h"
 #include "../src/memory/block_alloc.h"
 
@@ -92,9 +100,139 @@ TEST(Freeing) {
     return 0;
 }
 
-int main() {
+TEST(SizeClasses) {
+    init_heap(4096);
+    // Sizes of one class share the freed blocks
+    void* a = heap_alloc(40);
+    heap_free(a);
+    ASSERT_W(heap_alloc(33) == a);
+    // Different class does not get it
+    void* b = heap_alloc(40);
+    heap_free(b);
+    void* c = heap_alloc(64);
+    ASSERT_W(c != b);
+    ASSERT_W(heap_alloc(48) == b);
+    done_heap();
+    return 0;
+}
+
+TEST(Splitting) {
+    init_heap(1024);
+    // Take the whole pool and free the big block again
+    void* big = heap_alloc(700);
+    void* rest = heap_alloc(200);
+    ASSERT_W(big != NULL && rest != NULL && heap_alloc(100) == NULL);
+    heap_free(big);
+    // Small blocks are cut from the freed block
+    char* blocks[8];
+    for (size_t i = 0; i < 8; ++i) {
+        blocks[i] = heap_alloc(80);
+        ASSERT_W(blocks[i] != NULL);
+        memset(blocks[i], i, 80);
+    }
+    ASSERT_W(blocks[0] == big);
+    for (size_t i = 0; i < 8; ++i) {
+        ASSERT_W(blocks[i][0] == (char)i && blocks[i][79] == (char)i);
+        heap_free(blocks[i]);
+    }
+    heap_free(rest);
+    ASSERT_W(heap_taken() == 0);
+    done_heap();
+    return 0;
+}
+
+TEST(Compaction) {
+    init_heap(2048);
+    // Every other small block is freed, the big one does not fit in between
+    char* blocks[24];
+    for (size_t i = 0; i < 24; ++i) {
+        blocks[i] = heap_alloc(48);
+        ASSERT_W(blocks[i] != NULL);
+        memset(blocks[i], i, 48);
+        heap_set_object(blocks[i]);
+    }
+    for (size_t i = 0; i < 24; i += 2) {
+        heap_free(blocks[i]);
+    }
+    ASSERT_W(heap_alloc(1024) == NULL);
+    ASSERT_W(heap_free_listed() == 12 * 48);
+
+    for (size_t i = 1; i < 24; i += 2) {
+        heap_mark(blocks[i]);
+    }
+    ASSERT_W(heap_prepare_compaction());
+    char* moved[24];
+    for (size_t i = 1; i < 24; i += 2) {
+        moved[i] = heap_forward(blocks[i]);
+        ASSERT_W(moved[i] <= blocks[i]);
+    }
+    ASSERT_W(moved[1] == blocks[0]);
+    heap_finish_compaction();
+    for (size_t i = 1; i < 24; i += 2) {
+        ASSERT_W(moved[i][0] == (char)i && moved[i][47] == (char)i);
+        ASSERT_W(!heap_is_marked(moved[i]));
+    }
+    ASSERT_W(heap_free_listed() == 0);
+    ASSERT_W(heap_taken() == 12 * 48);
+    ASSERT_W(heap_used() == 12 * (48 + sizeof(struct heap_header)));
+    // Objects are found at their new addresses
+    size_t objects = 0;
+    for (size_t w = 0; w < heap_bitmap_words(); ++w) {
+        objects += __builtin_popcountll(heap_objects[w]);
+    }
+    ASSERT_W(objects == 12);
+    ASSERT_W(heap_alloc(1024) != NULL);
+    done_heap();
+    return 0;
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int bench(size_t operations, size_t live) {
+    // Strings, instances, functions, classes and their data
+    static const size_t sizes[] = {24, 32, 48, 56, 64, 72, 96, 136, 300, 1000};
+    const size_t sizes_len = sizeof(sizes) / sizeof(*sizes);
+    init_heap(1024 * 1024 * 1024);
+    void** blocks = calloc(live, sizeof(*blocks));
+    uint64_t rng = 88172645463325252ull;
+    double begin = now();
+    for (size_t i = 0; i < operations; ++i) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        size_t slot = rng % live;
+        if (blocks[slot] != NULL) {
+            heap_free(blocks[slot]);
+        }
+        blocks[slot] = heap_alloc(sizes[(rng >> 32) % sizes_len]);
+        if (blocks[slot] == NULL) {
+            fprintf(stderr, "Out of memory after %lu operations\n", i);
+            return 1;
+        }
+    }
+    double elapsed = now() - begin;
+    printf("%lu operations, %lu live blocks: %.3f s, %.1f ns per free + alloc\n",
+           operations, live, elapsed, elapsed * 1e9 / operations);
+    free(blocks);
+    done_heap();
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        size_t operations = argc > 2 ? strtoul(argv[2], NULL, 10) : 10000000;
+        size_t live = argc > 3 ? strtoul(argv[3], NULL, 10) : 100000;
+        return bench(operations, live);
+    }
     RUN_TEST(Allocation);
     RUN_TEST(ComplicatedAllocations);
     RUN_TEST(Freeing);
+    RUN_TEST(SizeClasses);
+    RUN_TEST(Splitting);
+    RUN_TEST(Compaction);
     return 0;
 }
@@ -0,0 +1,151 @@
+// Microbenchmark of the interpreter loop. It is compiled twice, once
+// with the switch dispatch and once with threaded dispatch, run both
+// binaries to compare them.
+//
+// usage: dispatch_bench [iterations]
+#include <stdbool.h>
+#include <time.h>
+
+#include "../src/vm.h"
+#include "../src/bytecode.h"
+#include "../src/object.h"
+#include "../src/memory/block_alloc.h"
+
+#ifdef __THREADED_DISPATCH__
+    #define MODE "threaded"
+#else
+    #define MODE "switch"
+#endif
+
+static void emit(struct bc_chunk* c, u8 op) {
+    write_byte(c, op);
+    write_loc(c, 0, 0);
+}
+
+static void emit_16(struct bc_chunk* c, u8 op, u16 arg) {
+    write_byte(c, op);
+    write_word(c, arg);
+    write_loc(c, 0, 0);
+}
+
+static void emit_32(struct bc_chunk* c, u8 op, u32 arg) {
+    write_byte(c, op);
+    write_dword(c, arg);
+    write_loc(c, 0, 0);
+}
+
+static void emit_8(struct bc_chunk* c, u8 op, u8 arg) {
+    write_byte(c, op);
+    write_byte(c, arg);
+    write_loc(c, 0, 0);
+}
+
+/// Emits 'while (local 0 < iterations)' header, returns the offset of
+/// the branch operand that has to be patched with the loop end.
+static size_t emit_loop_header(struct bc_chunk* c, u32 iterations) {
+    emit_32(c, OP_PUSH_INT, iterations);
+    emit_16(c, OP_GET_LOCAL, 0);
+    emit(c, OP_ILESS);
+    emit_32(c, OP_BRANCH_FALSE, 0);
+    return c->len - 4;
+}
+
+static void patch(struct bc_chunk* c, size_t at, u32 dest) {
+    c->data[at] = dest >> 24;
+    c->data[at + 1] = dest >> 16;
+    c->data[at + 2] = dest >> 8;
+    c->data[at + 3] = dest;
+}
+
+/// acc = 0; i = 0; while (i < n) { acc = acc + i % 7; i = i + 1; }
+/// Returns number of instructions executed per iteration.
+static size_t build_arith(vm_t* vm, u32 iterations) {
+    struct bc_chunk c;
+    init_bc_chunk(&c);
+    emit_32(&c, OP_PUSH_INT, 0);
+    emit_16(&c, OP_SET_LOCAL, 0);
+    emit_32(&c, OP_PUSH_INT, 0);
+    emit_16(&c, OP_SET_LOCAL, 1);
+    u32 loop = c.len;
+    size_t end = emit_loop_header(&c, iterations);
+    emit_32(&c, OP_PUSH_INT, 7);
+    emit_16(&c, OP_GET_LOCAL, 0);
+    emit(&c, OP_IMOD);
+    emit_16(&c, OP_GET_LOCAL, 1);
+    emit(&c, OP_IADD);
+    emit_16(&c, OP_SET_LOCAL, 1);
+    emit_32(&c, OP_PUSH_INT, 1);
+    emit_16(&c, OP_GET_LOCAL, 0);
+    emit(&c, OP_IADD);
+    emit_16(&c, OP_SET_LOCAL, 0);
+    emit_32(&c, OP_JMP, loop);
+    patch(&c, end, c.len);
+    emit(&c, OP_RETURN);
+
+    write_constant_pool(&vm->const_pool, (struct object*)new_string(vm, "#main"));
+    write_constant_pool(&vm->const_pool, (struct object*)new_function(vm, 0, 2, 2, c, 0));
+    return 15;
+}
+
+/// def add1(x) = x + 1; i = 0; while (i < n) { i = add1(i); }
+/// Returns number of instructions executed per iteration.
+static size_t build_calls(vm_t* vm, u32 iterations) {
+    struct bc_chunk f;
+    init_bc_chunk(&f);
+    emit_16(&f, OP_GET_LOCAL, 0);
+    emit_32(&f, OP_PUSH_INT, 1);
+    emit(&f, OP_IADD);
+    emit(&f, OP_RETURN);
+
+    struct bc_chunk c;
+    init_bc_chunk(&c);
+    emit_32(&c, OP_PUSH_INT, 0);
+    emit_16(&c, OP_SET_LOCAL, 0);
+    u32 loop = c.len;
+    size_t end = emit_loop_header(&c, iterations);
+    emit_16(&c, OP_GET_LOCAL, 0);
+    emit_32(&c, OP_PUSH_LITERAL, 1);
+    emit_8(&c, OP_CALL_FUNC, 1);
+    emit_16(&c, OP_SET_LOCAL, 0);
+    emit_32(&c, OP_JMP, loop);
+    patch(&c, end, c.len);
+    emit(&c, OP_RETURN);
+
+    write_constant_pool(&vm->const_pool, (struct object*)new_string(vm, "#main"));
+    write_constant_pool(&vm->const_pool, (struct object*)new_function(vm, 1, 1, 2, f, 0));
+    write_constant_pool(&vm->const_pool, (struct object*)new_function(vm, 0, 1, 2, c, 0));
+    return 13;
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void bench(const char* name, size_t (*build)(vm_t*, u32), u32 iterations) {
+    vm_t vm;
+    init_vm_state(&vm);
+    vm.gc.gc_off = true;
+    size_t per_iteration = build(&vm, iterations);
+    decode_constant_pool(&vm.const_pool, &vm.globals, 0);
+    vm.gc.gc_off = false;
+
+    double begin = now();
+    interpret(&vm, vm.const_pool.len - 1);
+    double elapsed = now() - begin;
+
+    double instructions = (double)per_iteration * iterations;
+    printf("%-8s %-6s %12.0f ins %8.3f s %10.2f Mins/s\n", MODE, name,
+           instructions, elapsed, instructions / elapsed / 1e6);
+    free_vm_state(&vm);
+}
+
+int main(int argc, const char* argv[]) {
+    u32 iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+    init_heap(64 * 1024 * 1024);
+    bench("arith", build_arith, iterations);
+    bench("calls", build_calls, iterations);
+    done_heap();
+    return 0;
+}
@@ -0,0 +1,72 @@
+// Benchmark of the parallel marker. It builds a binary tree of instances
+// and measures how long full collections spend marking it with 1, 2, 4...
+// threads.
+//
+// usage: gc_bench [depth of the tree] [maximum number of threads]
+#include <stdio.h>
+
+#include "../src/vm.h"
+#include "../src/class.h"
+#include "../src/gc.h"
+#include "../src/object.h"
+#include "../src/memory/block_alloc.h"
+
+#define ROUNDS 3
+
+static struct object_class* klass;
+static struct shape* with_left;
+static struct shape* with_both;
+
+static struct value build(vm_t* vm, u32 depth) {
+    if (depth == 0) {
+        return NEW_NONE();
+    }
+    struct value left = build(vm, depth - 1);
+    struct value right = build(vm, depth - 1);
+    struct object_instance* node = new_instance(vm, klass);
+    instance_transition(node, with_left, left);
+    instance_transition(node, with_both, right);
+    return NEW_OBJECT(node);
+}
+
+int main(int argc, const char* argv[]) {
+    u32 depth = argc > 1 ? strtoul(argv[1], NULL, 10) : 21;
+    u32 max_threads = argc > 2 ? strtoul(argv[2], NULL, 10) : 8;
+    init_heap(2048ul * 1024 * 1024);
+
+    vm_t vm;
+    init_vm_state(&vm);
+    vm.gc.gc_off = true;
+    // Everything is kept alive by the constant pool.
+    struct object_string* l = new_string(&vm, "l");
+    struct object_string* r = new_string(&vm, "r");
+    klass = new_class(&vm, 0, 0);
+    klass->slots_hint = 2;
+    with_left = shape_add(klass->shape, &l->object);
+    with_both = shape_add(with_left, &r->object);
+    write_constant_pool(&vm.const_pool, &l->object);
+    write_constant_pool(&vm.const_pool, &r->object);
+    write_constant_pool(&vm.const_pool, &klass->object);
+    write_constant_pool(&vm.const_pool, AS_OBJECT(build(&vm, depth)));
+    vm.gc.gc_off = false;
+
+    printf("%u instances\n", (1u << depth) - 1);
+    for (u32 threads = 1; threads <= max_threads; threads *= 2) {
+        vm.gc.mark_threads = threads;
+        u64 before = vm.gc.mark_ns;
+        // The worklist grows in the first collection and counts to
+        // mem_taken, so only the objects are compared.
+        size_t taken = heap_taken();
+        for (int i = 0; i < ROUNDS; ++i) {
+            gc_collect(&vm);
+        }
+        if (heap_taken() != taken) {
+            fprintf(stderr, "The marker missed live objects\n");
+            return 1;
+        }
+        printf("threads %2u  mark %8.2f ms\n", threads, (vm.gc.mark_ns - before) / 1e6 / ROUNDS);
+    }
+    free_vm_state(&vm);
+    done_heap();
+    return 0;
+}
@@ -1,6 +1,12 @@
 // In case any of the tests segfaults for no apparent reason
 // try to enlarge the heap.
+//
+// When run as 'hashmap_test bench [keys] [operations]' it measures the
+// insert, lookup and delete throughput of the table with string keys
+// against the linear probing table it replaced.
 #include <stdbool.h>
+#include <string.h>
+#include <time.h>
 
 #include "test.h"
 #include "../src/vm.h"
@@ -23,13 +29,13 @@ TEST(HashMapBasic) {
     table_set(&t, key1, NEW_INT(3));
     ASSERT_W(t.count == 1);
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT);
-    ASSERT_W(val_out.integer == 3);
+    ASSERT_W(IS_INT(val_out));
+    ASSERT_W(AS_CINT(val_out) == 3);
 
     ASSERT_W(!table_set(&t, key1, NEW_INT(5)));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT);
-    ASSERT_W(val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out));
+    ASSERT_W(AS_CINT(val_out) == 5);
 
     struct value key2 = NEW_OBJECT(new_string(&vm, "FOO"));
     struct value key3 = NEW_OBJECT(new_string(&vm, "BAR"));
@@ -45,48 +51,50 @@ TEST(HashMapBasic) {
 
     // Check that the keys exists
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(table_get(&t, key2, &val_out));
-    ASSERT_W(val_out.type == VAL_BOOL && val_out.boolean == true);
+    ASSERT_W(IS_BOOL(val_out) && AS_BOOL(val_out) == true);
     ASSERT_W(table_get(&t, key3, &val_out));
-    ASSERT_W(val_out.type == VAL_NONE);
+    ASSERT_W(IS_NONE(val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
 
-    // Check reads/writes through equal bot not same "object" keys
+    // Check reads/writes through keys created separately (strings are interned,
+    // so they end up being the same object)
     struct value key7_1 = NEW_OBJECT(new_string(&vm, "FOOBAR"));
     struct value key7_2 = NEW_OBJECT(new_string(&vm, "FOOBAR"));
+    ASSERT_W(AS_OBJECT(key7_1) == AS_OBJECT(key7_2));
     ASSERT_W(table_set(&t, key7_1, NEW_INT(9)));
     ASSERT_W(table_get(&t, key7_2, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 9);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 9);
     ASSERT_W(table_get(&t, key7_1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 9);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 9);
     ASSERT_W(!table_set(&t, key7_2, NEW_DOUBLE(9.9)));
     ASSERT_W(table_get(&t, key7_1, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 9.9);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 9.9);
     ASSERT_W(table_get(&t, key7_2, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 9.9);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 9.9);
 
     // Delete the above entry
     ASSERT_W(table_delete(&t, key7_1));
     ASSERT_W(!table_delete(&t, key7_1));
     ASSERT_W(!table_delete(&t, key7_2));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(table_get(&t, key2, &val_out));
-    ASSERT_W(val_out.type == VAL_BOOL && val_out.boolean == true);
+    ASSERT_W(IS_BOOL(val_out) && AS_BOOL(val_out) == true);
     ASSERT_W(table_get(&t, key3, &val_out));
-    ASSERT_W(val_out.type == VAL_NONE);
+    ASSERT_W(IS_NONE(val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
 
 
     // Add a couple more entries to stress reallocation
@@ -97,19 +105,19 @@ TEST(HashMapBasic) {
 
     ASSERT_W(table_set(&t, key7, NEW_INT(70)));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(table_get(&t, key2, &val_out));
-    ASSERT_W(val_out.type == VAL_BOOL && val_out.boolean == true);
+    ASSERT_W(IS_BOOL(val_out) && AS_BOOL(val_out) == true);
     ASSERT_W(table_get(&t, key3, &val_out));
-    ASSERT_W(val_out.type == VAL_NONE);
+    ASSERT_W(IS_NONE(val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(!table_get(&t, key8, &val_out));
     ASSERT_W(!table_get(&t, key9, &val_out));
     ASSERT_W(!table_get(&t, key10, &val_out));
@@ -117,111 +125,111 @@ TEST(HashMapBasic) {
 
     ASSERT_W(table_set(&t, key8, NEW_INT(80)));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(table_get(&t, key2, &val_out));
-    ASSERT_W(val_out.type == VAL_BOOL && val_out.boolean == true);
+    ASSERT_W(IS_BOOL(val_out) && AS_BOOL(val_out) == true);
     ASSERT_W(table_get(&t, key3, &val_out));
-    ASSERT_W(val_out.type == VAL_NONE);
+    ASSERT_W(IS_NONE(val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(!table_get(&t, key9, &val_out));
     ASSERT_W(!table_get(&t, key10, &val_out));
 
     ASSERT_W(table_set(&t, key9, NEW_INT(90)));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(table_get(&t, key2, &val_out));
-    ASSERT_W(val_out.type == VAL_BOOL && val_out.boolean == true);
+    ASSERT_W(IS_BOOL(val_out) && AS_BOOL(val_out) == true);
     ASSERT_W(table_get(&t, key3, &val_out));
-    ASSERT_W(val_out.type == VAL_NONE);
+    ASSERT_W(IS_NONE(val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(!table_get(&t, key10, &val_out));
 
     ASSERT_W(table_set(&t, key10, NEW_INT(100)));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(table_get(&t, key2, &val_out));
-    ASSERT_W(val_out.type == VAL_BOOL && val_out.boolean == true);
+    ASSERT_W(IS_BOOL(val_out) && AS_BOOL(val_out) == true);
     ASSERT_W(table_get(&t, key3, &val_out));
-    ASSERT_W(val_out.type == VAL_NONE);
+    ASSERT_W(IS_NONE(val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     // Delete all entries one by one
     ASSERT_W(table_delete(&t, key2));
     ASSERT_W(!table_delete(&t, key2));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(!table_get(&t, key2, &val_out));
     ASSERT_W(table_get(&t, key3, &val_out));
-    ASSERT_W(val_out.type == VAL_NONE);
+    ASSERT_W(IS_NONE(val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key3));
     ASSERT_W(!table_delete(&t, key3));
     ASSERT_W(!table_delete(&t, key2));
     ASSERT_W(table_get(&t, key1, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 5);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 5);
     ASSERT_W(!table_get(&t, key2, &val_out));
     ASSERT_W(!table_get(&t, key3, &val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key1));
     ASSERT_W(!table_delete(&t, key1));
@@ -231,19 +239,19 @@ TEST(HashMapBasic) {
     ASSERT_W(!table_get(&t, key2, &val_out));
     ASSERT_W(!table_get(&t, key3, &val_out));
     ASSERT_W(table_get(&t, key4, &val_out));
-    ASSERT_W(val_out.type == VAL_DOUBLE && val_out.double_num == 4.2);
+    ASSERT_W(IS_DOUBLE(val_out) && AS_DOUBLE(val_out) == 4.2);
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key4));
     ASSERT_W(!table_delete(&t, key4));
@@ -255,17 +263,17 @@ TEST(HashMapBasic) {
     ASSERT_W(!table_get(&t, key3, &val_out));
     ASSERT_W(!table_get(&t, key4, &val_out));
     ASSERT_W(table_get(&t, key5, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 42);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 42);
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key5));
     ASSERT_W(!table_delete(&t, key5));
@@ -279,15 +287,15 @@ TEST(HashMapBasic) {
     ASSERT_W(!table_get(&t, key4, &val_out));
     ASSERT_W(!table_get(&t, key5, &val_out));
     ASSERT_W(table_get(&t, key6, &val_out));
-    ASSERT_W(val_out.type == VAL_OBJECT && val_out.object == key1.object);
+    ASSERT_W(IS_OBJECT(val_out) && AS_OBJECT(val_out) == AS_OBJECT(key1));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key6));
     ASSERT_W(!table_delete(&t, key6));
@@ -303,13 +311,13 @@ TEST(HashMapBasic) {
     ASSERT_W(!table_get(&t, key5, &val_out));
     ASSERT_W(!table_get(&t, key6, &val_out));
     ASSERT_W(table_get(&t, key7, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 70);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 70);
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key7));
     ASSERT_W(!table_delete(&t, key7));
@@ -327,11 +335,11 @@ TEST(HashMapBasic) {
     ASSERT_W(!table_get(&t, key6, &val_out));
     ASSERT_W(!table_get(&t, key7, &val_out));
     ASSERT_W(table_get(&t, key8, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 80);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 80);
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key8));
     ASSERT_W(!table_delete(&t, key8));
@@ -351,9 +359,9 @@ TEST(HashMapBasic) {
     ASSERT_W(!table_get(&t, key7, &val_out));
     ASSERT_W(!table_get(&t, key8, &val_out));
     ASSERT_W(table_get(&t, key9, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 90);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 90);
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
     ASSERT_W(table_delete(&t, key9));
     ASSERT_W(!table_delete(&t, key9));
@@ -375,7 +383,7 @@ TEST(HashMapBasic) {
     ASSERT_W(!table_get(&t, key8, &val_out));
     ASSERT_W(!table_get(&t, key9, &val_out));
     ASSERT_W(table_get(&t, key10, &val_out));
-    ASSERT_W(val_out.type == VAL_INT && val_out.integer == 100);
+    ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == 100);
 
 
     ASSERT_W(table_delete(&t, key10));
@@ -405,6 +413,254 @@ TEST(HashMapBasic) {
     return 0;
 }
 
-int main() {
+TEST(HashMapMany) {
+    init_heap(1024 * 1024);
+    struct table t;
+    init_table(&t);
+    struct value val_out;
+    const int n = 5000;
+
+    for (int i = 0; i < n; ++i) {
+        ASSERT_W(table_set(&t, NEW_INT(i), NEW_INT(-i)));
+    }
+    ASSERT_W(t.count == (size_t)n);
+    // Delete and insert again so that the deleted entries get reused
+    for (int round = 0; round < 4; ++round) {
+        for (int i = round % 2; i < n; i += 2) {
+            ASSERT_W(table_delete(&t, NEW_INT(i)));
+        }
+        ASSERT_W(t.count == (size_t)n / 2);
+        for (int i = 0; i < n; ++i) {
+            ASSERT_W(table_get(&t, NEW_INT(i), &val_out) == (i % 2 != round % 2));
+        }
+        for (int i = round % 2; i < n; i += 2) {
+            ASSERT_W(table_set(&t, NEW_INT(i), NEW_INT(-i)));
+        }
+        ASSERT_W(t.count == (size_t)n);
+    }
+    size_t capacity = t.capacity;
+    for (int i = 0; i < n; ++i) {
+        ASSERT_W(table_get(&t, NEW_INT(i), &val_out));
+        ASSERT_W(IS_INT(val_out) && AS_CINT(val_out) == -i);
+    }
+    // Keys that were never in the table fill the deleted entries
+    for (int i = 0; i < 100 * n; ++i) {
+        ASSERT_W(table_delete(&t, NEW_INT(i % n)));
+        ASSERT_W(table_set(&t, NEW_INT(n + i), NEW_INT(i)));
+        ASSERT_W(table_delete(&t, NEW_INT(n + i)));
+        ASSERT_W(table_set(&t, NEW_INT(i % n), NEW_INT(-(i % n))));
+    }
+    ASSERT_W(t.count == (size_t)n);
+    ASSERT_W(t.capacity == capacity);
+    ASSERT_W(!table_get(&t, NEW_INT(n), &val_out));
+    ASSERT_W(table_get(&t, NEW_INT(n - 1), &val_out));
+
+    size_t found = 0;
+    for (size_t i = 0; i < t.capacity; ++i) {
+        found += !IS_NONE(t.entries[i].key);
+    }
+    ASSERT_W(found == (size_t)n);
+
+    free_table(&t);
+    done_heap();
+    return 0;
+}
+
+/*
+ * The table before the control bytes were added, kept for the benchmark.
+ * Linear probing over the entries, deleted ones have a none key and a true value.
+ */
+static struct entry* linear_find_entry(struct entry* entries, size_t capacity,
+                                       struct value key) {
+    u32 idx = value_hash(key) & (capacity - 1);
+    struct entry* tombstone = NULL;
+    for (;;) {
+        struct entry* e = &entries[idx];
+        if (IS_NONE(e->key)) {
+            if (IS_NONE(e->val)) {
+                return tombstone != NULL ? tombstone : e;
+            } else if (tombstone == NULL) {
+                tombstone = e;
+            }
+        } else if (value_eq(e->key, key)) {
+            return e;
+        }
+        idx = (idx + 1) & (capacity - 1);
+    }
+}
+
+static void linear_adjust_capacity(struct table* t, size_t capacity) {
+    struct entry* entries = malloc(sizeof(*entries) * capacity);
+    for (size_t i = 0; i < capacity; ++i) {
+        entries[i].key = NEW_NONE();
+        entries[i].val = NEW_NONE();
+    }
+    t->count = 0;
+    for (size_t i = 0; i < t->capacity; ++i) {
+        struct entry* e = &t->entries[i];
+        if (IS_NONE(e->key)) {
+            continue;
+        }
+        *linear_find_entry(entries, capacity, e->key) = *e;
+        t->count += 1;
+    }
+    free(t->entries);
+    t->entries = entries;
+    t->capacity = capacity;
+}
+
+static bool linear_set(struct table* t, struct value key, struct value val) {
+    if (t->count >= t->capacity * 0.75) {
+        linear_adjust_capacity(t, get_cap(t->capacity));
+    }
+    struct entry* e = linear_find_entry(t->entries, t->capacity, key);
+    bool is_new_key = IS_NONE(e->key);
+    if (is_new_key && IS_NONE(e->val)) {
+        t->count += 1;
+    }
+    e->key = key;
+    e->val = val;
+    return is_new_key;
+}
+
+static bool linear_get(struct table* t, struct value key, struct value* val) {
+    if (t->count == 0) {
+        return false;
+    }
+    struct entry* e = linear_find_entry(t->entries, t->capacity, key);
+    if (IS_NONE(e->key)) {
+        return false;
+    }
+    *val = e->val;
+    return true;
+}
+
+static bool linear_delete(struct table* t, struct value key) {
+    if (t->count == 0) {
+        return false;
+    }
+    struct entry* e = linear_find_entry(t->entries, t->capacity, key);
+    if (IS_NONE(e->key)) {
+        return false;
+    }
+    e->key = NEW_NONE();
+    e->val = NEW_BOOL(true);
+    return true;
+}
+
+static void linear_free(struct table* t) {
+    free(t->entries);
+}
+
+struct table_impl {
+    const char* name;
+    bool (*set)(struct table*, struct value, struct value);
+    bool (*get)(struct table*, struct value, struct value*);
+    bool (*delete)(struct table*, struct value);
+    void (*free)(struct table*);
+};
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/// Runs each phase over the keys until it did at least 'operations' of them.
+static void bench_table(const struct table_impl* impl, struct value* keys,
+                        struct value* missing, size_t len, size_t operations) {
+    size_t rounds = (operations + len - 1) / len;
+    struct table t;
+    init_table(&t);
+    struct value val;
+    size_t hits = 0;
+
+    double begin = now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < len; ++i) {
+            impl->set(&t, keys[i], NEW_INT(i));
+        }
+        if (r + 1 < rounds) {
+            for (size_t i = 0; i < len; ++i) {
+                impl->delete(&t, keys[i]);
+            }
+        }
+    }
+    double insert = now() - begin;
+
+    begin = now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < len; ++i) {
+            hits += impl->get(&t, keys[i], &val);
+        }
+    }
+    double lookup = now() - begin;
+
+    begin = now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < len; ++i) {
+            hits += impl->get(&t, missing[i], &val);
+        }
+    }
+    double miss = now() - begin;
+
+    begin = now();
+    for (size_t r = 0; r < rounds; ++r) {
+        for (size_t i = 0; i < len; ++i) {
+            impl->delete(&t, keys[i]);
+        }
+        if (r + 1 < rounds) {
+            for (size_t i = 0; i < len; ++i) {
+                impl->set(&t, keys[i], NEW_INT(i));
+            }
+        }
+    }
+    double delete = now() - begin;
+
+    double ops = rounds * len;
+    printf("%-7s insert %6.1f ns, hit %6.1f ns, miss %6.1f ns, delete %6.1f ns (%lu)\n",
+           impl->name, insert * 1e9 / ops, lookup * 1e9 / ops, miss * 1e9 / ops,
+           delete * 1e9 / ops, hits);
+    impl->free(&t);
+}
+
+static int bench(size_t len, size_t operations) {
+    static const struct table_impl impls[] = {
+        {"linear", linear_set, linear_get, linear_delete, linear_free},
+        {"swiss", table_set, table_get, table_delete, free_table},
+    };
+    init_heap(1024 * 1024 * 1024);
+    vm_t vm;
+    init_vm_state(&vm);
+    vm.gc.gc_off = true;
+    // Names of globals and methods
+    struct value* keys = malloc(len * sizeof(*keys));
+    struct value* missing = malloc(len * sizeof(*missing));
+    char buf[32];
+    for (size_t i = 0; i < len; ++i) {
+        snprintf(buf, sizeof(buf), "name_%lu", i);
+        keys[i] = NEW_OBJECT(new_string(&vm, buf));
+        snprintf(buf, sizeof(buf), "other_%lu", i);
+        missing[i] = NEW_OBJECT(new_string(&vm, buf));
+    }
+    printf("%lu keys, %lu operations per phase\n", len, operations);
+    for (size_t i = 0; i < sizeof(impls) / sizeof(*impls); ++i) {
+        bench_table(&impls[i], keys, missing, len, operations);
+    }
+    free(keys);
+    free(missing);
+    free_vm_state(&vm);
+    done_heap();
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        size_t len = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+        size_t operations = argc > 3 ? strtoul(argv[3], NULL, 10) : 10000000;
+        return bench(len, operations);
+    }
     RUN_TEST(HashMapBasic);
+    RUN_TEST(HashMapMany);
+    return 0;
 }
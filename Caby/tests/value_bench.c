@@ -0,0 +1,154 @@
+// Benchmark of the value representation. It is compiled twice, once with
+// the tagged union and once with NaN boxed values, run both binaries to
+// compare them.
+//
+// stack - interpreter loop doing integer arithmetic, it mostly moves
+//         values between the operand stack and locals.
+// table - inserts and looks up integer and string keys in hash tables.
+//
+// usage: value_bench [iterations]
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../src/vm.h"
+#include "../src/bytecode.h"
+#include "../src/object.h"
+#include "../src/hashtable.h"
+#include "../src/memory/block_alloc.h"
+
+#ifdef __NAN_BOXING__
+    #define MODE "nanbox"
+#else
+    #define MODE "tagged"
+#endif
+
+#define TABLE_KEYS 4096
+#define STRING_KEYS 64
+
+static void emit(struct bc_chunk* c, u8 op) {
+    write_byte(c, op);
+    write_loc(c, 0, 0);
+}
+
+static void emit_16(struct bc_chunk* c, u8 op, u16 arg) {
+    write_byte(c, op);
+    write_word(c, arg);
+    write_loc(c, 0, 0);
+}
+
+static void emit_32(struct bc_chunk* c, u8 op, u32 arg) {
+    write_byte(c, op);
+    write_dword(c, arg);
+    write_loc(c, 0, 0);
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void report(const char* name, double ops, double elapsed) {
+    printf("%-7s %-6s %12.0f ops %8.3f s %8.2f ns/op\n", MODE, name, ops,
+           elapsed, elapsed * 1e9 / ops);
+}
+
+/// i = 0; acc = 0; while (i < n) { acc = acc + i % 7; i = i + 1; }
+static void bench_stack(u32 iterations) {
+    vm_t vm;
+    init_vm_state(&vm);
+    vm.gc.gc_off = true;
+
+    struct bc_chunk c;
+    init_bc_chunk(&c);
+    emit_32(&c, OP_PUSH_INT, 0);
+    emit_16(&c, OP_SET_LOCAL, 0);
+    emit_32(&c, OP_PUSH_INT, 0);
+    emit_16(&c, OP_SET_LOCAL, 1);
+    u32 loop = c.len;
+    emit_32(&c, OP_PUSH_INT, iterations);
+    emit_16(&c, OP_GET_LOCAL, 0);
+    emit(&c, OP_ILESS);
+    emit_32(&c, OP_BRANCH_FALSE, 0);
+    size_t end = c.len - 4;
+    emit_32(&c, OP_PUSH_INT, 7);
+    emit_16(&c, OP_GET_LOCAL, 0);
+    emit(&c, OP_IMOD);
+    emit_16(&c, OP_GET_LOCAL, 1);
+    emit(&c, OP_IADD);
+    emit_16(&c, OP_SET_LOCAL, 1);
+    emit_32(&c, OP_PUSH_INT, 1);
+    emit_16(&c, OP_GET_LOCAL, 0);
+    emit(&c, OP_IADD);
+    emit_16(&c, OP_SET_LOCAL, 0);
+    emit_32(&c, OP_JMP, loop);
+    c.data[end] = c.len >> 24;
+    c.data[end + 1] = c.len >> 16;
+    c.data[end + 2] = c.len >> 8;
+    c.data[end + 3] = c.len;
+    emit(&c, OP_RETURN);
+
+    write_constant_pool(&vm.const_pool, (struct object*)new_string(&vm, "#main"));
+    write_constant_pool(&vm.const_pool, (struct object*)new_function(&vm, 0, 2, 2, c, 0));
+    decode_constant_pool(&vm.const_pool, &vm.globals, 0);
+    vm.gc.gc_off = false;
+
+    double begin = now();
+    interpret(&vm, vm.const_pool.len - 1);
+    report("stack", (double)iterations * 15, now() - begin);
+    free_vm_state(&vm);
+}
+
+static void bench_table(u32 iterations) {
+    vm_t vm;
+    init_vm_state(&vm);
+    vm.gc.gc_off = true;
+
+    struct value strings[STRING_KEYS];
+    char buf[32];
+    for (int i = 0; i < STRING_KEYS; ++i) {
+        snprintf(buf, sizeof(buf), "member_%d", i);
+        strings[i] = NEW_OBJECT(new_string(&vm, buf));
+    }
+
+    u32 rounds = iterations / TABLE_KEYS + 1;
+    u64 checksum = 0;
+    double begin = now();
+    for (u32 r = 0; r < rounds; ++r) {
+        struct table ints;
+        struct table members;
+        init_table(&ints);
+        init_table(&members);
+        for (int i = 0; i < TABLE_KEYS; ++i) {
+            table_set(&ints, NEW_INT(i * 31), NEW_INT(i));
+            table_set(&members, strings[i % STRING_KEYS], NEW_INT(i));
+        }
+        struct value v;
+        for (int i = 0; i < TABLE_KEYS; ++i) {
+            if (table_get(&ints, NEW_INT(i * 31), &v)) {
+                checksum += AS_CINT(v);
+            }
+            if (table_get(&members, strings[i % STRING_KEYS], &v)) {
+                checksum += AS_CINT(v);
+            }
+        }
+        free_table(&ints);
+        free_table(&members);
+    }
+    report("table", (double)rounds * TABLE_KEYS * 4, now() - begin);
+    if (checksum == 0) {
+        fprintf(stderr, "Table benchmark computed nothing\n");
+    }
+    free_vm_state(&vm);
+}
+
+int main(int argc, const char* argv[]) {
+    u32 iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : 10000000;
+    init_heap(64 * 1024 * 1024);
+    printf("sizeof(struct value) = %zu\n", sizeof(struct value));
+    bench_stack(iterations);
+    bench_table(iterations);
+    done_heap();
+    return 0;
+}
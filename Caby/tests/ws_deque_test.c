@@ -0,0 +1,70 @@
+// Unit tests of the work-stealing deque used by the parallel marker.
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "test.h"
+#include "../src/ws_deque.h"
+
+#define OBJ(i) ((struct object*)(uintptr_t)(((i) + 1) * 16))
+
+TEST(OwnerIsLifo) {
+    struct ws_deque q;
+    init_ws_deque(&q);
+    ASSERT_W(ws_take(&q) == NULL);
+    for (int i = 0; i < 3; ++i) {
+        ws_push(&q, OBJ(i));
+    }
+    ASSERT_EQ((int)ws_size(&q), 3);
+    ASSERT_W(ws_take(&q) == OBJ(2));
+    ASSERT_W(ws_take(&q) == OBJ(1));
+    ASSERT_W(ws_take(&q) == OBJ(0));
+    ASSERT_W(ws_take(&q) == NULL);
+    free_ws_deque(&q);
+    return 0;
+}
+
+TEST(ThiefIsFifo) {
+    struct ws_deque q;
+    init_ws_deque(&q);
+    ASSERT_W(ws_steal(&q) == NULL);
+    for (int i = 0; i < 3; ++i) {
+        ws_push(&q, OBJ(i));
+    }
+    ASSERT_W(ws_steal(&q) == OBJ(0));
+    ASSERT_W(ws_take(&q) == OBJ(2));
+    ASSERT_W(ws_steal(&q) == OBJ(1));
+    ASSERT_W(ws_steal(&q) == NULL);
+    ASSERT_W(ws_take(&q) == NULL);
+    free_ws_deque(&q);
+    return 0;
+}
+
+TEST(Growing) {
+    struct ws_deque q;
+    init_ws_deque(&q);
+    // Some objects are stolen first, so the live part wraps around the array.
+    for (int i = 0; i < 100; ++i) {
+        ws_push(&q, OBJ(i));
+    }
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_W(ws_steal(&q) == OBJ(i));
+    }
+    for (int i = 0; i < 5000; ++i) {
+        ws_push(&q, OBJ(i));
+    }
+    ASSERT_EQ((int)ws_size(&q), 5000);
+    ASSERT_W(ws_steal(&q) == OBJ(0));
+    for (int i = 4999; i > 0; --i) {
+        ASSERT_W(ws_take(&q) == OBJ(i));
+    }
+    ASSERT_W(ws_take(&q) == NULL);
+    free_ws_deque(&q);
+    return 0;
+}
+
+int main() {
+    RUN_TEST(OwnerIsLifo);
+    RUN_TEST(ThiefIsFifo);
+    RUN_TEST(Growing);
+    return 0;
+}
@@ -92,16 +92,15 @@ pub enum ExprType {
     Block(Vec<Stmt>, Box<Expr>),
 
     List {
-        size: Box<Expr>,
-        values: Vec<Stmt>,
+        values: Vec<Expr>,
     },
 
     AccessVariable {
         name: String,
     },
     AccessList {
-        list: Box<Stmt>,
-        index: Box<Stmt>,
+        list: Box<Expr>,
+        index: Box<Expr>,
     },
     CallFunction {
         name: String,
@@ -162,11 +161,18 @@ impl Expr {
             ExprType::Bool(val) => println!("Bool: {}", val),
             ExprType::NoneVal => println!("Unit"),
             ExprType::String(val) => println!("String: {}", val),
-            ExprType::List { size, values } => {
-                todo!();
+            ExprType::List { values } => {
+                println!("List:");
+                for value in values {
+                    value.dump(prefix.clone() + " ");
+                }
             }
             ExprType::AccessVariable { name } => println!("AccessVariable: {}\n", name),
-            ExprType::AccessList { list, index } => todo!(),
+            ExprType::AccessList { list, index } => {
+                println!("Index:");
+                list.dump(prefix.clone() + " ");
+                index.dump(prefix + " ");
+            }
             ExprType::CallFunction { name, arguments } => {
                 println!("Call: {}", name);
                 for arg in arguments {
@@ -232,7 +238,12 @@ impl Stmt {
                 value.dump(prefix + " ");
             }
             StmtType::AssignVariable { name, value } => todo!(),
-            StmtType::AssignList { list, index, value } => todo!(),
+            StmtType::AssignList { list, index, value } => {
+                println!("Store index:");
+                list.dump(prefix.clone() + " ");
+                index.dump(prefix.clone() + " ");
+                value.dump(prefix + " ");
+            }
             StmtType::Function {
                 name,
                 parameters,
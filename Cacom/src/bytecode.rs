@@ -45,6 +45,17 @@ pub enum BytecodeType {
 
     NewObject(ConstantPoolIndex),
 
+    /// Pops the values and pushes a list of them, the value
+    /// pushed first is the first item.
+    NewList(u16),
+    /// Pops index and list, pushes the item.
+    GetIndex,
+    /// Pops index, list and value, stores the value into the list.
+    SetIndex,
+    ListLen,
+    /// Pops value and list, appends the value and pushes none.
+    ListAppend,
+
     CallFunc {
         arg_cnt: u8,
     },
@@ -97,6 +108,134 @@ pub enum BytecodeType {
     Drop,
     Dropn(u8),
     Dup,
+
+    // Register machine instructions. Operands are slots of the current
+    // frame, the instructions do not touch the operand stack.
+    RegMove {
+        dst: LocalIndex,
+        src: LocalIndex,
+    },
+    RegLoadInt {
+        dst: LocalIndex,
+        val: i32,
+    },
+    RegLoadBool {
+        dst: LocalIndex,
+        val: bool,
+    },
+    RegLoadNone {
+        dst: LocalIndex,
+    },
+    RegLoadLiteral {
+        dst: LocalIndex,
+        idx: ConstantPoolIndex,
+    },
+    RegGetGlobal {
+        dst: LocalIndex,
+        name: ConstantPoolIndex,
+    },
+    RegSetGlobal {
+        src: LocalIndex,
+        name: ConstantPoolIndex,
+    },
+    RegDeclValGlobal {
+        src: LocalIndex,
+        name: ConstantPoolIndex,
+    },
+    RegDeclVarGlobal {
+        src: LocalIndex,
+        name: ConstantPoolIndex,
+    },
+    /// Binary operator, 'op' can't be negation.
+    RegBinary {
+        op: Opcode,
+        dst: LocalIndex,
+        lhs: LocalIndex,
+        rhs: LocalIndex,
+    },
+    RegNegate {
+        dst: LocalIndex,
+        src: LocalIndex,
+    },
+    RegBranchLabelFalse {
+        cond: LocalIndex,
+        label: String,
+    },
+    RegBranchFalse {
+        cond: LocalIndex,
+        dest: u32,
+    },
+    /// Calls the function in slot 'base' with arguments in the slots
+    /// that follow it, the result is stored into 'base'.
+    RegCall {
+        base: LocalIndex,
+        arg_cnt: u8,
+    },
+    /// Calls method of object in slot 'base', arguments follow it
+    /// (the object itself is counted in 'arg_cnt'), the result is
+    /// stored into 'base'.
+    RegDispatchMethod {
+        base: LocalIndex,
+        name: ConstantPoolIndex,
+        arg_cnt: u8,
+    },
+    /// Format string is in 'base' and the arguments follow it.
+    RegPrint {
+        base: LocalIndex,
+        arg_cnt: u8,
+    },
+    RegRet(LocalIndex),
+    RegNewObject {
+        dst: LocalIndex,
+        class: ConstantPoolIndex,
+    },
+    RegGetMember {
+        dst: LocalIndex,
+        obj: LocalIndex,
+        name: ConstantPoolIndex,
+    },
+    RegSetMember {
+        obj: LocalIndex,
+        val: LocalIndex,
+        name: ConstantPoolIndex,
+    },
+    /// List of the 'cnt' values in the slots from 'base'.
+    RegNewList {
+        dst: LocalIndex,
+        base: LocalIndex,
+        cnt: u16,
+    },
+    RegGetIndex {
+        dst: LocalIndex,
+        list: LocalIndex,
+        index: LocalIndex,
+    },
+    RegSetIndex {
+        list: LocalIndex,
+        index: LocalIndex,
+        val: LocalIndex,
+    },
+    RegListLen {
+        dst: LocalIndex,
+        src: LocalIndex,
+    },
+    /// Appends 'val' to 'list' and stores none into 'dst'.
+    RegListAppend {
+        dst: LocalIndex,
+        list: LocalIndex,
+        val: LocalIndex,
+    },
+}
+
+/// Every bytecode file starts with this string.
+pub const HEADER_MAGIC: &[u8; 4] = b"CAML";
+/// Header flag, the code consists of register instructions.
+pub const HEADER_FLAG_REGISTER: u8 = 0x01;
+
+/// Writes the bytecode file header, it precedes the constant pool.
+pub fn serialize_header(f: &mut File, flags: u8) -> io::Result<()> {
+    f.write_all(HEADER_MAGIC)?;
+    f.write_all(&[flags])
 }
 
 impl From<Opcode> for BytecodeType {
@@ -169,9 +308,75 @@ impl fmt::Display for Bytecode {
             BytecodeType::Dup => write!(f, "Dup"),
             BytecodeType::Neq => write!(f, "Neq"),
             BytecodeType::NewObject(idx) => write!(f, "NewObject: {}", idx),
+            BytecodeType::NewList(cnt) => write!(f, "NewList: {}", cnt),
+            BytecodeType::GetIndex => write!(f, "GetIndex"),
+            BytecodeType::SetIndex => write!(f, "SetIndex"),
+            BytecodeType::ListLen => write!(f, "ListLen"),
+            BytecodeType::ListAppend => write!(f, "ListAppend"),
             BytecodeType::DispatchMethod { name, arg_cnt } => {
                 write!(f, "DispatchMethod: {} {}", name, arg_cnt)
             }
+            BytecodeType::RegMove { dst, src } => write!(f, "Move: r{} r{}", dst, src),
+            BytecodeType::RegLoadInt { dst, val } => write!(f, "Load int: r{} {}", dst, val),
+            BytecodeType::RegLoadBool { dst, val } => write!(f, "Load bool: r{} {}", dst, val),
+            BytecodeType::RegLoadNone { dst } => write!(f, "Load none: r{}", dst),
+            BytecodeType::RegLoadLiteral { dst, idx } => {
+                write!(f, "Load literal: r{} {}", dst, idx)
+            }
+            BytecodeType::RegGetGlobal { dst, name } => {
+                write!(f, "Get global: r{} {}", dst, name)
+            }
+            BytecodeType::RegSetGlobal { src, name } => {
+                write!(f, "Set global: r{} {}", src, name)
+            }
+            BytecodeType::RegDeclValGlobal { src, name } => {
+                write!(f, "decl val global: r{} {}", src, name)
+            }
+            BytecodeType::RegDeclVarGlobal { src, name } => {
+                write!(f, "decl var global: r{} {}", src, name)
+            }
+            BytecodeType::RegBinary { op, dst, lhs, rhs } => {
+                write!(f, "{:?}: r{} r{} r{}", op, dst, lhs, rhs)
+            }
+            BytecodeType::RegNegate { dst, src } => write!(f, "Negate: r{} r{}", dst, src),
+            BytecodeType::RegBranchLabelFalse { cond, label } => {
+                write!(f, "BranchLabelFalse: r{} {}", cond, label)
+            }
+            BytecodeType::RegBranchFalse { cond, dest } => {
+                write!(f, "BranchFalse: r{} {}", cond, dest)
+            }
+            BytecodeType::RegCall { base, arg_cnt } => {
+                write!(f, "Call function: r{}, args: {}", base, arg_cnt)
+            }
+            BytecodeType::RegDispatchMethod {
+                base,
+                name,
+                arg_cnt,
+            } => write!(f, "DispatchMethod: r{} {} {}", base, name, arg_cnt),
+            BytecodeType::RegPrint { base, arg_cnt } => write!(f, "Print r{} {}", base, arg_cnt),
+            BytecodeType::RegRet(src) => write!(f, "Ret r{}", src),
+            BytecodeType::RegNewObject { dst, class } => {
+                write!(f, "NewObject: r{} {}", dst, class)
+            }
+            BytecodeType::RegGetMember { dst, obj, name } => {
+                write!(f, "Get member: r{} r{} {}", dst, obj, name)
+            }
+            BytecodeType::RegSetMember { obj, val, name } => {
+                write!(f, "Set member: r{} r{} {}", obj, val, name)
+            }
+            BytecodeType::RegNewList { dst, base, cnt } => {
+                write!(f, "NewList: r{} r{} {}", dst, base, cnt)
+            }
+            BytecodeType::RegGetIndex { dst, list, index } => {
+                write!(f, "GetIndex: r{} r{} r{}", dst, list, index)
+            }
+            BytecodeType::RegSetIndex { list, index, val } => {
+                write!(f, "SetIndex: r{} r{} r{}", list, index, val)
+            }
+            BytecodeType::RegListLen { dst, src } => write!(f, "ListLen: r{} r{}", dst, src),
+            BytecodeType::RegListAppend { dst, list, val } => {
+                write!(f, "ListAppend: r{} r{} r{}", dst, list, val)
+            }
         }
     }
 }
@@ -205,6 +410,50 @@ impl Code {
             self.add(instruction);
         }
     }
+
+    /// Returns the maximum depth of the operand stack the code can reach,
+    /// the arguments are not counted, they are in the local slots.
+    /// Jumps must be resolved already (see jump_pass).
+    pub fn max_stack_depth(&self) -> u16 {
+        let mut offsets = HashMap::new();
+        let mut offset = 0;
+        for (i, ins) in self.code.iter().enumerate() {
+            offsets.insert(offset, i);
+            offset += ins.size();
+        }
+        let target = |dest: u32| {
+            *offsets
+                .get(&(dest as usize))
+                .expect("Jump into instruction")
+        };
+
+        let mut depths: Vec<Option<usize>> = vec![None; self.code.len()];
+        let mut worklist = vec![(0, 0)];
+        let mut max = 0;
+        while let Some((i, depth)) = worklist.pop() {
+            if i >= self.code.len() || depths[i].is_some() {
+                continue;
+            }
+            depths[i] = Some(depth);
+            let ins = &self.code[i].instr;
+            let (pops, pushes) = ins.stack_effect();
+            let depth = depth + pushes - pops.min(depth);
+            max = max.max(depth);
+            match ins {
+                BytecodeType::Ret | BytecodeType::RegRet(_) => {}
+                BytecodeType::Jmp(dest) => worklist.push((target(*dest), depth)),
+                BytecodeType::Branch(dest)
+                | BytecodeType::BranchFalse(dest)
+                | BytecodeType::RegBranchFalse { dest, .. } => {
+                    worklist.push((target(*dest), depth));
+                    worklist.push((i + 1, depth));
+                }
+                _ => worklist.push((i + 1, depth)),
+            }
+        }
+        max.try_into()
+            .expect("Operand stack of a function can have at most 2^16 values")
+    }
 }
 
 impl Serializable for Code {
@@ -223,6 +472,65 @@ impl Serializable for Code {
     }
 }
 
+impl BytecodeType {
+    /// Returns how many values the instruction pops from the operand stack
+    /// and how many it pushes. Called functions take their arguments
+    /// from the stack and leave the result there.
+    fn stack_effect(&self) -> (usize, usize) {
+        match self {
+            BytecodeType::PushShort(_)
+            | BytecodeType::PushInt(_)
+            | BytecodeType::PushLong(_)
+            | BytecodeType::PushBool(_)
+            | BytecodeType::PushLiteral(_)
+            | BytecodeType::PushNone
+            | BytecodeType::GetLocal(_)
+            | BytecodeType::GetGlobal(_)
+            | BytecodeType::NewObject(_) => (0, 1),
+            BytecodeType::SetLocal(_)
+            | BytecodeType::DeclValGlobal { .. }
+            | BytecodeType::DeclVarGlobal { .. }
+            | BytecodeType::SetGlobal(_)
+            | BytecodeType::Drop => (1, 0),
+            BytecodeType::GetMember(_) | BytecodeType::Ineg | BytecodeType::ListLen => (1, 1),
+            BytecodeType::SetMember(_) => (2, 0),
+            BytecodeType::NewList(cnt) => (*cnt as usize, 1),
+            BytecodeType::GetIndex | BytecodeType::ListAppend => (2, 1),
+            BytecodeType::SetIndex => (3, 0),
+            BytecodeType::Dup => (1, 2),
+            BytecodeType::Dropn(n) => (*n as usize, 0),
+            // The function itself is popped too
+            BytecodeType::CallFunc { arg_cnt } => (*arg_cnt as usize + 1, 1),
+            BytecodeType::DispatchMethod { arg_cnt, .. } | BytecodeType::Print { arg_cnt } => {
+                (*arg_cnt as usize, 1)
+            }
+            BytecodeType::BranchLabel(_)
+            | BytecodeType::BranchLabelFalse(_)
+            | BytecodeType::BranchShort(_)
+            | BytecodeType::Branch(_)
+            | BytecodeType::BranchLong(_)
+            | BytecodeType::BranchShortFalse(_)
+            | BytecodeType::BranchFalse(_)
+            | BytecodeType::BranchLongFalse(_) => (1, 0),
+            BytecodeType::Iadd
+            | BytecodeType::Isub
+            | BytecodeType::Imul
+            | BytecodeType::Mod
+            | BytecodeType::Idiv
+            | BytecodeType::Iand
+            | BytecodeType::Ior
+            | BytecodeType::Iless
+            | BytecodeType::Ilesseq
+            | BytecodeType::Igreater
+            | BytecodeType::Igreatereq
+            | BytecodeType::Ieq
+            | BytecodeType::Neq => (2, 1),
+            // Jumps, labels, return and the register instructions
+            _ => (0, 0),
+        }
+    }
+}
+
 impl Bytecode {
     fn byte_encode(&self) -> u8 {
         match &self.instr {
@@ -282,6 +590,53 @@ impl Bytecode {
             BytecodeType::GetMember(_) => 0x61,
             BytecodeType::SetMember(_) => 0x62,
             BytecodeType::DispatchMethod { .. } => 0x63,
+            BytecodeType::NewList(_) => 0x64,
+            BytecodeType::GetIndex => 0x65,
+            BytecodeType::SetIndex => 0x66,
+            BytecodeType::ListLen => 0x67,
+            BytecodeType::ListAppend => 0x68,
+
+            BytecodeType::RegMove { .. } => 0x80,
+            BytecodeType::RegLoadInt { .. } => 0x81,
+            BytecodeType::RegLoadBool { .. } => 0x82,
+            BytecodeType::RegLoadNone { .. } => 0x83,
+            BytecodeType::RegLoadLiteral { .. } => 0x84,
+            BytecodeType::RegGetGlobal { .. } => 0x85,
+            BytecodeType::RegSetGlobal { .. } => 0x86,
+            BytecodeType::RegDeclValGlobal { .. } => 0x87,
+            BytecodeType::RegDeclVarGlobal { .. } => 0x88,
+            BytecodeType::RegBranchLabelFalse { .. } => {
+                panic!("Label jumps are not meant to exist in final bytecode!")
+            }
+            BytecodeType::RegBranchFalse { .. } => 0x8E,
+            // Same order as the stack variants, offset by 0x60
+            BytecodeType::RegBinary { op, .. } => match op {
+                Opcode::Add => 0x90,
+                Opcode::Sub => 0x91,
+                Opcode::Mul => 0x92,
+                Opcode::Div => 0x93,
+                Opcode::Mod => 0x94,
+                Opcode::Less => 0x97,
+                Opcode::LessEq => 0x98,
+                Opcode::Greater => 0x99,
+                Opcode::GreaterEq => 0x9A,
+                Opcode::Eq => 0x9B,
+                Opcode::Neq => 0x9D,
+                Opcode::Negate => panic!("Negation is not a binary operator"),
+            },
+            BytecodeType::RegNegate { .. } => 0x9C,
+            BytecodeType::RegCall { .. } => 0xA0,
+            BytecodeType::RegDispatchMethod { .. } => 0xA1,
+            BytecodeType::RegPrint { .. } => 0xA2,
+            BytecodeType::RegRet(_) => 0xA3,
+            BytecodeType::RegNewObject { .. } => 0xA4,
+            BytecodeType::RegGetMember { .. } => 0xA5,
+            BytecodeType::RegSetMember { .. } => 0xA6,
+            BytecodeType::RegNewList { .. } => 0xA7,
+            BytecodeType::RegGetIndex { .. } => 0xA8,
+            BytecodeType::RegSetIndex { .. } => 0xA9,
+            BytecodeType::RegListLen { .. } => 0xAA,
+            BytecodeType::RegListAppend { .. } => 0xAB,
         }
     }
 
@@ -352,6 +707,36 @@ impl Bytecode {
             BytecodeType::SetMember(_) => 4,
             BytecodeType::NewObject(_) => 4,
             BytecodeType::DispatchMethod { .. } => 5,
+            BytecodeType::NewList(cnt) => std::mem::size_of_val(cnt),
+            BytecodeType::GetIndex => 0,
+            BytecodeType::SetIndex => 0,
+            BytecodeType::ListLen => 0,
+            BytecodeType::ListAppend => 0,
+            BytecodeType::RegMove { .. } => 4,
+            BytecodeType::RegLoadInt { .. } => 6,
+            BytecodeType::RegLoadBool { .. } => 3,
+            BytecodeType::RegLoadNone { .. } => 2,
+            BytecodeType::RegLoadLiteral { .. } => 6,
+            BytecodeType::RegGetGlobal { .. } => 6,
+            BytecodeType::RegSetGlobal { .. } => 6,
+            BytecodeType::RegDeclValGlobal { .. } => 6,
+            BytecodeType::RegDeclVarGlobal { .. } => 6,
+            BytecodeType::RegBinary { .. } => 6,
+            BytecodeType::RegNegate { .. } => 4,
+            BytecodeType::RegBranchLabelFalse { .. } => 6,
+            BytecodeType::RegBranchFalse { .. } => 6,
+            BytecodeType::RegCall { .. } => 3,
+            BytecodeType::RegDispatchMethod { .. } => 7,
+            BytecodeType::RegPrint { .. } => 3,
+            BytecodeType::RegRet(_) => 2,
+            BytecodeType::RegNewObject { .. } => 6,
+            BytecodeType::RegGetMember { .. } => 8,
+            BytecodeType::RegSetMember { .. } => 8,
+            BytecodeType::RegNewList { .. } => 6,
+            BytecodeType::RegGetIndex { .. } => 6,
+            BytecodeType::RegSetIndex { .. } => 6,
+            BytecodeType::RegListLen { .. } => 4,
+            BytecodeType::RegListAppend { .. } => 6,
         }
     }
 }
@@ -416,10 +801,98 @@ impl Serializable for Bytecode {
             BytecodeType::GetMember(idx) => f.write_all(&idx.to_le_bytes())?,
             BytecodeType::SetMember(idx) => f.write_all(&idx.to_le_bytes())?,
             BytecodeType::NewObject(idx) => f.write_all(&idx.to_le_bytes())?,
+            BytecodeType::NewList(cnt) => f.write_all(&cnt.to_le_bytes())?,
+            BytecodeType::GetIndex => {}
+            BytecodeType::SetIndex => {}
+            BytecodeType::ListLen => {}
+            BytecodeType::ListAppend => {}
             BytecodeType::DispatchMethod { name, arg_cnt } => {
                 f.write_all(&name.to_le_bytes())?;
                 f.write_all(&arg_cnt.to_le_bytes())?;
             }
+            BytecodeType::RegMove { dst, src }
+            | BytecodeType::RegNegate { dst, src }
+            | BytecodeType::RegListLen { dst, src } => {
+                f.write_all(&dst.to_le_bytes())?;
+                f.write_all(&src.to_le_bytes())?;
+            }
+            BytecodeType::RegLoadInt { dst, val } => {
+                f.write_all(&dst.to_le_bytes())?;
+                f.write_all(&val.to_le_bytes())?;
+            }
+            BytecodeType::RegLoadBool { dst, val } => {
+                f.write_all(&dst.to_le_bytes())?;
+                f.write_all(&[*val as u8])?;
+            }
+            BytecodeType::RegLoadNone { dst } => f.write_all(&dst.to_le_bytes())?,
+            BytecodeType::RegLoadLiteral { dst, idx: name }
+            | BytecodeType::RegGetGlobal { dst, name }
+            | BytecodeType::RegNewObject { dst, class: name } => {
+                f.write_all(&dst.to_le_bytes())?;
+                f.write_all(&name.to_le_bytes())?;
+            }
+            BytecodeType::RegSetGlobal { src, name }
+            | BytecodeType::RegDeclValGlobal { src, name }
+            | BytecodeType::RegDeclVarGlobal { src, name } => {
+                f.write_all(&src.to_le_bytes())?;
+                f.write_all(&name.to_le_bytes())?;
+            }
+            BytecodeType::RegBinary { dst, lhs, rhs, .. }
+            | BytecodeType::RegNewList {
+                dst,
+                base: lhs,
+                cnt: rhs,
+            }
+            | BytecodeType::RegGetIndex {
+                dst,
+                list: lhs,
+                index: rhs,
+            }
+            | BytecodeType::RegSetIndex {
+                list: dst,
+                index: lhs,
+                val: rhs,
+            }
+            | BytecodeType::RegListAppend {
+                dst,
+                list: lhs,
+                val: rhs,
+            } => {
+                f.write_all(&dst.to_le_bytes())?;
+                f.write_all(&lhs.to_le_bytes())?;
+                f.write_all(&rhs.to_le_bytes())?;
+            }
+            BytecodeType::RegBranchLabelFalse { .. } => {
+                panic!("Jump labels are not meant to exist in final bytecode")
+            }
+            BytecodeType::RegBranchFalse { cond, dest } => {
+                f.write_all(&cond.to_le_bytes())?;
+                f.write_all(&dest.to_le_bytes())?;
+            }
+            BytecodeType::RegCall { base, arg_cnt } | BytecodeType::RegPrint { base, arg_cnt } => {
+                f.write_all(&base.to_le_bytes())?;
+                f.write_all(&arg_cnt.to_le_bytes())?;
+            }
+            BytecodeType::RegDispatchMethod {
+                base,
+                name,
+                arg_cnt,
+            } => {
+                f.write_all(&base.to_le_bytes())?;
+                f.write_all(&name.to_le_bytes())?;
+                f.write_all(&arg_cnt.to_le_bytes())?;
+            }
+            BytecodeType::RegRet(src) => f.write_all(&src.to_le_bytes())?,
+            BytecodeType::RegGetMember { dst, obj, name } => {
+                f.write_all(&dst.to_le_bytes())?;
+                f.write_all(&obj.to_le_bytes())?;
+                f.write_all(&name.to_le_bytes())?;
+            }
+            BytecodeType::RegSetMember { obj, val, name } => {
+                f.write_all(&obj.to_le_bytes())?;
+                f.write_all(&val.to_le_bytes())?;
+                f.write_all(&name.to_le_bytes())?;
+            }
         };
         self.location.serialize(f)
     }
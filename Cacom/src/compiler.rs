@@ -6,23 +6,24 @@ use lalrpop_util::state_machine;
 use crate::ast::{Expr, ExprType, Opcode, Stmt, StmtType};
 use crate::bytecode::{Bytecode, BytecodeType, Code, ConstantPoolIndex, LocalIndex};
 use crate::objects::{ConstantPool, Function, Object};
+use crate::register_compiler::RegisterCompiler;
 use crate::utils::Location as CodeLocation;
 use crate::utils::{AtomicInt, LabelGenerator};
 
 #[derive(Clone, Copy)]
-struct Local {
-    idx: LocalIndex,
-    mutable: bool,
+pub struct Local {
+    pub idx: LocalIndex,
+    pub mutable: bool,
 }
 
 /// Environment keeps track of indexes of local variables into memory.
 /// It consists of multiple environments, each one is a map from
 /// name to index of the local variable.
-struct Environment {
-    envs: Vec<HashMap<String, Local>>,
+pub struct Environment {
+    pub envs: Vec<HashMap<String, Local>>,
 }
 
-enum Location {
+pub enum Location {
     Global,
     Local(Environment),
     Class(Environment),
@@ -182,7 +183,16 @@ impl Compiler {
                 self.compile_expr(expr, code, false)?;
                 self.leave_scope();
             }
-            ExprType::List { size, values } => todo!(),
+            ExprType::List { values } => {
+                for value in values {
+                    self.compile_expr(value, code, false)?;
+                }
+                let cnt = values
+                    .len()
+                    .try_into()
+                    .map_err(|_| "List literal can have at most 2^16 values.")?;
+                self.add_instruction(code, BytecodeType::NewList(cnt), expr.location);
+            }
             ExprType::AccessVariable { name } => {
                 // TODO: some repeated code
                 match &mut self.location {
@@ -204,7 +214,23 @@ impl Compiler {
                     }
                 }
             }
-            ExprType::AccessList { list, index } => todo!(),
+            ExprType::AccessList { list, index } => {
+                self.compile_expr(list, code, false)?;
+                self.compile_expr(index, code, false)?;
+                self.add_instruction(code, BytecodeType::GetIndex, expr.location);
+            }
+            ExprType::CallFunction { name, arguments } if builtin_arity(name).is_some() => {
+                check_builtin_arity(name, arguments.len())?;
+                for arg in arguments {
+                    self.compile_expr(arg, code, false)?;
+                }
+                let instr = if name == "len" {
+                    BytecodeType::ListLen
+                } else {
+                    BytecodeType::ListAppend
+                };
+                self.add_instruction(code, instr, expr.location);
+            }
             ExprType::CallFunction { name, arguments } => {
                 for arg in arguments.iter().rev() {
                     self.compile_expr(arg, code, false)?;
@@ -341,6 +367,7 @@ impl Compiler {
                 mutable,
                 value,
             } => {
+                check_not_builtin(name)?;
                 self.compile_expr(value, code, false)?;
                 match &mut self.location {
                     Location::Global => {
@@ -373,6 +400,7 @@ impl Compiler {
                 }
             }
             StmtType::AssignVariable { name, value } => {
+                check_not_builtin(name)?;
                 self.compile_expr(value, code, false)?;
                 // TODO: Repeated code!
                 if let Location::Local(env) = &mut self.location {
@@ -390,12 +418,18 @@ impl Compiler {
                     self.add_instruction(code, BytecodeType::SetGlobal(idx), value.location);
                 }
             }
-            StmtType::AssignList { list, index, value } => todo!(),
+            StmtType::AssignList { list, index, value } => {
+                self.compile_expr(value, code, false)?;
+                self.compile_expr(list, code, false)?;
+                self.compile_expr(index, code, false)?;
+                self.add_instruction(code, BytecodeType::SetIndex, ast.location);
+            }
             StmtType::Function {
                 name,
                 parameters,
                 body,
             } => {
+                check_not_builtin(name)?;
                 let locals_backup = self.reset_locals();
                 let new_fun_name_idx = self.constant_pool.add(Object::from(name.clone()));
                 let fun = self.compile_fun(new_fun_name_idx, parameters, body)?;
@@ -409,6 +443,7 @@ impl Compiler {
             StmtType::Return(_) => todo!(),
             StmtType::Expression(expr) => self.compile_expr(expr, code, true)?,
             StmtType::Class { name, statements } => {
+                check_not_builtin(name)?;
                 let name_idx = self.constant_pool.add(Object::from(name.clone()));
 
                 let mut methods: Vec<ConstantPoolIndex> = vec![];
@@ -428,29 +463,10 @@ impl Compiler {
                             let name_idx = self.constant_pool.add(Object::from(name.clone()));
                             if name == "init" {
                                 constructor_args = Some(parameters.len().try_into().unwrap());
-                                if let ExprType::Block(body, ret) = &body.node {
-                                    if let ExprType::NoneVal = ret.node {
-                                        let modified = body.clone();
-                                        let self_returned = Box::new(Expr {
-                                            node: ExprType::AccessVariable {
-                                                name: String::from("self"),
-                                            },
-                                            location: CodeLocation(0, 0),
-                                        });
-                                        let body = Expr {
-                                            node: ExprType::Block(modified, self_returned),
-                                            location: CodeLocation(0, 0),
-                                        };
-                                        let cons = self.compile_fun(name_idx, parameters, &body)?;
-                                        let cons_idx =
-                                            self.constant_pool.add(Object::Function(cons));
-                                        methods.push(cons_idx);
-                                    } else {
-                                        return Err("Constructor must always return none.");
-                                    }
-                                } else {
-                                    return Err("Constructor body must always be a block.");
-                                }
+                                let body = constructor_body(body)?;
+                                let cons = self.compile_fun(name_idx, parameters, &body)?;
+                                let cons_idx = self.constant_pool.add(Object::Function(cons));
+                                methods.push(cons_idx);
                             } else {
                                 let method = self.compile_fun(name_idx, parameters, body)?;
                                 let method_idx = self.constant_pool.add(Object::Function(method));
@@ -494,12 +510,15 @@ impl Compiler {
                 // through the constructor, since the calling program will push them,
                 // the free constructor function will not touch them and the real
                 // constructor will use them.
-                // The proxy constructor will just push the object onto the stack.
+                // The proxy constructor will just push the object onto the stack,
+                // right after its locals (the arguments), so it ends up as the
+                // last argument of 'init'.
+                // minus one because this free function doesn't expect self.
+                let parameters_cnt = constructor_args.unwrap_or(1) - 1;
                 let cons_fun = Function {
                     name: name_idx,
-                    // minus one because this free function doesn't expect self.
-                    parameters_cnt: constructor_args.unwrap_or(1) - 1,
-                    locals_cnt: 0,
+                    parameters_cnt,
+                    locals_cnt: parameters_cnt as LocalIndex,
                     body: constructor,
                 };
                 let constructor_idx = Some(self.constant_pool.add(Object::Function(cons_fun)));
@@ -517,24 +536,20 @@ impl Compiler {
         Ok(())
     }
 
-    fn compile_parameters(
-        &mut self,
-        code: &mut Code,
-        parameters: &[String],
-        location: CodeLocation,
-    ) -> Result<(), &'static str> {
+    /// The arguments stay on the operand stack where the caller pushed them
+    /// and become the first local slots of the function. They are pushed from
+    /// the last one, so the first parameter is in the last of these slots.
+    fn compile_parameters(&mut self, parameters: &[String]) -> Result<(), &'static str> {
+        let cnt: LocalIndex = parameters.len().try_into().unwrap();
         for (idx, par) in parameters.iter().enumerate() {
+            check_not_builtin(par)?;
             // Since we just added scope it will always be local
             if let Location::Local(env) = &mut self.location {
-                env.add_local(par.clone(), self.local_count, false)?;
-                self.add_instruction(
-                    code,
-                    BytecodeType::SetLocal(idx.try_into().unwrap()),
-                    location,
-                );
-                self.add_locals(1);
+                let slot = self.local_count + cnt - 1 - idx as LocalIndex;
+                env.add_local(par.clone(), slot, false)?;
             }
         }
+        self.add_locals(cnt);
         Ok(())
     }
 
@@ -550,7 +565,7 @@ impl Compiler {
         // the indexes won't match).
         self.enter_scope();
         let mut code = Code::new();
-        self.compile_parameters(&mut code, parameters, body.location)?;
+        self.compile_parameters(parameters)?;
         self.compile_expr(body, &mut code, false)?;
         if code.code.is_empty() {
             self.add_instruction(&mut code, BytecodeType::PushNone, body.location);
@@ -570,7 +585,7 @@ impl Compiler {
     }
 }
 
-fn check_operator_arity(op: &Opcode, len: usize) -> Result<(), &'static str> {
+pub fn check_operator_arity(op: &Opcode, len: usize) -> Result<(), &'static str> {
     let arity = match op {
         Opcode::Add => 2,
         Opcode::Sub => 2,
@@ -592,6 +607,57 @@ fn check_operator_arity(op: &Opcode, len: usize) -> Result<(), &'static str> {
     }
 }
 
+/// Returns the number of arguments of a builtin function, these are
+/// compiled into instructions instead of calls. Returns None if 'name'
+/// is not a builtin.
+pub fn builtin_arity(name: &str) -> Option<usize> {
+    match name {
+        "len" => Some(1),
+        "append" => Some(2),
+        _ => None,
+    }
+}
+
+pub fn check_builtin_arity(name: &str, len: usize) -> Result<(), &'static str> {
+    if builtin_arity(name) != Some(len) {
+        Err("Builtin function arity does not match.")
+    } else {
+        Ok(())
+    }
+}
+
+/// Calls of builtins are compiled by name, so a variable, function, parameter
+/// or class with the same name could never be called.
+pub fn check_not_builtin(name: &str) -> Result<(), &'static str> {
+    if builtin_arity(name).is_some() {
+        Err("Builtin functions can not be redefined.")
+    } else {
+        Ok(())
+    }
+}
+
+/// Wraps body of the 'init' method so that it returns 'self'.
+pub fn constructor_body(body: &Expr) -> Result<Expr, &'static str> {
+    if let ExprType::Block(body, ret) = &body.node {
+        if let ExprType::NoneVal = ret.node {
+            let self_returned = Box::new(Expr {
+                node: ExprType::AccessVariable {
+                    name: String::from("self"),
+                },
+                location: CodeLocation(0, 0),
+            });
+            Ok(Expr {
+                node: ExprType::Block(body.clone(), self_returned),
+                location: CodeLocation(0, 0),
+            })
+        } else {
+            Err("Constructor must always return none.")
+        }
+    } else {
+        Err("Constructor body must always be a block.")
+    }
+}
+
 /// Removes jumps to labels and replaces them with offset jumps
 /// TODO: Currently, the computed offset takes all jump instructions
 /// as 4B, this is not necessarily true if we use short and long jmps.
@@ -630,6 +696,13 @@ fn jump_pass(code: Vec<Bytecode>) -> Vec<Bytecode> {
                     let label_index = *labels.get(&label).unwrap();
                     BytecodeType::BranchFalse(label_index.try_into().unwrap())
                 }
+                BytecodeType::RegBranchLabelFalse { cond, label } => {
+                    let label_index = *labels.get(&label).unwrap();
+                    BytecodeType::RegBranchFalse {
+                        cond,
+                        dest: label_index.try_into().unwrap(),
+                    }
+                }
                 _ => ins.instr,
             };
             Bytecode {
@@ -640,8 +713,48 @@ fn jump_pass(code: Vec<Bytecode>) -> Vec<Bytecode> {
         .collect()
 }
 
+/// Instruction set the program is compiled into.
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub enum Backend {
+    Stack,
+    Register,
+}
+
 /// Compiles StmtType into constant pool and returns tuple (constant pool, entry point, globals)
-pub fn compile(ast: &Stmt) -> Result<(ConstantPool, ConstantPoolIndex), &'static str> {
+pub fn compile(
+    ast: &Stmt,
+    backend: Backend,
+) -> Result<(ConstantPool, ConstantPoolIndex), &'static str> {
+    let (mut constant_pool, main_fun_idx) = match backend {
+        Backend::Stack => compile_stack(ast)?,
+        Backend::Register => RegisterCompiler::compile_program(ast)?,
+    };
+    // TODO: Consider rewritting this into some prettier form
+    constant_pool.data = constant_pool
+        .data
+        .into_iter()
+        .map(|f| match f {
+            Object::Function(Function {
+                body,
+                name,
+                parameters_cnt,
+                locals_cnt,
+            }) => Object::Function(Function {
+                body: Code {
+                    code: jump_pass(body.code),
+                },
+                name,
+                parameters_cnt,
+                locals_cnt,
+            }),
+            _ => f,
+        })
+        .collect();
+
+    Ok((constant_pool, main_fun_idx))
+}
+
+fn compile_stack(ast: &Stmt) -> Result<(ConstantPool, ConstantPoolIndex), &'static str> {
     let mut compiler = Compiler::new();
     let idx = compiler
         .constant_pool
@@ -664,28 +777,5 @@ pub fn compile(ast: &Stmt) -> Result<(ConstantPool, ConstantPoolIndex), &'static
         body: code,
     });
     let main_fun_idx = compiler.constant_pool.add(main_fun);
-    // TODO: Consider rewritting this into some prettier form
-    compiler.constant_pool.data = compiler
-        .constant_pool
-        .data
-        .into_iter()
-        .map(|f| match f {
-            Object::Function(Function {
-                body,
-                name,
-                parameters_cnt,
-                locals_cnt,
-            }) => Object::Function(Function {
-                body: Code {
-                    code: jump_pass(body.code),
-                },
-                name,
-                parameters_cnt,
-                locals_cnt,
-            }),
-            _ => f,
-        })
-        .collect();
-
     Ok((compiler.constant_pool, main_fun_idx))
 }
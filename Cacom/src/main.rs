@@ -6,9 +6,10 @@ extern crate clap;
 use std::fs;
 use std::io::Write;
 
-use clap::{App, Arg, Command, SubCommand};
+use clap::{App, Arg, ArgMatches, Command, SubCommand};
 
-use crate::compiler::compile;
+use crate::bytecode::{serialize_header, HEADER_FLAG_REGISTER};
+use crate::compiler::{compile, Backend};
 use crate::grammar::TopLevelParser;
 use crate::serializable::Serializable;
 
@@ -21,6 +22,7 @@ mod ast;
 mod bytecode;
 mod compiler;
 mod objects;
+mod register_compiler;
 mod serializable;
 mod tests;
 mod utils;
@@ -33,6 +35,11 @@ fn cli() -> Command<'static> {
         .value_name("INPUT-FILE")
         .help("Camel source code");
 
+    let register = Arg::new("register")
+        .long("register")
+        .takes_value(false)
+        .help("Compile into register machine instructions instead of stack ones");
+
     // TODO: input file should probably not be passed like that.
     let matches = App::new("Cacom")
             .subcommand_required(true)
@@ -42,6 +49,7 @@ fn cli() -> Command<'static> {
             .subcommand(SubCommand::with_name("compile")
                 .about("Compile the source file into Caby bytecode")
                 .arg(input_file.clone())
+                .arg(register.clone())
                 .arg(Arg::new("output-file")
                     .short('o')
                     .long("output-file")
@@ -51,11 +59,12 @@ fn cli() -> Command<'static> {
                     .help("The Caby bytecode output file")))
             .subcommand(SubCommand::with_name("export")
                 .about("Compile camel source to bytecode and print it to standard output in human readable format")
-                .arg(input_file.clone()));
+                .arg(input_file.clone())
+                .arg(register));
     matches
 }
 
-fn compile_action(input_file: &String, output_file: &String) {
+fn compile_action(input_file: &String, output_file: &String, backend: Backend) {
     let f = fs::read_to_string(input_file).expect("Couldn't read file");
     let mut out_f = fs::File::create(output_file).expect("Cannot open output file");
 
@@ -63,8 +72,13 @@ fn compile_action(input_file: &String, output_file: &String) {
         .parse(&f)
         .expect("Unable to parse file");
 
-    let (constant_pool, entry_point) = compile(&ast).expect("Compilation error");
+    let (constant_pool, entry_point) = compile(&ast, backend).expect("Compilation error");
 
+    let flags = match backend {
+        Backend::Stack => 0,
+        Backend::Register => HEADER_FLAG_REGISTER,
+    };
+    serialize_header(&mut out_f, flags).expect("Unable to write to output file");
     constant_pool
         .serialize(&mut out_f)
         .expect("Unable to write to output file");
@@ -84,7 +98,7 @@ fn dump_action(input_file: &String) {
     ast.dump(String::from(""));
 }
 
-fn export_action(input_file: &String) {
+fn export_action(input_file: &String, backend: Backend) {
     let f = fs::read_to_string(input_file)
         .unwrap_or_else(|_| panic!("Couldn't read file at '{}'", input_file));
 
@@ -92,12 +106,20 @@ fn export_action(input_file: &String) {
         .parse(&f)
         .expect("Unable to parse file");
 
-    let (constant_pool, entry_point) = compile(&ast).expect("Compilation error");
+    let (constant_pool, entry_point) = compile(&ast, backend).expect("Compilation error");
     println!("=== ConstantPool ===");
     println!("{}", constant_pool);
     println!("=== Entry point: {} ===", entry_point);
 }
 
+fn backend(matches: &ArgMatches) -> Backend {
+    if matches.contains_id("register") {
+        Backend::Register
+    } else {
+        Backend::Stack
+    }
+}
+
 fn main() {
     let matches = cli().get_matches();
 
@@ -109,11 +131,11 @@ fn main() {
         Some(("compile", sub_matches)) => {
             let input_file = sub_matches.get_one::<String>("input-file").unwrap();
             let output_file = sub_matches.get_one::<String>("output-file").unwrap();
-            compile_action(input_file, output_file);
+            compile_action(input_file, output_file, backend(sub_matches));
         }
         Some(("export", sub_matches)) => {
             let input_file = sub_matches.get_one::<String>("input-file").unwrap();
-            export_action(input_file);
+            export_action(input_file, backend(sub_matches));
         }
         Some((name, _)) => {
             unreachable!("Unsupported subcommand '{}'", name)
@@ -139,6 +139,8 @@ impl Serializable for Function {
         f.write_all(&self.name.to_le_bytes())?;
         f.write_all(&self.parameters_cnt.to_le_bytes())?;
         f.write_all(&self.locals_cnt.to_le_bytes())?;
+        let stack_size = self.body.max_stack_depth();
+        f.write_all(&stack_size.to_le_bytes())?;
         self.body.serialize(f)
     }
 }
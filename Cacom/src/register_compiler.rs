@@ -0,0 +1,729 @@
+use crate::ast::{Expr, ExprType, Opcode, Stmt, StmtType};
+use crate::bytecode::{Bytecode, BytecodeType, Code, ConstantPoolIndex, LocalIndex};
+use crate::compiler::{
+    builtin_arity, check_builtin_arity, check_not_builtin, check_operator_arity, constructor_body,
+    Environment, Local, Location,
+};
+use crate::objects::{ConstantPool, Function, Object};
+use crate::utils::LabelGenerator;
+use crate::utils::Location as CodeLocation;
+
+/// Index of a slot in the function frame.
+type Reg = LocalIndex;
+
+/// Compiles the AST into register machine instructions.
+///
+/// Every function frame is an array of slots (registers). Parameters
+/// occupy the first slots, local variables and temporaries are allocated
+/// after them in stack-like fashion, a temporary lives until the enclosing
+/// expression is done and local variable until its scope ends.
+///
+/// Calls use consecutive slots, the function (or the object for methods)
+/// is in the base slot and arguments follow it. Callee frame starts at
+/// the first argument (at the object for methods), so arguments are
+/// passed without copying. The result is stored into the base slot.
+pub struct RegisterCompiler {
+    constant_pool: ConstantPool,
+    location: Location,
+    label_generator: LabelGenerator,
+    /// First free slot of the current function.
+    next_reg: Reg,
+    /// Number of slots needed by the current function.
+    reg_max: Reg,
+    /// Value of 'next_reg' when the scopes were entered.
+    scope_marks: Vec<Reg>,
+}
+
+impl RegisterCompiler {
+    fn new() -> Self {
+        Self {
+            constant_pool: ConstantPool::new(),
+            location: Location::Global,
+            label_generator: LabelGenerator::new(),
+            next_reg: 0,
+            reg_max: 0,
+            scope_marks: vec![],
+        }
+    }
+
+    /// Compiles the program and returns the constant pool and index of
+    /// the entry point function.
+    pub fn compile_program(ast: &Stmt) -> Result<(ConstantPool, ConstantPoolIndex), &'static str> {
+        let mut compiler = Self::new();
+        let idx = compiler
+            .constant_pool
+            .add(Object::from(String::from("#main")));
+        let mut code = Code::new();
+
+        match ast.node {
+            StmtType::Top(_) => {
+                compiler.compile_stmt(ast, &mut code)?;
+                let ret = compiler.alloc()?;
+                compiler.add_instruction(
+                    &mut code,
+                    BytecodeType::RegLoadNone { dst: ret },
+                    ast.location,
+                );
+                compiler.add_instruction(&mut code, BytecodeType::RegRet(ret), ast.location);
+            }
+            _ => unreachable!(),
+        }
+
+        let main_fun = Object::Function(Function {
+            name: idx,
+            parameters_cnt: 0,
+            locals_cnt: compiler.reg_max,
+            body: code,
+        });
+        let main_fun_idx = compiler.constant_pool.add(main_fun);
+        Ok((compiler.constant_pool, main_fun_idx))
+    }
+
+    fn add_instruction(&mut self, code: &mut Code, instr: BytecodeType, location: CodeLocation) {
+        code.add(Bytecode { instr, location });
+    }
+
+    /// Allocates new slot on top of the used ones.
+    fn alloc(&mut self) -> Result<Reg, &'static str> {
+        let reg = self.next_reg;
+        self.next_reg = self
+            .next_reg
+            .checked_add(1)
+            .ok_or("Function needs too many registers")?;
+        self.reg_max = std::cmp::max(self.reg_max, self.next_reg);
+        Ok(reg)
+    }
+
+    /// Frees all slots from 'mark' upwards.
+    fn free_to(&mut self, mark: Reg) {
+        self.next_reg = mark;
+    }
+
+    /// Returns 'dst' if it is given, otherwise allocates new slot.
+    fn target(&mut self, dst: Option<Reg>) -> Result<Reg, &'static str> {
+        match dst {
+            Some(reg) => Ok(reg),
+            None => self.alloc(),
+        }
+    }
+
+    fn enter_scope(&mut self) {
+        self.scope_marks.push(self.next_reg);
+        match &mut self.location {
+            Location::Global => {
+                self.location = Location::Local(Environment::new());
+            }
+            Location::Local(env) | Location::Class(env) => {
+                env.enter_scope();
+            }
+        };
+    }
+
+    fn leave_scope(&mut self) {
+        let mark = self
+            .scope_marks
+            .pop()
+            .expect("Internal compiler error: Can't leave scope at global environment");
+        self.free_to(mark);
+        match &mut self.location {
+            Location::Global => {
+                unreachable!("Internal compiler error: Can't leave scope at global environment");
+            }
+            Location::Local(env) => {
+                env.leave_scope();
+                if env.envs.is_empty() {
+                    self.location = Location::Global;
+                }
+            }
+            Location::Class(env) => {
+                env.leave_scope();
+            }
+        };
+    }
+
+    fn fetch_local(&self, name: &String) -> Option<Local> {
+        match &self.location {
+            Location::Global => None,
+            Location::Local(env) | Location::Class(env) => env.fetch_local(name),
+        }
+    }
+
+    /// Compiles expression 'expr' and returns the slot with the result. If 'dst' is
+    /// given the result is always stored there, otherwise the expression can return
+    /// slot of the local variable or allocate new temporary.
+    fn compile_expr(
+        &mut self,
+        expr: &Expr,
+        dst: Option<Reg>,
+        code: &mut Code,
+    ) -> Result<Reg, &'static str> {
+        let location = expr.location;
+        match &expr.node {
+            ExprType::Integer(val) => {
+                let dst = self.target(dst)?;
+                self.add_instruction(code, BytecodeType::RegLoadInt { dst, val: *val }, location);
+                Ok(dst)
+            }
+            ExprType::Float(_) => todo!(),
+            ExprType::Bool(val) => {
+                let dst = self.target(dst)?;
+                self.add_instruction(code, BytecodeType::RegLoadBool { dst, val: *val }, location);
+                Ok(dst)
+            }
+            ExprType::NoneVal => {
+                let dst = self.target(dst)?;
+                self.add_instruction(code, BytecodeType::RegLoadNone { dst }, location);
+                Ok(dst)
+            }
+            ExprType::String(lit) => {
+                let idx = self.constant_pool.add(Object::from(lit.clone()));
+                let dst = self.target(dst)?;
+                self.add_instruction(code, BytecodeType::RegLoadLiteral { dst, idx }, location);
+                Ok(dst)
+            }
+            ExprType::Block(stmts, expr) => {
+                // The result slot has to be allocated outside of the block scope.
+                let dst = self.target(dst)?;
+                self.enter_scope();
+                self.compile_block(stmts, code)?;
+                self.compile_expr(expr, Some(dst), code)?;
+                self.leave_scope();
+                Ok(dst)
+            }
+            ExprType::List { values } => {
+                let cnt = values
+                    .len()
+                    .try_into()
+                    .map_err(|_| "List literal can have at most 2^16 values.")?;
+                // The values are evaluated into consecutive temporaries
+                let base = self.next_reg;
+                let mut regs = vec![];
+                for _ in values {
+                    regs.push(self.alloc()?);
+                }
+                for (value, reg) in values.iter().zip(regs) {
+                    self.compile_expr(value, Some(reg), code)?;
+                }
+                self.free_to(base);
+                let dst = self.target(dst)?;
+                self.add_instruction(code, BytecodeType::RegNewList { dst, base, cnt }, location);
+                Ok(dst)
+            }
+            ExprType::AccessVariable { name } => {
+                if let Some(local) = self.fetch_local(name) {
+                    match dst {
+                        Some(dst) if dst != local.idx => {
+                            self.add_instruction(
+                                code,
+                                BytecodeType::RegMove {
+                                    dst,
+                                    src: local.idx,
+                                },
+                                location,
+                            );
+                            Ok(dst)
+                        }
+                        _ => Ok(local.idx),
+                    }
+                } else {
+                    let name = self.constant_pool.add(Object::from(name.clone()));
+                    let dst = self.target(dst)?;
+                    self.add_instruction(code, BytecodeType::RegGetGlobal { dst, name }, location);
+                    Ok(dst)
+                }
+            }
+            ExprType::AccessList { list, index } => {
+                let mark = self.next_reg;
+                let list = self.compile_operand(list, &[index], code)?;
+                let index = self.compile_expr(index, None, code)?;
+                self.free_to(mark);
+                let dst = self.target(dst)?;
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegGetIndex { dst, list, index },
+                    location,
+                );
+                Ok(dst)
+            }
+            ExprType::CallFunction { name, arguments } if builtin_arity(name).is_some() => {
+                check_builtin_arity(name, arguments.len())?;
+                let mark = self.next_reg;
+                let rest: Vec<&Expr> = arguments[1..].iter().collect();
+                let list = self.compile_operand(&arguments[0], &rest, code)?;
+                let val = match arguments.get(1) {
+                    Some(arg) => Some(self.compile_expr(arg, None, code)?),
+                    None => None,
+                };
+                self.free_to(mark);
+                let dst = self.target(dst)?;
+                let instr = match val {
+                    Some(val) => BytecodeType::RegListAppend { dst, list, val },
+                    None => BytecodeType::RegListLen { dst, src: list },
+                };
+                self.add_instruction(code, instr, location);
+                Ok(dst)
+            }
+            ExprType::CallFunction { name, arguments } => {
+                let arg_cnt: u8 = arguments.len().try_into().unwrap();
+                // TODO: Hardcoded native print
+                let is_print = name == "print";
+                let mark = self.next_reg;
+                let base = self.call_base(dst)?;
+                let mut args = vec![];
+                for i in 0..arguments.len() {
+                    // Format string of print is in the base slot
+                    if is_print && i == 0 {
+                        args.push(base);
+                    } else {
+                        args.push(self.alloc()?);
+                    }
+                }
+                // Arguments are evaluated from the last one, same as in the stack code.
+                for (arg, reg) in arguments.iter().zip(args).rev() {
+                    self.compile_expr(arg, Some(reg), code)?;
+                }
+                if is_print {
+                    self.add_instruction(code, BytecodeType::RegPrint { base, arg_cnt }, location);
+                } else {
+                    let name = self.constant_pool.add(Object::from(name.clone()));
+                    self.add_instruction(
+                        code,
+                        BytecodeType::RegGetGlobal { dst: base, name },
+                        location,
+                    );
+                    self.add_instruction(code, BytecodeType::RegCall { base, arg_cnt }, location);
+                }
+                self.finish_call(mark, base, dst, location, code)
+            }
+            ExprType::MethodCall {
+                left,
+                name,
+                arguments,
+            } => {
+                let mark = self.next_reg;
+                let base = self.call_base(dst)?;
+                let mut args = vec![];
+                for _ in arguments {
+                    args.push(self.alloc()?);
+                }
+                for (arg, reg) in arguments.iter().zip(args).rev() {
+                    self.compile_expr(arg, Some(reg), code)?;
+                }
+                self.compile_expr(left, Some(base), code)?;
+                let name = self.constant_pool.add(Object::from(name.clone()));
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegDispatchMethod {
+                        base,
+                        name,
+                        arg_cnt: (arguments.len() + 1).try_into().unwrap(),
+                    },
+                    location,
+                );
+                self.finish_call(mark, base, dst, location, code)
+            }
+            ExprType::Conditional {
+                guard,
+                then_branch,
+                else_branch,
+            } => {
+                let dst = self.target(dst)?;
+                let label_else = self.label_generator.get_label("if_else");
+                let label_end = self.label_generator.get_label("if_merge");
+                let mark = self.next_reg;
+                let cond = self.compile_expr(guard, None, code)?;
+                self.free_to(mark);
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegBranchLabelFalse {
+                        cond,
+                        label: label_else.clone(),
+                    },
+                    location,
+                );
+                self.compile_expr(then_branch, Some(dst), code)?;
+                self.add_instruction(code, BytecodeType::JmpLabel(label_end.clone()), location);
+                self.add_instruction(code, BytecodeType::Label(label_else), location);
+                if let Some(else_body) = else_branch {
+                    self.compile_expr(else_body, Some(dst), code)?;
+                } else {
+                    self.add_instruction(code, BytecodeType::RegLoadNone { dst }, location);
+                }
+                self.add_instruction(code, BytecodeType::Label(label_end), location);
+                Ok(dst)
+            }
+            ExprType::Operator { op, arguments } => {
+                check_operator_arity(op, arguments.len())?;
+                let mark = self.next_reg;
+                if let Opcode::Negate = op {
+                    let src = self.compile_expr(&arguments[0], None, code)?;
+                    self.free_to(mark);
+                    let dst = self.target(dst)?;
+                    self.add_instruction(code, BytecodeType::RegNegate { dst, src }, location);
+                    return Ok(dst);
+                }
+                // Right operand is evaluated first, same as in the stack code.
+                let rhs = self.compile_operand(&arguments[1], &[&arguments[0]], code)?;
+                let lhs = self.compile_expr(&arguments[0], None, code)?;
+                self.free_to(mark);
+                let dst = self.target(dst)?;
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegBinary {
+                        op: *op,
+                        dst,
+                        lhs,
+                        rhs,
+                    },
+                    location,
+                );
+                Ok(dst)
+            }
+            ExprType::MemberRead { left, right } => {
+                let mark = self.next_reg;
+                let obj = self.compile_expr(left, None, code)?;
+                self.free_to(mark);
+                let name = self.constant_pool.add(Object::from(right.clone()));
+                let dst = self.target(dst)?;
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegGetMember { dst, obj, name },
+                    location,
+                );
+                Ok(dst)
+            }
+        }
+    }
+
+    /// Compiles 'expr' which is evaluated before the expressions in 'next'.
+    /// If any of them can assign to local variables the value is copied into
+    /// temporary, so that it is not changed before it is used.
+    fn compile_operand(
+        &mut self,
+        expr: &Expr,
+        next: &[&Expr],
+        code: &mut Code,
+    ) -> Result<Reg, &'static str> {
+        let is_local = match &expr.node {
+            ExprType::AccessVariable { name } => self.fetch_local(name).is_some(),
+            _ => false,
+        };
+        let reg = self.compile_expr(expr, None, code)?;
+        if is_local && next.iter().any(|e| writes_locals(e)) {
+            let tmp = self.alloc()?;
+            self.add_instruction(
+                code,
+                BytecodeType::RegMove { dst: tmp, src: reg },
+                expr.location,
+            );
+            return Ok(tmp);
+        }
+        Ok(reg)
+    }
+
+    /// Returns base slot for a call. If the destination is the topmost used
+    /// slot the call can use it directly, the arguments are placed above it.
+    fn call_base(&mut self, dst: Option<Reg>) -> Result<Reg, &'static str> {
+        match dst {
+            Some(dst) if dst + 1 == self.next_reg => Ok(dst),
+            _ => self.alloc(),
+        }
+    }
+
+    /// Frees temporaries of the call and moves the result from 'base' to 'dst'.
+    fn finish_call(
+        &mut self,
+        mark: Reg,
+        base: Reg,
+        dst: Option<Reg>,
+        location: CodeLocation,
+        code: &mut Code,
+    ) -> Result<Reg, &'static str> {
+        match dst {
+            Some(dst) => {
+                self.free_to(mark);
+                if dst != base {
+                    self.add_instruction(code, BytecodeType::RegMove { dst, src: base }, location);
+                }
+                Ok(dst)
+            }
+            None => {
+                self.free_to(base + 1);
+                Ok(base)
+            }
+        }
+    }
+
+    fn compile_block(&mut self, stmts: &[Stmt], code: &mut Code) -> Result<(), &'static str> {
+        for stmt in stmts {
+            self.compile_stmt(stmt, code)?;
+        }
+        Ok(())
+    }
+
+    fn compile_stmt(&mut self, ast: &Stmt, code: &mut Code) -> Result<(), &'static str> {
+        let location = ast.location;
+        match &ast.node {
+            StmtType::Variable {
+                name,
+                mutable,
+                value,
+            } => {
+                check_not_builtin(name)?;
+                match self.location {
+                    Location::Global => {
+                        let mark = self.next_reg;
+                        let src = self.compile_expr(value, None, code)?;
+                        self.free_to(mark);
+                        let name = self.constant_pool.add(Object::from(name.clone()));
+                        let instr = if *mutable {
+                            BytecodeType::RegDeclVarGlobal { src, name }
+                        } else {
+                            BytecodeType::RegDeclValGlobal { src, name }
+                        };
+                        self.add_instruction(code, instr, location);
+                    }
+                    Location::Local(_) => {
+                        let reg = self.alloc()?;
+                        self.compile_expr(value, Some(reg), code)?;
+                        if let Location::Local(env) = &mut self.location {
+                            env.add_local(name.clone(), reg, *mutable)?;
+                        }
+                    }
+                    Location::Class(_) => todo!(),
+                }
+            }
+            StmtType::AssignVariable { name, value } => {
+                check_not_builtin(name)?;
+                if let Some(Local { idx, mutable }) = self.fetch_local(name) {
+                    if !mutable {
+                        return Err("Variable is declared immutable.");
+                    }
+                    let mark = self.next_reg;
+                    self.compile_expr(value, Some(idx), code)?;
+                    self.free_to(mark);
+                } else {
+                    let mark = self.next_reg;
+                    let src = self.compile_expr(value, None, code)?;
+                    self.free_to(mark);
+                    let name = self.constant_pool.add(Object::from(name.clone()));
+                    self.add_instruction(code, BytecodeType::RegSetGlobal { src, name }, location);
+                }
+            }
+            StmtType::AssignList { list, index, value } => {
+                let mark = self.next_reg;
+                let val = self.compile_operand(value, &[list, index], code)?;
+                let list = self.compile_operand(list, &[index], code)?;
+                let index = self.compile_expr(index, None, code)?;
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegSetIndex { list, index, val },
+                    location,
+                );
+                self.free_to(mark);
+            }
+            StmtType::Function {
+                name,
+                parameters,
+                body,
+            } => {
+                check_not_builtin(name)?;
+                let name_idx = self.constant_pool.add(Object::from(name.clone()));
+                let fun = self.compile_fun(name_idx, parameters, body)?;
+                let fun_idx = self.constant_pool.add(Object::Function(fun));
+                self.emit_function_def(name_idx, fun_idx, location, code)?;
+            }
+            StmtType::Top(stmts) => self.compile_block(stmts, code)?,
+            StmtType::While { guard, body } => todo!(),
+            StmtType::Return(_) => todo!(),
+            StmtType::Expression(expr) => {
+                let mark = self.next_reg;
+                self.compile_expr(expr, None, code)?;
+                self.free_to(mark);
+            }
+            StmtType::Class { name, statements } => {
+                check_not_builtin(name)?;
+                let name_idx = self.constant_pool.add(Object::from(name.clone()));
+
+                let mut methods: Vec<ConstantPoolIndex> = vec![];
+                let mut constructor_args: Option<u8> = None;
+
+                for stmt in statements {
+                    match &stmt.node {
+                        StmtType::Function {
+                            name,
+                            parameters,
+                            body,
+                        } => {
+                            let name_idx = self.constant_pool.add(Object::from(name.clone()));
+                            let method = if name == "init" {
+                                constructor_args = Some(parameters.len().try_into().unwrap());
+                                self.compile_fun(name_idx, parameters, &constructor_body(body)?)?
+                            } else {
+                                self.compile_fun(name_idx, parameters, body)?
+                            };
+                            methods.push(self.constant_pool.add(Object::Function(method)));
+                        }
+                        StmtType::Class { .. } => todo!("Nested classes are not yet supported"),
+                        _ => panic!("Class can only contain method or member definitions."),
+                    };
+                }
+                let init_idx = self.constant_pool.add(Object::from(String::from("init")));
+                let class_idx = self.constant_pool.add(Object::Class {
+                    name: name_idx,
+                    methods,
+                });
+
+                // The proxy constructor (see the stack compiler) receives the arguments
+                // in its first slots. They are shifted by one to make place for
+                // the new object, which is then passed to 'init' as 'self'.
+                let parameters_cnt = constructor_args.unwrap_or(1) - 1;
+                let mut constructor = Code::new();
+                for i in (0..parameters_cnt as Reg).rev() {
+                    self.add_instruction(
+                        &mut constructor,
+                        BytecodeType::RegMove { dst: i + 1, src: i },
+                        CodeLocation(0, 0),
+                    );
+                }
+                self.add_instruction(
+                    &mut constructor,
+                    BytecodeType::RegNewObject {
+                        dst: 0,
+                        class: class_idx,
+                    },
+                    CodeLocation(0, 0),
+                );
+                if let Some(arg_cnt) = constructor_args {
+                    self.add_instruction(
+                        &mut constructor,
+                        BytecodeType::RegDispatchMethod {
+                            base: 0,
+                            name: init_idx,
+                            arg_cnt,
+                        },
+                        CodeLocation(0, 0),
+                    );
+                }
+                self.add_instruction(
+                    &mut constructor,
+                    BytecodeType::RegRet(0),
+                    CodeLocation(0, 0),
+                );
+
+                let cons_fun = Function {
+                    name: name_idx,
+                    parameters_cnt,
+                    locals_cnt: parameters_cnt as Reg + 1,
+                    body: constructor,
+                };
+                let constructor_idx = self.constant_pool.add(Object::Function(cons_fun));
+                self.emit_function_def(name_idx, constructor_idx, location, code)?;
+            }
+            StmtType::MemberStore { left, right, val } => {
+                let mark = self.next_reg;
+                let val_reg = self.compile_operand(val, &[left], code)?;
+                let obj = self.compile_expr(left, None, code)?;
+                let name = self.constant_pool.add(Object::from(right.clone()));
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegSetMember {
+                        obj,
+                        val: val_reg,
+                        name,
+                    },
+                    location,
+                );
+                self.free_to(mark);
+            }
+        };
+        Ok(())
+    }
+
+    fn emit_function_def(
+        &mut self,
+        name: ConstantPoolIndex,
+        fun: ConstantPoolIndex,
+        location: CodeLocation,
+        code: &mut Code,
+    ) -> Result<(), &'static str> {
+        match self.location {
+            Location::Global => {
+                let mark = self.next_reg;
+                let src = self.alloc()?;
+                self.add_instruction(
+                    code,
+                    BytecodeType::RegLoadLiteral { dst: src, idx: fun },
+                    location,
+                );
+                self.add_instruction(code, BytecodeType::RegDeclValGlobal { src, name }, location);
+                self.free_to(mark);
+            }
+            Location::Local(_) => todo!("Nested functions are not yet implemented"),
+            Location::Class(_) => unreachable!(),
+        };
+        Ok(())
+    }
+
+    fn compile_fun(
+        &mut self,
+        name: ConstantPoolIndex,
+        parameters: &[String],
+        body: &Expr,
+    ) -> Result<Function, &'static str> {
+        let backup = (self.next_reg, self.reg_max);
+        self.next_reg = 0;
+        self.reg_max = 0;
+
+        self.enter_scope();
+        // Parameters are in the first slots of the frame
+        for par in parameters {
+            check_not_builtin(par)?;
+            let reg = self.alloc()?;
+            if let Location::Local(env) = &mut self.location {
+                env.add_local(par.clone(), reg, false)?;
+            }
+        }
+        let mut code = Code::new();
+        let ret = self.compile_expr(body, None, &mut code)?;
+        self.add_instruction(&mut code, BytecodeType::RegRet(ret), body.location);
+        self.leave_scope();
+
+        let fun = Function {
+            name,
+            parameters_cnt: parameters.len().try_into().unwrap(),
+            locals_cnt: self.reg_max,
+            body: code,
+        };
+        self.next_reg = backup.0;
+        self.reg_max = backup.1;
+        Ok(fun)
+    }
+}
+
+/// Returns true if evaluation of the expression can assign to local
+/// variables of the current function.
+fn writes_locals(expr: &Expr) -> bool {
+    match &expr.node {
+        ExprType::Block(stmts, expr) => !stmts.is_empty() || writes_locals(expr),
+        ExprType::Conditional {
+            guard,
+            then_branch,
+            else_branch,
+        } => {
+            writes_locals(guard)
+                || writes_locals(then_branch)
+                || else_branch.as_ref().map_or(false, |e| writes_locals(e))
+        }
+        ExprType::Operator { arguments, .. } | ExprType::CallFunction { arguments, .. } => {
+            arguments.iter().any(writes_locals)
+        }
+        ExprType::MethodCall {
+            left, arguments, ..
+        } => writes_locals(left) || arguments.iter().any(writes_locals),
+        ExprType::MemberRead { left, .. } => writes_locals(left),
+        ExprType::List { values } => values.iter().any(writes_locals),
+        ExprType::AccessList { list, index } => writes_locals(list) || writes_locals(index),
+        _ => false,
+    }
+}
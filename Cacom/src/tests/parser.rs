@@ -153,4 +153,18 @@ mod parser_tests {
         assert!(TopLevelParser::new().parse("1.foo();").is_ok());
         assert!(TopLevelParser::new().parse("\"Hello\".foo();").is_ok());
     }
+
+    #[test]
+    fn lists() {
+        assert!(TopLevelParser::new().parse("[]").is_ok());
+        assert!(TopLevelParser::new().parse("[1, 2, 3]").is_ok());
+        assert!(TopLevelParser::new().parse("[1, [2], x.y]").is_ok());
+        assert!(TopLevelParser::new().parse("x[0]").is_ok());
+        assert!(TopLevelParser::new().parse("x[0][1] + x.y[2]").is_ok());
+        assert!(TopLevelParser::new().parse("[1, 2][0]").is_ok());
+        assert!(TopLevelParser::new().parse("x[0] = 1").is_ok());
+        assert!(TopLevelParser::new().parse("x.y[i + 1] = [1]").is_ok());
+        assert!(TopLevelParser::new().parse("x[]").is_err());
+        assert!(TopLevelParser::new().parse("[1, 2").is_err());
+    }
 }
@@ -7,6 +7,7 @@ NC='\033[0m'
 if [[ "$#" -ne 2 ]]; then
     echo "usage: run_tests.sh compiler vm"
     echo "  Must be run in the tests directory"
+    echo "  Additional compiler flags can be passed in CACOM_FLAGS variable"
     exit 1;
 fi
 
@@ -24,7 +25,7 @@ for file in expected/*.exp; do
     echo "Running test ${file}"
 
     # Run compiler
-    ${COMPILER} compile --input-file ${file}.cml;
+    ${COMPILER} compile ${CACOM_FLAGS} --input-file ${file}.cml;
     if [[ $? -ne 0 ]]; then
         printf "${RED}Test ${file} failed - Compilation failed${NC}\n";
         continue;